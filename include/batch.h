@@ -0,0 +1,412 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <chip8.h>
+#include <jit.h>
+#include <headless.h>
+#include <lockstep.h>
+#include <bit_utility.h>
+
+/*
+ Run many independent (rom, key script, cycle budget) jobs on every core.
+
+ - the roms are read once and shared read-only by the jobs (batch_rom_t)
+ - every worker owns one chip8_t of a pooled arena, reinitialized in place for each job (chip_init()),
+   and optionally a jit which is reset instead of being mmap'd again
+ - the jobs (tasks, see below) are dealt round robin to per-worker deques: a worker pops from the tail of its own one
+   and when it's empty steals from the head of the others. Head and tail live in the same 64 bit word
+   so both ends are a single CAS, no locks. Jobs never spawn other jobs, once every deque is empty the worker quits.
+ - nothing is shared between the vm: per-instance rng (chip_seed()), results written in place in the job
+ - with opts.lockstep the jobs with the same rom and budget are grouped LOCKSTEP_LANES at a time
+   and every group runs in the vector lanes of a lockstep_t (lockstep.h), one per worker as well
+ - every job runs with the quirk profile of its rom (quirks.h), the jit and lockstep only have the default one:
+   the jobs with another profile go through the interpreter
+*/
+
+typedef struct {
+    uint8_t data[CHIP_ROM_MAX];
+    uint16_t size;
+    uint16_t ipf;   // 0 -> opts.ipf, es. the one of a rom pack (rompack.h)
+    uint8_t quirks; // CHIP_QUIRKS_DEFAULT -> opts.quirks, same
+} batch_rom_t;
+
+// the screen of a job at its end (es. to look at it), only for the jobs which ask for it
+typedef struct {
+    uint64_t plane[SCREEN_PLANES][SCREEN_HEIGHT][SCREEN_WORDS];
+    uint8_t planes_used;
+    bool hires;
+} batch_screen_t;
+
+typedef struct {
+
+    const batch_rom_t *rom;
+    const key_event_t *keys; // sorted by frame
+    size_t keys_len;
+    uint64_t max_cycles;
+    uint64_t seed;
+    batch_screen_t *screen; // optional
+
+    // filled by batch_run()
+    headless_result_t result;
+    uint64_t screen_hash;
+    uint8_t V[REG_LEN];
+    uint16_t I, PC;
+    uint16_t bad_opcode; // the first 0NNN or instruction which isn't one the rom executed, when bad
+    bool bad;
+    bool ok;
+
+} batch_job_t;
+
+typedef struct {
+    uint32_t threads; // 0 -> one per online cpu
+    uint32_t ipf;
+    chip_quirks_t quirks; // of the roms without their own
+    bool jit;
+    bool lockstep; // the jit is not used
+    bool idle;     // fast forward the idle loops of the interpreter (idle.h), same results
+} batch_opts_t;
+
+// jobs order[first] .. order[first + len - 1], more than one only in lockstep
+typedef struct {
+    uint32_t first, len;
+} batch_task_t;
+
+typedef struct {
+    alignas(64) _Atomic uint64_t span; // low 32 bits: head (thieves), high 32 bits: tail (owner)
+    uint32_t *items;                    // task indexes, immutable once dealt
+} batch_deque_t;
+
+typedef struct {
+    batch_deque_t deque;
+    pthread_t thread;
+    uint32_t id;
+
+    struct batch *batch;
+    chip8_t *chip; // in the arena
+    chip_jit_t *jit;
+    lockstep_t *lockstep;
+} batch_worker_t;
+
+typedef struct batch {
+    batch_job_t *jobs;
+    const batch_opts_t *opts;
+
+    const batch_task_t *tasks;
+    const uint32_t *order;
+
+    batch_worker_t *workers;
+    uint32_t workers_len;
+} batch_t;
+
+
+#define BATCH_SPAN(head, tail) ((uint64_t)(tail) << 32 | (uint32_t)(head))
+
+// owner side: take the newest task
+static bool batch_deque_pop(batch_deque_t *self, uint32_t *task) {
+
+    uint64_t span = atomic_load_explicit(&self->span, memory_order_acquire);
+    for (;;) {
+        const uint32_t head = span, tail = span >> 32;
+        if (head >= tail) return false;
+
+        // on failure span is reloaded, someone stole meanwhile
+        if (atomic_compare_exchange_weak_explicit(&self->span, &span, BATCH_SPAN(head, tail - 1), memory_order_acq_rel, memory_order_acquire)) {
+            *task = self->items[tail - 1];
+            return true;
+        }
+    }
+}
+
+// thief side: take the oldest task
+static bool batch_deque_steal(batch_deque_t *self, uint32_t *task) {
+
+    uint64_t span = atomic_load_explicit(&self->span, memory_order_acquire);
+    for (;;) {
+        const uint32_t head = span, tail = span >> 32;
+        if (head >= tail) return false;
+
+        if (atomic_compare_exchange_weak_explicit(&self->span, &span, BATCH_SPAN(head + 1, tail), memory_order_acq_rel, memory_order_acquire)) {
+            *task = self->items[head];
+            return true;
+        }
+    }
+}
+
+static bool batch_next_task(batch_worker_t *self, uint32_t *task) {
+
+    if (LIKELY(batch_deque_pop(&self->deque, task)))
+        return true;
+
+    const batch_t *batch = self->batch;
+    for (uint32_t i = 1; i < batch->workers_len; ++i)
+        if (batch_deque_steal(&batch->workers[(self->id + i) % batch->workers_len].deque, task))
+            return true;
+
+    return false;
+}
+
+static void batch_job_done(batch_job_t *job, const chip8_t *chip) {
+
+    job->screen_hash = chip_screen_hash(chip);
+    memcpy(job->V, chip->V, sizeof(job->V));
+    job->I  = chip->I;
+    job->PC = chip->PC;
+    job->bad        = !!chip->bad_opcodes.count;
+    job->bad_opcode = chip->bad_opcodes.first;
+
+    if (job->screen) {
+        memcpy(job->screen->plane, chip->plane, sizeof(job->screen->plane));
+        job->screen->planes_used = chip->planes_used;
+        job->screen->hires       = chip->hires;
+    }
+}
+
+static chip_quirks_t batch_quirks(const batch_t *self, const batch_rom_t *rom) {
+    return rom->quirks != CHIP_QUIRKS_DEFAULT ? rom->quirks : self->opts->quirks;
+}
+
+static void batch_exec_job(batch_worker_t *self, batch_job_t *job) {
+
+    const chip_quirks_t quirks = batch_quirks(self->batch, job->rom);
+    chip_jit_t *const jit = quirks == CHIP_QUIRKS_DEFAULT ? self->jit : NULL;
+
+    chip8_t *chip = self->chip;
+    chip_init(chip);
+    chip_seed(chip, job->seed);
+
+    if (jit)
+        chip_jit_reset(jit);
+
+    if (!(job->ok = chip_set_quirks(chip, quirks) && chip_load_rom_mem(chip, job->rom->data, job->rom->size)))
+        return;
+
+    const headless_opts_t opts = {
+        .keys       = job->keys,
+        .keys_len   = job->keys_len,
+        .max_cycles = job->max_cycles,
+        .ipf        = job->rom->ipf ? job->rom->ipf : self->batch->opts->ipf,
+        .jit        = jit,
+        .idle       = self->batch->opts->idle && !jit,
+    };
+
+    headless_run(chip, &opts, &job->result);
+    batch_job_done(job, chip);
+}
+
+// same frames of headless_run() but for a group of jobs sharing rom and budget
+static void batch_exec_lockstep(batch_worker_t *self, const uint32_t *order, uint32_t len) {
+
+    batch_job_t *const jobs = self->batch->jobs;
+    const batch_job_t *first = jobs + order[0];
+    const uint32_t ipf = first->rom->ipf ? first->rom->ipf : self->batch->opts->ipf;
+
+    lockstep_t *ls = self->lockstep;
+    if (!lockstep_load_rom_mem(ls, first->rom->data, first->rom->size, len)) {
+        for (uint32_t l = 0; l < len; ++l)
+            jobs[order[l]].ok = false;
+        return;
+    }
+
+    size_t next_key[LOCKSTEP_LANES] = {0};
+    for (uint32_t l = 0; l < len; ++l)
+        lockstep_seed(ls, l, jobs[order[l]].seed);
+
+    struct timespec beg, end;
+    clock_gettime(CLOCK_MONOTONIC, &beg);
+
+    headless_result_t result = {0};
+    while (result.cycles < first->max_cycles) {
+
+        for (uint32_t l = 0; l < len; ++l) {
+            const batch_job_t *job = jobs + order[l];
+            for (; next_key[l] < job->keys_len && job->keys[next_key[l]].frame <= result.frames; ++next_key[l])
+                lockstep_press_key(ls, l, job->keys[next_key[l]].key, job->keys[next_key[l]].state);
+        }
+
+        const uint64_t left = first->max_cycles - result.cycles;
+        const uint32_t budget = left < ipf ? left : ipf;
+        lockstep_run(ls, budget);
+
+        // while waiting a key the frame goes on anyway
+        result.cycles += budget;
+        if (budget < ipf) break;
+
+        result.frames++;
+        lockstep_tick(ls);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result.seconds = (end.tv_sec - beg.tv_sec) + (end.tv_nsec - beg.tv_nsec) / 1.0e9;
+
+    for (uint32_t l = 0; l < len; ++l) {
+        batch_job_t *job = jobs + order[l];
+        const chip8_t *chip = lockstep_lane(ls, l);
+
+        job->ok     = true;
+        job->result = result;
+        batch_job_done(job, chip);
+    }
+}
+
+static void * batch_worker(void *arg) {
+
+    batch_worker_t *self = arg;
+    const batch_t *batch = self->batch;
+
+    // NULL -> interpreter, jobs one at a time
+    if (batch->opts->lockstep)
+        self->lockstep = lockstep_new();
+    else if (batch->opts->jit)
+        self->jit = chip_jit_new(self->chip);
+
+    for (uint32_t t; batch_next_task(self, &t); ) {
+        const batch_task_t *task = batch->tasks + t;
+
+        // a group shares the rom, so the profile too
+        if (self->lockstep && batch_quirks(batch, batch->jobs[batch->order[task->first]].rom) == CHIP_QUIRKS_DEFAULT) {
+            batch_exec_lockstep(self, batch->order + task->first, task->len);
+            continue;
+        }
+
+        for (uint32_t i = 0; i < task->len; ++i)
+            batch_exec_job(self, batch->jobs + batch->order[task->first + i]);
+    }
+
+    lockstep_free(self->lockstep);
+    chip_jit_free(self->jit);
+    chip_release(self->chip); // the 64 KB of the XO-CHIP jobs
+    return NULL;
+}
+
+typedef struct {
+    const batch_rom_t *rom;
+    uint64_t max_cycles;
+    uint32_t idx;
+} batch_group_key_t;
+
+static int batch_group_cmp(const void *a, const void *b) {
+    const batch_group_key_t *l = a, *r = b;
+    if (l->rom != r->rom) return (l->rom > r->rom) - (l->rom < r->rom);
+    if (l->max_cycles != r->max_cycles) return (l->max_cycles > r->max_cycles) - (l->max_cycles < r->max_cycles);
+    return (l->idx > r->idx) - (l->idx < r->idx);
+}
+
+// one task per job, or per group of at most LOCKSTEP_LANES jobs with the same rom and budget. Return the tasks count
+static uint32_t batch_make_tasks(const batch_job_t *jobs, uint32_t jobs_len, bool lockstep, uint32_t *order, batch_task_t *tasks) {
+
+    if (!lockstep) {
+        for (uint32_t i = 0; i < jobs_len; ++i)
+            order[i] = i, tasks[i] = (batch_task_t){ .first = i, .len = 1 };
+        return jobs_len;
+    }
+
+    batch_group_key_t *keys;
+    if (!(keys = malloc(sizeof(batch_group_key_t) * (jobs_len ? jobs_len : 1))))
+        return 0;
+
+    for (uint32_t i = 0; i < jobs_len; ++i)
+        keys[i] = (batch_group_key_t){ .rom = jobs[i].rom, .max_cycles = jobs[i].max_cycles, .idx = i };
+
+    qsort(keys, jobs_len, sizeof(batch_group_key_t), batch_group_cmp);
+
+    uint32_t tasks_len = 0;
+    for (uint32_t i = 0; i < jobs_len; ++i) {
+
+        order[i] = keys[i].idx;
+
+        batch_task_t *last = tasks_len ? tasks + tasks_len - 1 : NULL;
+        if (last && last->len < LOCKSTEP_LANES && keys[last->first].rom == keys[i].rom && keys[last->first].max_cycles == keys[i].max_cycles)
+            last->len++;
+        else
+            tasks[tasks_len++] = (batch_task_t){ .first = i, .len = 1 };
+    }
+
+    free(keys);
+    return tasks_len;
+}
+
+// run every job, the results are stored in the jobs themselves. Return false if the pool can't be set up
+bool batch_run(batch_job_t *jobs, uint32_t jobs_len, const batch_opts_t *opts) {
+
+    assert(opts->ipf);
+    assert(!opts->lockstep || opts->ipf <= UINT16_MAX);
+
+    const size_t alloc_len = jobs_len ? jobs_len : 1;
+    uint32_t *order      = malloc(sizeof(uint32_t) * alloc_len);
+    batch_task_t *tasks  = malloc(sizeof(batch_task_t) * alloc_len);
+    uint32_t *items      = malloc(sizeof(uint32_t) * alloc_len);
+    const uint32_t tasks_len = order && tasks && items ? batch_make_tasks(jobs, jobs_len, opts->lockstep, order, tasks) : 0;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t threads = opts->threads ? opts->threads : cpus > 0 ? (uint32_t)cpus : 1;
+    if (threads > tasks_len) threads = tasks_len ? tasks_len : 1;
+
+    batch_t batch = { .jobs = jobs, .opts = opts, .tasks = tasks, .order = order, .workers_len = threads };
+
+    // the pool: one vm per worker for the whole batch, not one per job
+    chip8_t *arena       = aligned_alloc(64, (sizeof(chip8_t) + 63) / 64 * 64 * threads);
+    batch_worker_t *pool = aligned_alloc(64, (sizeof(batch_worker_t) * threads + 63) / 64 * 64);
+
+    if (!arena || !pool || !order || !tasks || !items || (jobs_len && !tasks_len)) {
+        free(arena), free(pool), free(items), free(tasks), free(order);
+        return false;
+    }
+
+    batch.workers = pool;
+
+    // deal the tasks round robin: items of worker w are contiguous, [per_worker * w, per_worker * w + count)
+    const uint32_t per_worker = (tasks_len + threads - 1) / threads;
+    for (uint32_t w = 0; w < threads; ++w) {
+
+        batch_worker_t *worker = pool + w;
+        memset(worker, 0x00, sizeof(*worker));
+
+        worker->id    = w;
+        worker->batch = &batch;
+        worker->chip  = (chip8_t *)((uint8_t *)arena + (sizeof(chip8_t) + 63) / 64 * 64 * w);
+        worker->chip->xo = NULL; // see chip_init()
+        worker->deque.items = items + per_worker * w;
+
+        uint32_t count = 0;
+        for (uint32_t t = w; t < tasks_len; t += threads)
+            worker->deque.items[count++] = t;
+
+        // pop() takes from the tail: reverse, so each worker starts from its first task
+        for (uint32_t i = 0; i < count / 2; ++i) {
+            const uint32_t tmp = worker->deque.items[i];
+            worker->deque.items[i] = worker->deque.items[count - 1 - i];
+            worker->deque.items[count - 1 - i] = tmp;
+        }
+
+        atomic_init(&worker->deque.span, BATCH_SPAN(0, count));
+    }
+
+    uint32_t started = 0;
+    for (; started < threads; ++started)
+        if (pthread_create(&pool[started].thread, NULL, batch_worker, pool + started))
+            break;
+
+    // not enough threads: the ones running steal the rest, at worst this one does everything
+    if (!started)
+        batch_worker(pool);
+
+    for (uint32_t w = 0; w < started; ++w)
+        pthread_join(pool[w].thread, NULL);
+
+    free(items);
+    free(tasks);
+    free(order);
+    free(pool);
+    free(arena);
+    return true;
+}
+
+#undef BATCH_SPAN
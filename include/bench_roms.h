@@ -0,0 +1,216 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ Small roms for the whole-rom throughput runs of chip8_bench and the checkpoints of chip8_conformance, written for this
+ repo (same MIT license). They never stop and never wait a key (iFX0A), so every budget runs the whole time; each one
+ stresses a different path:
+
+  alu    - 8XY_ arithmetic, skips and jumps: the interpreter dispatch at its cheapest, the result on the screen every 16 rounds
+  draw   - iFX29 + iDXYN of every font glyph on the whole screen, 00E0 every screen
+  bcd    - score counter: iFX33, iFX65, iFX55 (self-modifying from the icache / jit point of view) + 6 glyphs a point
+  calls  - nested 2NNN / 00EE, the counter on the screen every 16 rounds
+  timer  - iCXNN sprites at random positions, busy wait on the delay timer, iEX9E
+  scroll - SUPER-CHIP hi-res 16x16 sprites and scrolls, XO-CHIP F000 NNNN, 5XY2 / 5XY3 and two planes (FN01):
+           every quirk profile runs it (the XO-CHIP opcodes degrade to their CHIP-8 meaning), with different screens
+
+ alu, bcd and calls show a number (V6) as 3 decimal digits through the subroutine at 240 (BENCH_SCORE_SHOW): every digit
+ is drawn again (off, it's a xor) and the new one on, one at a time, the screen is never blank.
+ VC..VE are the digits on the screen, V0..V4 are scratch.
+
+ Any other rom (es. the test suites in the README) can be passed on the command line.
+*/
+
+// 000 at (0, 10), VC..VE are 0 at reset
+#define BENCH_SCORE_INIT \
+    0x64, 0x0A, /* V4 = 10 (y)       */ \
+    0x63, 0x00, /* V3 = 0 (x)        */ \
+    0xFC, 0x29, /* I = font[VC]      */ \
+    0xD3, 0x45, /* draw(V3, V4, 5)   */ \
+    0x73, 0x05, /* V3 += 5           */ \
+    0xD3, 0x45, /* draw(V3, V4, 5)   */ \
+    0x73, 0x05, /* V3 += 5           */ \
+    0xD3, 0x45  /* draw(V3, V4, 5)   */
+
+// 240: the digits of V6 in place of VC..VE
+#define BENCH_SCORE_SHOW \
+    0xA4, 0x00, /* 240: I = 0x400         */ \
+    0xF6, 0x33, /* 242: I[0..2] = bcd(V6) */ \
+    0xF2, 0x65, /* 244: V0..V2 = I[0..2]  */ \
+    0x63, 0x00, /* 246: V3 = 0 (x)        */ \
+    0xFC, 0x29, /* 248: I = font[VC]      */ \
+    0xD3, 0x45, /* 24A: draw(V3, V4, 5)   */ \
+    0xF0, 0x29, /* 24C: I = font[V0]      */ \
+    0xD3, 0x45, /* 24E: draw(V3, V4, 5)   */ \
+    0x73, 0x05, /* 250: V3 += 5           */ \
+    0xFD, 0x29, /* 252: I = font[VD]      */ \
+    0xD3, 0x45, /* 254: draw(V3, V4, 5)   */ \
+    0xF1, 0x29, /* 256: I = font[V1]      */ \
+    0xD3, 0x45, /* 258: draw(V3, V4, 5)   */ \
+    0x73, 0x05, /* 25A: V3 += 5           */ \
+    0xFE, 0x29, /* 25C: I = font[VE]      */ \
+    0xD3, 0x45, /* 25E: draw(V3, V4, 5)   */ \
+    0xF2, 0x29, /* 260: I = font[V2]      */ \
+    0xD3, 0x45, /* 262: draw(V3, V4, 5)   */ \
+    0x8C, 0x00, /* 264: VC = V0           */ \
+    0x8D, 0x10, /* 266: VD = V1           */ \
+    0x8E, 0x20, /* 268: VE = V2           */ \
+    0x00, 0xEE  /* 26A: return            */
+
+typedef struct {
+    const char *name;
+    const uint8_t *data;
+    size_t size;
+} bench_rom_t;
+
+static const uint8_t bench_rom_alu[] = {
+    BENCH_SCORE_INIT, // 200
+    0x66, 0x00, // 210: V6 = 0
+    0x67, 0x01, // 212: V7 = 1
+    0x68, 0x03, // 214: V8 = 3
+    0x86, 0x74, // 216: V6 += V7
+    0x87, 0x84, // 218: V7 += V8
+    0x88, 0x65, // 21A: V8 -= V6
+    0x89, 0x76, // 21C: V9 >>= 1 (V9 = V7 >> 1 with QUIRK_SHIFT_VY)
+    0x89, 0x6E, // 21E: V9 <<= 1 (V9 = V6 << 1 with QUIRK_SHIFT_VY)
+    0x8A, 0x63, // 220: VA ^= V6
+    0x7B, 0x01, // 222: VB += 1
+    0x3B, 0x10, // 224: if (VB == 16) skip
+    0x12, 0x16, // 226: goto 216
+    0x6B, 0x00, // 228: VB = 0
+    0x22, 0x40, // 22A: call 240 (V6 on the screen)
+    0x12, 0x16, // 22C: goto 216
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    BENCH_SCORE_SHOW,
+};
+
+static const uint8_t bench_rom_draw[] = {
+    0x6E, 0x0F, // 200: VE = 0xf
+    0x00, 0xE0, // 202: cls
+    0x61, 0x00, // 204: V1 = 0 (y)
+    0x60, 0x00, // 206: V0 = 0 (x)
+    0xF2, 0x29, // 208: I = font[V2]
+    0xD0, 0x15, // 20A: draw(V0, V1, 5)
+    0x72, 0x01, // 20C: V2 += 1
+    0x82, 0xE2, // 20E: V2 &= VE
+    0x70, 0x05, // 210: V0 += 5
+    0x30, 0x3C, // 212: if (V0 == 60) skip
+    0x12, 0x08, // 214: goto 208
+    0x71, 0x06, // 216: V1 += 6
+    0x31, 0x1E, // 218: if (V1 == 30) skip
+    0x12, 0x06, // 21A: goto 206
+    0x12, 0x02, // 21C: goto 202
+};
+
+static const uint8_t bench_rom_bcd[] = {
+    BENCH_SCORE_INIT, // 200
+    0x76, 0x01, // 210: V6 += 1 (score)
+    0x22, 0x40, // 212: call 240 (the score on the screen: iFX33, iFX65, 3 glyphs off and 3 on)
+    0xA4, 0x10, // 214: I = 0x410
+    0xF2, 0x55, // 216: I[0..2] = V0..V2
+    0x12, 0x10, // 218: goto 210
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    BENCH_SCORE_SHOW,
+};
+
+static const uint8_t bench_rom_calls[] = {
+    BENCH_SCORE_INIT, // 200
+    0x66, 0x00, // 210: V6 = 0
+    0x22, 0x30, // 212: call 230
+    0x22, 0x30, // 214: call 230
+    0x22, 0x38, // 216: call 238
+    0x76, 0x01, // 218: V6 += 1
+    0x7B, 0x01, // 21A: VB += 1
+    0x3B, 0x10, // 21C: if (VB == 16) skip
+    0x12, 0x12, // 21E: goto 212
+    0x6B, 0x00, // 220: VB = 0
+    0x22, 0x40, // 222: call 240 (V6 on the screen)
+    0x12, 0x12, // 224: goto 212
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x22, 0x38, // 230: call 238
+    0x86, 0x74, // 232: V6 += V7
+    0x00, 0xEE, // 234: return
+    0x00, 0x00,
+    0x77, 0x01, // 238: V7 += 1
+    0x88, 0x76, // 23A: V8 >>= 1 (V8 = V7 >> 1 with QUIRK_SHIFT_VY)
+    0x00, 0xEE, // 23C: return
+    0x00, 0x00,
+    BENCH_SCORE_SHOW,
+};
+
+static const uint8_t bench_rom_timer[] = {
+    0xC0, 0x3F, // 200: V0 = rand() & 0x3f
+    0xC1, 0x1F, // 202: V1 = rand() & 0x1f
+    0x62, 0x0A, // 204: V2 = 0xa
+    0xF2, 0x29, // 206: I = font[V2]
+    0xD0, 0x15, // 208: draw(V0, V1, 5)
+    0x63, 0x01, // 20A: V3 = 1
+    0xF3, 0x15, // 20C: delay_timer(V3)
+    0xF4, 0x07, // 20E: V4 = get_delay()
+    0x34, 0x00, // 210: if (V4 == 0) skip
+    0x12, 0x0E, // 212: goto 20E
+    0x65, 0x05, // 214: V5 = 5
+    0xE5, 0x9E, // 216: if (key() == V5) skip
+    0x12, 0x00, // 218: goto 200
+    0x00, 0xE0, // 21A: cls
+    0x12, 0x00, // 21C: goto 200
+};
+
+static const uint8_t bench_rom_scroll[] = {
+    0x00, 0xFF, // 200: hires()
+    0xF3, 0x01, // 202: plane(3) (a single plane without QUIRK_XO)
+    0x60, 0x00, // 204: V0 = 0 (x)
+    0x61, 0x00, // 206: V1 = 0 (y)
+    0x6E, 0x00, // 208: VE = 0 (round)
+    0xF0, 0x00, // 20A: I = 0x240 (F000 NNNN)
+    0x02, 0x40, // 20C
+    0xD0, 0x10, // 20E: draw(V0, V1, 16x16), 32 bytes a plane
+    0x00, 0xC1, // 210: scroll_down(1)
+    0x00, 0xFB, // 212: scroll_right()
+    0x70, 0x0B, // 214: V0 += 11
+    0x71, 0x05, // 216: V1 += 5
+    0xA3, 0x80, // 218: I = 0x380
+    0x50, 0x12, // 21A: save(V0 - V1) (if (V0 == V1) skip without QUIRK_XO)
+    0x7D, 0x01, // 21C: VD += 1
+    0x59, 0x83, // 21E: load(V9 - V8), backwards: V9 = x, V8 = y (if (V9 == V8) skip without QUIRK_XO)
+    0x7D, 0x01, // 220: VD += 1
+    0xFE, 0x29, // 222: I = font[VE]
+    0xD8, 0x95, // 224: draw(V8, V9, 5)
+    0x7E, 0x01, // 226: VE += 1
+    0x4E, 0x10, // 228: if (VE != 16) skip
+    0x12, 0x2E, // 22A: goto 22E
+    0x12, 0x0A, // 22C: goto 20A
+    0x00, 0xFC, // 22E: scroll_left()
+    0x00, 0xD3, // 230: scroll_up(3)
+    0x6E, 0x00, // 232: VE = 0
+    0x12, 0x0A, // 234: goto 20A
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // 240: a ring (plane 0) and a cross (plane 1), 16x16
+    0x07, 0xE0, 0x1F, 0xF8, 0x3C, 0x3C, 0x70, 0x0E,
+    0x60, 0x06, 0xE0, 0x07, 0xC0, 0x03, 0xC0, 0x03,
+    0xC0, 0x03, 0xC0, 0x03, 0xE0, 0x07, 0x60, 0x06,
+    0x70, 0x0E, 0x3C, 0x3C, 0x1F, 0xF8, 0x07, 0xE0,
+    0x80, 0x01, 0x40, 0x02, 0x20, 0x04, 0x10, 0x08,
+    0x08, 0x10, 0x04, 0x20, 0x02, 0x40, 0x01, 0x80,
+    0x01, 0x80, 0x02, 0x40, 0x04, 0x20, 0x08, 0x10,
+    0x10, 0x08, 0x20, 0x04, 0x40, 0x02, 0x80, 0x01,
+};
+
+#define BENCH_ROM(_NAME_) { #_NAME_, bench_rom_##_NAME_, sizeof(bench_rom_##_NAME_) }
+
+static const bench_rom_t bench_roms[] = {
+    BENCH_ROM(alu),
+    BENCH_ROM(draw),
+    BENCH_ROM(bcd),
+    BENCH_ROM(calls),
+    BENCH_ROM(timer),
+    BENCH_ROM(scroll),
+};
+
+#undef BENCH_ROM
+#undef BENCH_SCORE_INIT
+#undef BENCH_SCORE_SHOW
+
+#define BENCH_ROMS_LEN (sizeof(bench_roms) / sizeof(bench_roms[0]))
@@ -73,3 +73,16 @@ static FORCED(inline) bool access_bit(const uint8_t *const restrict v, uint64_t
     const uint64_t byte_idx = bit_index >> 3; // (i/8)
     return (v[byte_idx] >> (7 - (bit_index&7))) & 1; // i&7 -> i%8
 }
+
+// rotate right, pixels shifted out of the right side of a screen row come back on the left
+static FORCED(inline) uint64_t rotr64(uint64_t v, uint8_t n) {
+    return (v >> (n & 63)) | (v << (-n & 63));
+}
+
+// gcc & clang have the 128 bit integers, __extension__ keeps -pedantic quiet
+__extension__ typedef unsigned __int128 uint128_t;
+
+// same on a hi-res row (screen.h)
+static FORCED(inline) uint128_t rotr128(uint128_t v, uint8_t n) {
+    return (v >> (n & 127)) | (v << (-n & 127));
+}
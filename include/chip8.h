@@ -4,6 +4,8 @@
 #include <screen.h>
 
 #include <instruction.h>
+#include <opcodes.h>
+#include <quirks.h>
 #include <dbg.h>
 #include <stdbool.h>
 #include <string.h>
@@ -11,6 +13,15 @@
 #include <file_utility.h>
 #include <font.h>
 #include <stack.h>
+#include <hash.h>
+
+#ifdef CHIP_PROFILE
+#include <profile.h>
+#endif
+
+#ifdef CHIP_TRACE
+#include <trace.h>
+#endif
 
 enum { REG_V0, REG_V1, REG_V2, REG_V3, REG_V4, REG_V5, REG_V6, REG_V7, REG_V8, REG_V9, REG_VA, REG_VB, REG_VC, REG_VD, REG_VE, REG_VF, REG_LEN };
 
@@ -24,15 +35,57 @@ typedef enum { HKEY_0, HKEY_1, HKEY_2, HKEY_3, HKEY_4, HKEY_5, HKEY_6, HKEY_7, H
 
 enum { KEY_UP, KEY_DOWN };
 
+/*
+ XO-CHIP addresses 64 KB, the other profiles the 4 KB of CHIP-8: the PC and I wrap around at CHIP_MEM_SIZE() as they always did.
+ Only a chip with QUIRK_XO pays for the 64 KB and their predecoded instructions (chip_xo_mem_t, ~1 MB),
+ the others keep their 4 KB inside chip8_t: the pools of batch.h and the lanes of lockstep.h stay small.
+*/
+#define CHIP_MEM_MAX 0x10000
+#define CHIP_MEM_MIN 0x1000
+#define CHIP_MEM_SIZE(_QUIRKS_)  ((_QUIRKS_) & QUIRK_XO ? CHIP_MEM_MAX : CHIP_MEM_MIN)
+#define CHIP_ADDR_MASK(_QUIRKS_) (CHIP_MEM_SIZE(_QUIRKS_) - 1)
+
+#define CHIP_ROM_MAX (CHIP_MEM_MAX - 0x200) // 65024 bytes (the rom will be loaded at 0x200 address), 3584 without QUIRK_XO
+
+typedef struct chip8 chip8_t;
+typedef void (*chip_handler_t)(chip8_t *chip, instr_t instr);
+
+/*
+ A predecoded instruction, one slot for every address of the memory.
+ The operands X, Y, N, NN, NNN are already laid out as bitfields of instr, so the handler pointer
+ is everything that chip_exec() would otherwise find in chip_opcode_table (opcodes.h).
+*/
+typedef struct {
+    chip_handler_t exec; // NULL -> not decoded yet or invalidated by a write to the memory
+    instr_t instr;
+    uint8_t step;        // how much the PC moves after exec(): sizeof(instr_t) or 0 for jumps
+    uint8_t op;          // OP_xxx (opcodes.h), the label chip_run() jumps to
+} decoded_t;
+
+// XO-CHIP: the memory and the icache of a chip with QUIRK_XO, allocated by chip_set_quirks()
 typedef struct {
+    alignas(uint16_t) uint8_t memory[CHIP_MEM_MAX];
+    decoded_t icache[CHIP_MEM_MAX];
+} chip_xo_mem_t;
+
+struct chip8 {
+
+    // chip_mem_size() bytes of memory and as many predecoded instructions: the 4 KB below, or the 64 KB of xo with QUIRK_XO
+    uint8_t *memory;
+    decoded_t *icache;
 
     /* CHIP-8 programs should be loaded into memory starting at address 0x200. The memory addresses 0x000 to 0x1FF are reserved for the CHIP-8 interpreter. */
     union {
-        alignas(uint16_t) uint8_t reserved[0x200];   // 512 byte usually untouched by the rom
-        alignas(uint16_t) uint8_t memory[0xfff + 1]; // 4096 bytes of memory
+        alignas(uint16_t) uint8_t reserved[0x200];        // 512 byte usually untouched by the rom
+        alignas(uint16_t) uint8_t memory_4k[CHIP_MEM_MIN]; // 4096 bytes of memory, use chip->memory
     };
 
-    alignas(32) uint8_t screen[SCREEN_WIDTH * SCREEN_HEIGHT];
+    // bit-packed, see screen.h (in lo-res only the top left quarter). screen is plane 0, the only one of CHIP-8 and SUPER-CHIP
+    union {
+        alignas(32) uint64_t screen[SCREEN_HEIGHT][SCREEN_WORDS];
+        alignas(32) uint64_t plane[SCREEN_PLANES][SCREEN_HEIGHT][SCREEN_WORDS];
+    };
+    uint64_t screen_dirty; // bit r set -> row r changed (in any plane) since the last time the frontend showed it (i00E0, iDXYN, the scrolls)
 
     union {
         uint8_t V[REG_LEN]; // 16 data registers
@@ -43,12 +96,9 @@ typedef struct {
     };
 
 
-    // 2**12 -> 4096 possible values from 0 to 2**12-1
-    uint16_t I  : 12; // address register (it can only be loaded with a 12-bit memory address due to the range of memory accessible to CHIP-8)
-    uint16_t    : 4;
-
-    uint16_t PC : 12; // program counter
-    uint16_t    : 4;
+    // the whole 16 bit in XO-CHIP, the handlers of the other profiles keep them below 4096 (CHIP_ADDR_MASK())
+    uint16_t I;  // address register (it can only be loaded with a 12-bit memory address due to the range of memory accessible to CHIP-8)
+    uint16_t PC; // program counter
 
     volatile uint8_t delay_timer;
     volatile uint8_t sound_timer;
@@ -63,31 +113,118 @@ typedef struct {
 
     // use(ful?) metadata
     struct {
-        uint16_t rom_size; // maximum value is 3584 bytes (the rom will be loaded at 0x200 address)
+        uint16_t rom_size; // maximum value is CHIP_ROM_MAX bytes (the rom will be loaded at 0x200 address)
+        uint64_t cycles;   // instructions executed so far
+        uint32_t writes;   // memory, screen and RPL flags writes so far, it wraps (see idle.h)
     };
 
-} chip8_t;
+    // 0NNN and the instructions which aren't one: only the first is printed (on stderr), the frontends report the rest
+    struct {
+        uint32_t count; // executed so far, not the ones fast forwarded by idle.h
+        uint16_t first; // the first one, when count != 0
+    } bad_opcodes;
 
+    // idle.h: chip_run() stops at the backward jumps (CHIP_RUN_LOOP) only in the frames idle_run() looks for idle loops
+    struct {
+        bool probe;      // this frame it looks
+        uint8_t backoff; // frames it doesn't look after one without idle loops, doubled every time (IDLE_BACKOFF_MAX)
+        uint8_t wait;    // frames left before it looks again
+    } idle;
 
-chip8_t * chip_new() {
+    uint64_t rng; // iCXNN, per instance: reproducible and nothing shared between threads (see chip_seed())
+    uint8_t quirks; // CHIP_QUIRKS_xxx (quirks.h): which instance of the handlers runs, see chip_set_quirks()
 
-    chip8_t *self;
+    // SUPER-CHIP
+    bool hires;           // 128x64 screen (i00FF), 64x32 otherwise (i00FE)
+    uint8_t rpl[REG_LEN]; // iFX75, iFX85: the RPL user flags of the HP-48 calculators
 
-    if (!(self = calloc(1, sizeof(chip8_t))))
-        return NULL;
+    // XO-CHIP
+    uint8_t planes;      // iFN01: the planes drawn, cleared and scrolled, bit p -> plane p (only plane 0 otherwise)
+    uint8_t planes_used; // every plane iFN01 ever selected, the others are still blank (the frontends and the hash skip them)
+
+    struct {
+        uint8_t pattern[16]; // iF002: 128 one bit samples played in loop while the sound timer runs
+        uint8_t pitch;       // iFX3A: the pattern plays at 4000 * 2^((pitch - 64) / 48) samples per second
+        bool loaded;         // a pattern replaces the plain beep
+    } audio;
 
-    // copy front sprites at the beginning of the memory (0-512)
-    assert(sizeof(font_sprites) < sizeof(self->reserved));
+    // optional listener of every write to the memory, es. the jit (jit.h) uses it to drop stale translations
+    struct {
+        void (*fn)(void *ctx, uint16_t addr, uint32_t len);
+        void *ctx;
+    } on_write;
+
+#ifdef CHIP_PROFILE
+    chip_profile_t *profile; // optional, owned by the caller (chip_init() detaches it)
+#endif
+
+#ifdef CHIP_TRACE
+    chip_trace_t *trace; // optional, owned by the caller (chip_init() detaches it)
+#endif
+
+    chip_xo_mem_t *xo; // NULL till the first profile with QUIRK_XO, chip_init() keeps it for the next one (chip_release() frees it)
+
+    decoded_t icache_4k[CHIP_MEM_MIN]; // see chip_step(), use chip->icache
+};
+
+// how much memory the profile of the chip addresses, for what doesn't run inside an instance of interp.h
+static FORCED(inline) uint32_t chip_mem_size(const chip8_t *chip) {
+    return CHIP_MEM_SIZE(chip_quirks_flags[chip->quirks]);
+}
+
+
+/*
+ (re)initialize a chip in place with the default profile, es. one taken from a pool (batch.h); the rng seed is 0.
+ The 64 KB of XO-CHIP of an earlier profile are kept for the next one: the xo of a chip never initialized must be NULL (chip_new(), the arenas)
+*/
+void chip_init(chip8_t *self) {
+
+    chip_xo_mem_t *const xo = self->xo;
+    memset(self, 0x00, sizeof(chip8_t));
+
+    self->xo     = xo;
+    self->memory = self->memory_4k;
+    self->icache = self->icache_4k;
+
+    // copy front sprites at the beginning of the memory (0-512), the big ones of iFX30 right after
+    assert(FONT_BIG_ADDR + sizeof(font_big_sprites) < sizeof(self->reserved));
     memcpy(self->reserved, font_sprites, sizeof(font_sprites));
+    memcpy(self->reserved + FONT_BIG_ADDR, font_big_sprites, sizeof(font_big_sprites));
 
     self->PC = self->I = 0x200;
+    self->planes = self->planes_used = 1;
+    self->audio.pitch = 64; // 4000 Hz
 
     stack_init(&self->stack);
+}
+
+chip8_t * chip_new() {
+
+    chip8_t *self;
+
+    // the screen is 32 byte aligned (vector stores), malloc() gives 16: a big chip comes from mmap at page + 16
+    if (!(self = aligned_alloc(alignof(chip8_t), (sizeof(chip8_t) + alignof(chip8_t) - 1) / alignof(chip8_t) * alignof(chip8_t))))
+        return NULL;
+
+    self->xo = NULL;
+    chip_init(self);
     return self;
 }
 
+void chip_seed(chip8_t *self, uint64_t seed) {
+    self->rng = seed;
+}
+
+
+// the 64 KB of XO-CHIP, of a chip which isn't freed with chip_free() (es. one in an arena): after this it's back to chip_init()
+void chip_release(chip8_t *self) {
+    free(self->xo);
+    self->xo = NULL;
+}
 
 void chip_free(chip8_t *self) {
+    if (!self) return;
+    chip_release(self);
     free(self);
 }
 
@@ -105,6 +242,10 @@ void chip_press_key(chip8_t *self, keycodes_t key_code, keystate_t status) {
 
     key_code &= 0xf; // same of key_code %= HKEY_LEN
 
+#ifdef CHIP_TRACE
+    if (self->trace) chip_trace_key(self->trace, self->cycles, key_code, status, self->V, self->I);
+#endif
+
     if (LIKELY(!self->is_awaiting)) {
         self->keypad[key_code] = status;
         return;
@@ -117,41 +258,145 @@ void chip_press_key(chip8_t *self, keycodes_t key_code, keystate_t status) {
     self->is_awaiting         = false;
 }
 
-bool chip_load_rom(chip8_t *chip, const char *fpath) {
+static void chip_invalidate_range(chip8_t *chip, uint32_t addr, uint32_t len) {
+
+    // an instruction starting at addr-1 has its low byte at addr
+    const uint32_t from = addr ? addr - 1u : 0;
+    memset(chip->icache + from, 0x00, (addr + len - from) * sizeof(decoded_t));
+
+    if (UNLIKELY(!!chip->on_write.fn))
+        chip->on_write.fn(chip->on_write.ctx, addr, len);
+}
+
+/*
+ every write to the memory must pass from here, otherwise a self-modifying rom would execute stale predecoded instructions.
+ The writes past the end of the memory wrap around to 0 (the handlers mask the addresses): the two pieces are dropped
+*/
+void chip_invalidate(chip8_t *chip, uint16_t addr, uint32_t len) {
+
+    const uint32_t size = chip_mem_size(chip);
+    addr &= size - 1;
+    if (len > size) len = size;
+
+    if (UNLIKELY(addr + len > size)) {
+        chip_invalidate_range(chip, 0, addr + len - size);
+        len = size - addr;
+    }
+
+    chip_invalidate_range(chip, addr, len);
+    chip->writes++;
+}
+
+/*
+ before the rom is loaded (or at least before it runs), the predecoded instructions of another profile are dropped.
+ Going to or from QUIRK_XO the first 4 KB move to the other memory, the 60 KB above them start from 0.
+ False if the 64 KB can't be allocated, the chip keeps its profile
+*/
+bool chip_set_quirks(chip8_t *chip, chip_quirks_t quirks) {
+
+    assert(quirks < CHIP_QUIRKS_LEN);
+    if (chip->quirks == quirks)
+        return true;
+
+    const bool xo = chip_quirks_flags[quirks] & QUIRK_XO;
+    if (xo != !!(chip_quirks_flags[chip->quirks] & QUIRK_XO)) {
+
+        if (xo && !chip->xo && !(chip->xo = malloc(sizeof(chip_xo_mem_t))))
+            return false;
+
+        uint8_t *const memory = xo ? chip->xo->memory : chip->memory_4k;
+        memcpy(memory, chip->memory, CHIP_MEM_MIN);
+        if (xo) memset(memory + CHIP_MEM_MIN, 0x00, CHIP_MEM_MAX - CHIP_MEM_MIN);
+
+        chip->memory = memory;
+        chip->icache = xo ? chip->xo->icache : chip->icache_4k;
+    }
+
+    chip->quirks = quirks;
+    chip_invalidate(chip, 0, chip_mem_size(chip));
+    return true;
+}
+
+// copy a rom already in memory, es. one shared by many vm (batch.h)
+bool chip_load_rom_mem(chip8_t *chip, const uint8_t *rom, size_t rom_size) {
 
     assert(chip->rom_size == 0); // rom already loaded, crash the program
 
+    // the quirks come first (chip_set_quirks()): only XO-CHIP has room for the big ones
+    if (rom_size < sizeof(uint16_t) || rom_size >= chip_mem_size(chip) - 0x200) {
+        dbg("Error invalid rom size=\"%zu\"\n", rom_size);
+        return false;
+    }
+
+    assert(chip->memory + 0x200 + rom_size <= chip->memory + chip_mem_size(chip));
+
+    // WARNING: !! DO-NOT: swap the rom endianness! since contain raw bytes like sprites etc. Not just instructions
+    memcpy(chip->memory + 0x200, rom, rom_size);
+
+    chip->rom_size = rom_size;
+    chip_invalidate(chip, 0x200, rom_size);
+    return true;
+}
+
+// read a rom file into buf (at least CHIP_ROM_MAX bytes), return its size or 0 on error
+size_t chip_read_rom(const char *fpath, uint8_t *buf) {
+
     FILE *file;
     if (!(file = fopen(fpath, "rb"))) {
         dbg("cannot open the path=\"%s\"\n", fpath);
-        return false;
+        return 0;
     }
 
     const size_t rom_size = file_size(file);
-    if (rom_size < sizeof(uint16_t) || rom_size >= 0xfff - 0x200 + 1) { // 3584 bytes (the rom will be loaded at 0x200 address)
+    if (rom_size < sizeof(uint16_t) || rom_size >= CHIP_ROM_MAX) {
         dbg("Error invalid rom size=\"%zu\"\n", rom_size);
         fclose(file);
-        return false;
+        return 0;
     }
 
-    const size_t bytes_read = fread(chip->memory + 0x200, sizeof(uint8_t), rom_size, file);
+    const size_t bytes_read = fread(buf, sizeof(uint8_t), rom_size, file);
+    fclose(file);
+
     if (bytes_read != rom_size) {
         dbg("I/O error bytes read: \"%zu\" expected: \"%zu\" \n", bytes_read, rom_size);
-        fclose(file);
-        return false;
+        return 0;
     }
 
     //dbg("bytes read %zu\n", bytes_read);
-    assert(chip->memory + 0x200 + rom_size <= chip->memory + 4096);
+    return rom_size;
+}
 
-    // WARNING: !! DO-NOT: swap the rom endianness! since contain raw bytes like sprites etc. Not just instructions
-    fclose(file);
-    return true;
+bool chip_load_rom(chip8_t *chip, const char *fpath) {
+
+    assert(chip->rom_size == 0); // rom already loaded, crash the program
+
+    uint8_t rom[CHIP_ROM_MAX];
+    const size_t rom_size = chip_read_rom(fpath, rom);
+    return rom_size && chip_load_rom_mem(chip, rom, rom_size);
 }
 
-// 0X00E0 disp_clear() - Clears the screen
-void i00E0(chip8_t *chip) {
-    memset(__builtin_assume_aligned(chip->screen, 32), 0x00, sizeof(chip->screen)); // In Chip-8 By default, the screen is set to all black pixels.
+instr_t chip_fetch(const chip8_t *chip, uint16_t chip_addr) {
+    assert(chip_addr <= chip_mem_size(chip) - sizeof(uint16_t)); // usually chip_addr is the program counter
+    return (instr_t) {
+        .data = be16toh( *((uint16_t *)(chip->memory + chip_addr)) )
+    };
+}
+
+// the rows of the screen in the current resolution (screen.h)
+static FORCED(inline) uint8_t chip_screen_height(const chip8_t *chip) {
+    return chip->hires ? SCREEN_HEIGHT : SCREEN_LORES_HEIGHT;
+}
+
+// 0X00E0 disp_clear() - Clears the screen (the planes selected by iFN01)
+void i00E0(chip8_t *chip, instr_t instr) {
+    (void)instr;
+    // In Chip-8 By default, the screen is set to all black pixels. In lo-res the rows below are already 0 (screen.h)
+    const uint8_t rows = chip_screen_height(chip);
+    for (uint8_t p = 0; p < SCREEN_PLANES; ++p)
+        if (chip->planes >> p & 1)
+            memset(__builtin_assume_aligned(chip->plane[p], 32), 0x00, rows * sizeof(chip->plane[p][0]));
+    chip->screen_dirty |= SCREEN_ROWS(rows);
+    chip->writes++;
 }
 
 // es. 0X600C V0 = 0XC - Sets VX to NN
@@ -164,14 +409,20 @@ void iANNN(chip8_t *chip, instr_t instr) {
     chip->I = instr.NNN;
 }
 
-// PC = V0 + %#03X - Jumps to the address NNN plus V0.
-void iBNNN(chip8_t *chip, instr_t instr) {
-    chip->PC = chip->V0 + instr.NNN; // CHIP-8 compliant
+// PC = V0 + %#03X - Jumps to the address NNN plus V0 (BXNN: XNN plus VX, with QUIRK_JUMP_VX).
+static FORCED(inline) void quirk_BNNN(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+    chip->PC = ((quirks & QUIRK_JUMP_VX ? chip->V[instr.X] : chip->V0) + instr.NNN) & CHIP_ADDR_MASK(quirks); // CHIP-8 compliant without the quirk
+}
+
+// 0XF000 0X1234 XO-CHIP I = 0X1234 - Loads I with the 16 bit address in the next 2 bytes, the instruction is 4 bytes long (step 4).
+static FORCED(inline) void quirk_F000(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+    (void)instr;
+    chip->I = chip_fetch(chip, (chip->PC + 2) & CHIP_ADDR_MASK(quirks)).data & CHIP_ADDR_MASK(quirks);
 }
 
 // CXNN: Vx = rand() & NN - Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN.
 void iCXNN(chip8_t *chip, instr_t instr) {
-    chip->V[instr.X] = rand() & instr.NN;
+    chip->V[instr.X] = splitmix64(&chip->rng) & instr.NN;
 }
 
 // 0XD01F draw(V0, V1, f)
@@ -210,57 +461,196 @@ void iCXNN(chip8_t *chip, instr_t instr) {
     Sprites that are drawn partially off-screen will be clipped.
  */
 
-// TODO: più check buffer overflow in particolare il bound sul chip->I e sugli altri data register
-void iDXYN(chip8_t *chip, instr_t instr) {
+/*
+ A sprite w pixels wide (8, 16 for DXY0) and h rows high at (x, y) into a plane: every row of the sprite is shifted
+ (or rotated) into place in a register and xor'ed into the row of the screen at once, no loop on the pixels.
+ In lo-res a row is word 0 of the screen row, in hi-res both words as an uint128_t. Return the pixels turned off.
+*/
+static FORCED(inline) uint64_t chip_draw_plane(chip8_t *chip, uint64_t (*const screen)[SCREEN_WORDS], const uint8_t *const beg_sprite,
+                                               uint8_t x, uint8_t y, const uint8_t w, const uint8_t h, const uint16_t quirks) {
 
-    // legge n byte consecutivi da memoria a partire da I, ciascun byte rappresenta una riga di 8 pixel.
-    const uint8_t *const beg_sprite = chip->memory + chip->I;
-    const uint8_t *const end_sprite = chip->memory + chip->I + instr.N; // n bytes of memory
-    assert(end_sprite <= chip->memory + 4096);
+    const bool hires = chip->hires;
+    uint64_t collision = 0;
 
-    // The two registers passed to this instruction determine the x and y location of the sprite on the screen.
-    const uint16_t x = chip->V[instr.X]; // x-offset (col_offset)
-    const uint16_t y = chip->V[instr.Y]; // y-offset (row_offset)
+    for (uint8_t sprite_h = 0; sprite_h < h; ++sprite_h) {
 
-    // instr.N * 8 -> bit
-           const uint8_t sprite_len        = end_sprite - beg_sprite;
-           const uint8_t sprite_bit_len    = sprite_len * 8;
-           const uint8_t sprite_bit_height = instr.N; // in bits
-    static const uint8_t sprite_bit_width  = 8;       // in bits
+        // a row of the sprite, the msb is its leftmost pixel
+        const uint64_t bits = w == 16
+            ? (uint64_t)beg_sprite[sprite_h * 2] << 8 | beg_sprite[sprite_h * 2 + 1]
+            : beg_sprite[sprite_h];
 
-    (void)sprite_bit_len; // suppress -Wunused-variable warn
+#ifdef CHIP_DEBUG
+        for (uint8_t sprite_w = 0; sprite_w < w; ++sprite_w)
+            printf("%d ", access_bit(beg_sprite + sprite_h * (w / 8), sprite_w));
+        printf("%c", '\n');
+#endif
 
-    // Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels.
-    // The corresponding graphic on the screen will be eight pixels wide and N pixels high.
+        if (LIKELY(!hires)) {
 
-    chip->VF = 0;
+            // put the sprite row on the leftmost w pixels then rotate it to x,
+            // questo fa il wrap around, tecnicamente è una roba di super-chip in chip8 originale viene clippato e basta se esce dallo schermo.
+            uint64_t sprite_row = rotr64(bits << (SCREEN_LORES_WIDTH - w), x);
+            uint8_t row_idx = (y + sprite_h) % SCREEN_LORES_HEIGHT;
+
+            // QUIRK_CLIP: only the origin wraps, the pixels past the right border are shifted out and the rows past the bottom aren't drawn
+            if (quirks & QUIRK_CLIP) {
+                if (y % SCREEN_LORES_HEIGHT + sprite_h >= SCREEN_LORES_HEIGHT) break;
+                sprite_row = (bits << (SCREEN_LORES_WIDTH - w)) >> (x % SCREEN_LORES_WIDTH);
+                row_idx    = y % SCREEN_LORES_HEIGHT + sprite_h;
+            }
 
-    // The corresponding graphic on the screen will be eight pixels wide and N pixels high.
-    for (uint8_t sprite_h = 0; sprite_h < sprite_bit_height; ++sprite_h) {
-        for (uint8_t sprite_w = 0; sprite_w < sprite_bit_width; ++sprite_w) {
+            uint64_t *const screen_row = screen[row_idx];
 
-            const uint8_t sprite_bit_idx = sprite_h * sprite_bit_width + sprite_w; // a bit matrix in row-major-order
-            assert(sprite_bit_idx < sprite_bit_len);
-            const uint8_t pixel = access_bit(beg_sprite, sprite_bit_idx) ? 0xff : 0x00;
+            collision   |= *screen_row & sprite_row; // pixels turned off
+            *screen_row ^= sprite_row;
+            chip->screen_dirty |= (uint64_t)1 << row_idx;
+            continue;
+        }
 
-#ifdef CHIP_DEBUG
-            printf("%d ", pixel ? 1 : 0);
-#endif
-            // questo fa il wrap around, tecnicamente è una roba di super-chip in chip8 originale viene clippato e basta se esce dallo schermo.
-            uint16_t pixel_index = SC(
-        (y + sprite_h) % SCREEN_HEIGHT,
-        (x + sprite_w) % SCREEN_WIDTH
-            );
-
-            const uint8_t pixel_tmp = chip->screen[pixel_index];
-            chip->screen[pixel_index] ^= pixel;
-            chip->VF |= pixel_tmp && pixel; // disegna in XOR qua c'è il carry chip->VF = chip->VF || (old_pixel == pixel); spenge il pixel se entrambi sono on
-            //chip->VF |= !!pixel_tmp & pixel;
+        // hi-res: the same on the 128 pixels of the row, word 0 is the high half
+        uint128_t sprite_row = rotr128((uint128_t)bits << (SCREEN_WIDTH - w), x);
+        uint8_t row_idx = (y + sprite_h) % SCREEN_HEIGHT;
+
+        if (quirks & QUIRK_CLIP) {
+            if (y % SCREEN_HEIGHT + sprite_h >= SCREEN_HEIGHT) break;
+            sprite_row = ((uint128_t)bits << (SCREEN_WIDTH - w)) >> (x % SCREEN_WIDTH);
+            row_idx    = y % SCREEN_HEIGHT + sprite_h;
         }
-#ifdef CHIP_DEBUG
-        printf("%c", '\n');
+
+        uint64_t *const screen_row = screen[row_idx];
+        const uint64_t hi = sprite_row >> 64, lo = (uint64_t)sprite_row;
+
+        collision     |= (screen_row[0] & hi) | (screen_row[1] & lo);
+        screen_row[0] ^= hi;
+        screen_row[1] ^= lo;
+        chip->screen_dirty |= (uint64_t)1 << row_idx;
+    }
+
+    return collision;
+}
+
+/*
+ The sprite goes into every plane selected by iFN01 (only plane 0 without QUIRK_XO): h * w / 8 bytes from I for the
+ lowest plane, the next ones right after for the next plane (XO-CHIP), es. 2 planes of 16x16 -> 64 bytes.
+*/
+static FORCED(inline) void chip_draw(chip8_t *chip, uint8_t x, uint8_t y, const uint8_t w, const uint8_t h, const uint16_t quirks) {
+
+    const uint8_t planes = quirks & QUIRK_XO ? chip->planes : 1;
+
+    // legge n byte consecutivi da memoria a partire da I, ciascun byte rappresenta una riga di 8 pixel (due per DXY0).
+    const uint8_t *beg_sprite = chip->memory + chip->I;
+    const uint32_t len = __builtin_popcount(planes) * h * (w / 8); // n bytes of memory per plane
+
+    // a sprite past the end of the memory wraps around to 0
+    uint8_t wrapped[SCREEN_PLANES * 32];
+    if (UNLIKELY(chip->I + len > CHIP_MEM_SIZE(quirks))) {
+        for (uint32_t i = 0; i < len; ++i)
+            wrapped[i] = chip->memory[(chip->I + i) & CHIP_ADDR_MASK(quirks)];
+        beg_sprite = wrapped;
+    }
+
+    uint64_t collision = 0;
+    for (uint8_t p = 0; p < SCREEN_PLANES; ++p) {
+        if (!(planes >> p & 1)) continue;
+        collision  |= chip_draw_plane(chip, chip->plane[p], beg_sprite, x, y, w, h, quirks);
+        beg_sprite += h * (w / 8);
+    }
+
+    // VF is set to 1 if any screen pixels are flipped from set to unset
+    chip->VF = !!collision;
+    chip->writes++;
+
+#ifdef CHIP_PROFILE
+    if (chip->profile) chip_profile_draw(chip->profile, x, y, w, h, chip->hires, collision);
 #endif
+}
+
+static FORCED(inline) void quirk_DXYN(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+
+    // The two registers passed to this instruction determine the x and y location of the sprite on the screen.
+    // Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels.
+    chip_draw(chip, chip->V[instr.X], chip->V[instr.Y], 8, instr.N, quirks);
+}
+
+// 0XD010 SUPER-CHIP draw16(V0, V1) - Draws a 16x16 sprite at (VX, VY), 32 bytes from I: two bytes per row.
+static FORCED(inline) void quirk_DXY0(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+
+    // the DXYN of CHIP-8 with N = 0: no rows, nothing collides
+    if (!(quirks & QUIRK_LORES_DXY0) && !chip->hires) {
+        chip_draw(chip, chip->V[instr.X], chip->V[instr.Y], 8, 0, quirks);
+        return;
     }
+
+    chip_draw(chip, chip->V[instr.X], chip->V[instr.Y], 16, 16, quirks);
+}
+
+// scroll the planes selected by iFN01 right (left if < 0) or down (up if < 0) by n pixels, lo-res pixels in lo-res
+static void chip_scroll(chip8_t *chip, int8_t right, int8_t down) {
+
+    const uint8_t rows = chip_screen_height(chip);
+
+    for (uint8_t p = 0; p < SCREEN_PLANES; ++p) {
+        if (!(chip->planes >> p & 1)) continue;
+        if (right) screen_scroll_h(chip->plane[p], rows, right, chip->hires);
+        if (down)  screen_scroll_v(chip->plane[p], rows, down);
+    }
+
+    chip->screen_dirty |= SCREEN_ROWS(rows);
+    chip->writes++;
+}
+
+// 0X00C4 SUPER-CHIP scroll_down(4) - Scrolls the screen down by N pixels (lo-res pixels in lo-res).
+void i00CN(chip8_t *chip, instr_t instr) {
+    chip_scroll(chip, 0, instr.N);
+}
+
+// 0X00D4 XO-CHIP scroll_up(4) - Scrolls the screen up by N pixels.
+void i00DN(chip8_t *chip, instr_t instr) {
+    chip_scroll(chip, 0, -instr.N);
+}
+
+// 0X00FB SUPER-CHIP scroll_right() - Scrolls the screen right by 4 pixels.
+void i00FB(chip8_t *chip, instr_t instr) {
+    (void)instr;
+    chip_scroll(chip, 4, 0);
+}
+
+// 0X00FC SUPER-CHIP scroll_left() - Scrolls the screen left by 4 pixels.
+void i00FC(chip8_t *chip, instr_t instr) {
+    (void)instr;
+    chip_scroll(chip, -4, 0);
+}
+
+// 0X00FD SUPER-CHIP exit() - Exits the interpreter: the PC doesn't move anymore (step 0), a jump to self which idle.h fast forwards.
+void i00FD(chip8_t *chip, instr_t instr) {
+    (void)chip, (void)instr;
+}
+
+// 00FE lo-res 64x32, 00FF hi-res 128x64: the screen is cleared, every plane (the modern SUPER-CHIP and XO-CHIP do it, Octo too)
+static void chip_set_hires(chip8_t *chip, bool hires) {
+    chip->hires = hires;
+    memset(__builtin_assume_aligned(chip->plane, 32), 0x00, sizeof(chip->plane));
+    chip->screen_dirty = SCREEN_ROWS_ALL;
+    chip->writes++;
+}
+
+// 0X00FE SUPER-CHIP lores() - Disables the high resolution mode.
+void i00FE(chip8_t *chip, instr_t instr) {
+    (void)instr;
+    chip_set_hires(chip, false);
+}
+
+// 0X00FF SUPER-CHIP hires() - Enables the high resolution mode.
+void i00FF(chip8_t *chip, instr_t instr) {
+    (void)instr;
+    chip_set_hires(chip, true);
+}
+
+// es. 0XF201 XO-CHIP plane(2) - Selects the planes which the drawing, clearing and scrolling instructions work on, a bit for each plane.
+static FORCED(inline) void quirk_FN01(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+    if (!(quirks & QUIRK_XO)) return; // a single plane
+    chip->planes       = instr.X;
+    chip->planes_used |= instr.X;
 }
 
 
@@ -274,24 +664,63 @@ void i1NNN(chip8_t *chip, instr_t instr) {
     chip->PC = instr.NNN;
 }
 
+// how many bytes a skip jumps over: the next instruction, 4 bytes if it's the F000 NNNN of XO-CHIP
+static FORCED(inline) uint16_t chip_skip(const chip8_t *chip, const uint16_t quirks) {
+    if (!(quirks & QUIRK_XO)) return sizeof(instr_t);
+    return chip_fetch(chip, chip->PC + 2).data == 0xF000 ? 2 * sizeof(instr_t) : sizeof(instr_t);
+}
+
 // es. 0X362B if (V6 == 0x2b) - Skips the next instruction if VX equals NN (usually the next instruction is a jump to skip a code block).
-void i3XNN(chip8_t *chip, instr_t instr) {
-    chip->PC += (chip->V[instr.X] == instr.NN) << 1; // same of: (chip->V[instr.X] == instr.NN) ? sizeof(instr_t) : 0
+static FORCED(inline) void quirk_3XNN(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+    chip->PC += chip->V[instr.X] == instr.NN ? chip_skip(chip, quirks) : 0;
 }
 
 // es. 0X452A if (V5 != 0x2a) - Skips the next instruction if VX does not equal NN (usually the next instruction is a jump to skip a code block).
-void i4XNN(chip8_t *chip, instr_t instr) {
-    chip->PC += (chip->V[instr.X] != instr.NN) << 1;
+static FORCED(inline) void quirk_4XNN(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+    chip->PC += chip->V[instr.X] != instr.NN ? chip_skip(chip, quirks) : 0;
 }
 
 // .. - Skips the next instruction if VX equals VY (usually the next instruction is a jump to skip a code block).
-void i5XY0(chip8_t *chip, instr_t instr) {
-    chip->PC += (chip->V[instr.X] == chip->V[instr.Y]) << 1;
+static FORCED(inline) void quirk_5XY0(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+    chip->PC += chip->V[instr.X] == chip->V[instr.Y] ? chip_skip(chip, quirks) : 0;
 }
 
 // es. 0X9560 if (V5 != V6) - Skips the next instruction if VX does not equal VY. (Usually the next instruction is a jump to skip a code block).
-void i9XY0(chip8_t *chip, instr_t instr) {
-    chip->PC += (chip->V[instr.X] != chip->V[instr.Y]) << 1;
+static FORCED(inline) void quirk_9XY0(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+    chip->PC += chip->V[instr.X] != chip->V[instr.Y] ? chip_skip(chip, quirks) : 0;
+}
+
+/*
+ es. 0X5362 XO-CHIP save(V3 - V6) - Stores from VX to VY (both included, backwards if X > Y) in memory starting at address I, I doesn't change.
+ Without QUIRK_XO it's a 5XY0, as the 5XYN with N != 0 always were here.
+*/
+static FORCED(inline) void quirk_5XY2(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+
+    if (!(quirks & QUIRK_XO)) {
+        quirk_5XY0(chip, instr, quirks);
+        return;
+    }
+
+    const int8_t dir = instr.X <= instr.Y ? 1 : -1;
+    const uint8_t sz = (instr.X <= instr.Y ? instr.Y - instr.X : instr.X - instr.Y) + 1;
+    for (uint8_t i = 0; i < sz; ++i) // past the end of the memory it wraps around to 0
+        chip->memory[(chip->I + i) & CHIP_ADDR_MASK(quirks)] = chip->V[instr.X + i * dir];
+
+    chip_invalidate(chip, chip->I, sz);
+}
+
+// es. 0X5363 XO-CHIP load(V3 - V6) - Fills from VX to VY (both included, backwards if X > Y) with values from memory starting at address I, I doesn't change.
+static FORCED(inline) void quirk_5XY3(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+
+    if (!(quirks & QUIRK_XO)) {
+        quirk_5XY0(chip, instr, quirks);
+        return;
+    }
+
+    const int8_t dir = instr.X <= instr.Y ? 1 : -1;
+    const uint8_t sz = (instr.X <= instr.Y ? instr.Y - instr.X : instr.X - instr.Y) + 1;
+    for (uint8_t i = 0; i < sz; ++i) // past the end of the memory it wraps around to 0
+        chip->V[instr.X + i * dir] = chip->memory[(chip->I + i) & CHIP_ADDR_MASK(quirks)];
 }
 
 // es.  0X2812 *(0X812)() - Calls subroutine at NNN.
@@ -307,7 +736,8 @@ void i2NNN(chip8_t *chip, instr_t instr) {
 }
 
 // 0X00EE return; - Returns from a subroutine.
-void i00EE(chip8_t *chip) {
+void i00EE(chip8_t *chip, instr_t instr) {
+    (void)instr;
     //assert( !lifo_u16_isEmpty(chip->stack) );
     //chip->PC = lifo_u16_pop(chip->stack);
     chip->PC = stack_pop(&chip->stack);
@@ -319,21 +749,21 @@ void i8XY0(chip8_t *chip, instr_t instr) {
 }
 
 // es. 0X87B1 V7 |= Vb - Sets VX to VX or VY. (bitwise OR operation).
-void i8XY1(chip8_t *chip, instr_t instr) {
+static FORCED(inline) void quirk_8XY1(chip8_t *chip, instr_t instr, const uint16_t quirks) {
     chip->V[instr.X] |= chip->V[instr.Y];
-    chip->VF = 0; // CHIP-8 compliant: add VF reset as described here: https://github.com/Timendus/chip8-test-suite/blob/main/bin/
+    if (quirks & QUIRK_VF_RESET) chip->VF = 0; // CHIP-8 compliant: add VF reset as described here: https://github.com/Timendus/chip8-test-suite/blob/main/bin/
 }
 
 // es. 0X87B2 V7 &= Vb - Sets VX to VX and VY. (bitwise AND operation).
-void i8XY2(chip8_t *chip, instr_t instr) {
+static FORCED(inline) void quirk_8XY2(chip8_t *chip, instr_t instr, const uint16_t quirks) {
     chip->V[instr.X] &= chip->V[instr.Y];
-    chip->VF = 0; // CHIP-8 compliant
+    if (quirks & QUIRK_VF_RESET) chip->VF = 0; // CHIP-8 compliant
 }
 
 // es. 0X87B3 V7 ^= Vb - Sets VX to VX xor VY.
-void i8XY3(chip8_t *chip, instr_t instr) {
+static FORCED(inline) void quirk_8XY3(chip8_t *chip, instr_t instr, const uint16_t quirks) {
     chip->V[instr.X] ^= chip->V[instr.Y];
-    chip->VF = 0; // CHIP-8 compliant
+    if (quirks & QUIRK_VF_RESET) chip->VF = 0; // CHIP-8 compliant
 }
 
 // es. 0X8764 V7 += V6 - Adds VY to VX. VF is set to 1 when there's an overflow, and to 0 when there is not.
@@ -368,57 +798,70 @@ void i8XY7(chip8_t *chip, instr_t instr) {
 }
 
 // es. 0X866E V6 <<= 1 - Shifts VX to the left by 1, then sets VF to 1 if the most significant bit of VX prior to that shift was set, or to 0 if it was unset.
-void i8XYE(chip8_t *chip, instr_t instr) {
+static FORCED(inline) void quirk_8XYE(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+
+    // CHIP-8 compliant:
+    // THIS BEHAVIOR MAKE Space Invaders [David Winter].ch8 not working properly, DEFAULT doesn't have it
+    if (quirks & QUIRK_SHIFT_VY) {
+        chip->VF = access_bit(chip->V + instr.Y, 0); // take the msb
+        chip->V[instr.X] = chip->V[instr.Y] << 1;
+        return;
+    }
 
     chip->VF = access_bit(chip->V + instr.X, 0); // take the msb
     chip->V[instr.X] <<= 1;
-
-
-    // CHIP-8 compliant:
-    // THIS BEHAVIOR MAKE Space Invaders [David Winter].ch8 not working properly
-    /*
-    chip->VF = access_bit(chip->V + instr.Y, 0); // take the lsb
-    chip->V[instr.X] = chip->V[instr.Y] << 1;
-    */
 }
 
 // es. 0X8666 V6 >>= 1 - Shifts VX to the right by 1, then stores the least significant bit of VX prior to the shift into VF.
-void i8XY6(chip8_t *chip, instr_t instr) {
-
-    chip->VF = access_bit(chip->V + instr.X, sizeof(uint8_t) - 1); // take the lsb
-    chip->V[instr.X] >>= 1;
+static FORCED(inline) void quirk_8XY6(chip8_t *chip, instr_t instr, const uint16_t quirks) {
 
+    // the bit 0 of access_bit() is the msb: that's what DEFAULT always took, see QUIRK_SHIFT_MSB
+    const uint8_t lsb = quirks & QUIRK_SHIFT_MSB ? 0 : 7;
 
     // CHIP-8 compliant:
-    // THIS BEHAVIOR MAKE Space Invaders [David Winter].ch8 not working properly
-    /*
-    chip->VF = access_bit(chip->V + instr.Y, sizeof(uint8_t) - 1); // take the lsb
-    chip->V[instr.X] = chip->V[instr.Y] >> 1;
-     */
+    // THIS BEHAVIOR MAKE Space Invaders [David Winter].ch8 not working properly, DEFAULT doesn't have it
+    if (quirks & QUIRK_SHIFT_VY) {
+        chip->VF = access_bit(chip->V + instr.Y, lsb); // take the lsb
+        chip->V[instr.X] = chip->V[instr.Y] >> 1;
+        return;
+    }
+
+    chip->VF = access_bit(chip->V + instr.X, lsb); // take the lsb
+    chip->V[instr.X] >>= 1;
 }
 
 // es.  0XF155 reg_dump(V1, &I)  - Stores from V0 to VX (including VX) in memory,
 // starting at address I. The offset from I is increased by 1 for each value written,
 // but I itself is left unmodified.
-void iFX55(chip8_t *chip, instr_t instr) {
+static FORCED(inline) void quirk_FX55(chip8_t *chip, instr_t instr, const uint16_t quirks) {
 
     const size_t sz = instr.X + 1;
-    assert(chip->I + sz <= 4096);
 
-    memcpy(chip->memory + chip->I, chip->V, sz);
-    chip->I += sz; // CHIP-8 compliant
+    // past the end of the memory it wraps around to 0
+    if (LIKELY(chip->I + sz <= CHIP_MEM_SIZE(quirks)))
+        memcpy(chip->memory + chip->I, chip->V, sz);
+    else
+        for (uint8_t i = 0; i < sz; ++i)
+            chip->memory[(chip->I + i) & CHIP_ADDR_MASK(quirks)] = chip->V[i];
+
+    chip_invalidate(chip, chip->I, sz);
+    if (quirks & QUIRK_MEMORY) chip->I = (chip->I + sz) & CHIP_ADDR_MASK(quirks); // CHIP-8 compliant
 }
 
 // es. 0XF065 reg_load(V0, &I) - Fills from V0 to VX (including VX) with values from memory,
 // starting at address I. The offset from I is increased by 1 for each value read,
 // but I itself is left unmodified.
-void iFX65(chip8_t *chip, instr_t instr) {
+static FORCED(inline) void quirk_FX65(chip8_t *chip, instr_t instr, const uint16_t quirks) {
 
     const size_t sz = instr.X + 1;
-    assert(chip->I + sz <= 4096);
 
-    memcpy(chip->V, chip->memory + chip->I, sz);
-    chip->I += sz; // CHIP-8 compliant
+    // past the end of the memory it wraps around to 0
+    if (LIKELY(chip->I + sz <= CHIP_MEM_SIZE(quirks)))
+        memcpy(chip->V, chip->memory + chip->I, sz);
+    else
+        for (uint8_t i = 0; i < sz; ++i)
+            chip->V[i] = chip->memory[(chip->I + i) & CHIP_ADDR_MASK(quirks)];
+    if (quirks & QUIRK_MEMORY) chip->I = (chip->I + sz) & CHIP_ADDR_MASK(quirks); // CHIP-8 compliant
 }
 
 
@@ -431,12 +874,14 @@ void iFX65(chip8_t *chip, instr_t instr) {
 // and the ones digit at location I+2.
 void iFX33(chip8_t *chip, instr_t instr) {
 
-    assert(chip->I + 2 < 4096); // mem[I+2] writeable
+    const uint32_t mask = chip_mem_size(chip) - 1; // past the end of the memory it wraps around to 0
 
     uint8_t value = chip->V[instr.X]; // es. 123
-    chip->memory[chip->I + 2] = value % 10, value /= 10; // store 3
-    chip->memory[chip->I + 1] = value % 10, value /= 10; // store 2
-    chip->memory[chip->I + 0] = value % 10;              // store 1
+    chip->memory[(chip->I + 2) & mask] = value % 10, value /= 10; // store 3
+    chip->memory[(chip->I + 1) & mask] = value % 10, value /= 10; // store 2
+    chip->memory[(chip->I + 0) & mask] = value % 10;              // store 1
+
+    chip_invalidate(chip, chip->I, 3);
 }
 
 // es. 0XFC29 I = sprite_addr[Vc] -
@@ -446,6 +891,35 @@ void iFX29(chip8_t *chip, instr_t instr) {
     chip->I = N(chip->V[instr.X]) * sizeof(font_sprites[0]); // chip->I = chip->V[instr.X] & 0x0f;
 }
 
+// es. 0XFC30 SUPER-CHIP I = big_sprite_addr[Vc] - Same of FX29 with the 8x10 font (font.h).
+void iFX30(chip8_t *chip, instr_t instr) {
+    chip->I = FONT_BIG_ADDR + N(chip->V[instr.X]) * sizeof(font_big_sprites[0]);
+}
+
+// es. 0XF375 SUPER-CHIP rpl_dump(V3) - Stores from V0 to VX (including VX) in the RPL user flags.
+void iFX75(chip8_t *chip, instr_t instr) {
+    memcpy(chip->rpl, chip->V, instr.X + 1);
+    chip->writes++; // a loop counting in the flags isn't idle (idle.h)
+}
+
+// es. 0XF385 SUPER-CHIP rpl_load(V3) - Fills from V0 to VX (including VX) with the RPL user flags.
+void iFX85(chip8_t *chip, instr_t instr) {
+    memcpy(chip->V, chip->rpl, instr.X + 1);
+}
+
+// 0XF002 XO-CHIP audio() - Loads the 16 bytes from I into the audio pattern buffer, played while the sound timer runs.
+void iF002(chip8_t *chip, instr_t instr) {
+    (void)instr;
+    for (uint8_t i = 0; i < sizeof(chip->audio.pattern); ++i) // past the end of the memory it wraps around to 0
+        chip->audio.pattern[i] = chip->memory[(chip->I + i) & (chip_mem_size(chip) - 1)];
+    chip->audio.loaded = true;
+}
+
+// es. 0XF33A XO-CHIP pitch(V3) - Sets the playback rate of the audio pattern to 4000 * 2^((VX - 64) / 48) samples per second.
+void iFX3A(chip8_t *chip, instr_t instr) {
+    chip->audio.pitch = chip->V[instr.X];
+}
+
 // es. 0XF015 delay_timer(V0) - Sets the delay timer to VX.
 void iFX15(chip8_t *chip, instr_t instr) {
     chip->delay_timer = chip->V[instr.X];
@@ -462,16 +936,16 @@ void iFX18(chip8_t *chip, instr_t instr) {
 }
 
 // I += V%x - Adds VX to I. VF is not affected.
-void iFX1E(chip8_t *chip, instr_t instr) {
-    chip->I += chip->V[instr.X];
+static FORCED(inline) void quirk_FX1E(chip8_t *chip, instr_t instr, const uint16_t quirks) {
+    chip->I = (chip->I + chip->V[instr.X]) & CHIP_ADDR_MASK(quirks);
 }
 
 // EX9E. if (key() == Vx) Skips the next instruction if the key stored
 // in VX(only consider the lowest nibble) is pressed
 // (usually the next instruction is a jump to skip a code block).
-void iEX9E(chip8_t *chip, instr_t instr) {
+static FORCED(inline) void quirk_EX9E(chip8_t *chip, instr_t instr, const uint16_t quirks) {
     const uint8_t expected_key = N(chip->V[instr.X]);
-    chip->PC += (chip->keypad[ expected_key ] == KEY_DOWN) << 1; // same of: (chip->keypad[ N(chip->V[instr.V]) ] == KEY_DOWN) ? sizeof(instr_t) : 0
+    chip->PC += chip->keypad[ expected_key ] == KEY_DOWN ? chip_skip(chip, quirks) : 0;
 
     // chip->keypad[expected_key] = KEY_UP;
 }
@@ -479,9 +953,9 @@ void iEX9E(chip8_t *chip, instr_t instr) {
 // iEXA1 if (key() != V%x) - Skips the next instruction if the key stored
 // in VX(only consider the lowest nibble) is not pressed
 // (usually the next instruction is a jump to skip a code block).
-void iEXA1(chip8_t *chip, instr_t instr) {
+static FORCED(inline) void quirk_EXA1(chip8_t *chip, instr_t instr, const uint16_t quirks) {
     const uint8_t expected_key = N(chip->V[instr.X]);
-    chip->PC += (chip->keypad[ expected_key ] == KEY_UP) << 1;
+    chip->PC += chip->keypad[ expected_key ] == KEY_UP ? chip_skip(chip, quirks) : 0;
 }
 
 
@@ -492,11 +966,71 @@ void iFX0A(chip8_t *chip, instr_t instr) {
     chip->is_awaiting = true;
 }
 
-instr_t chip_fetch(const chip8_t *chip, uint16_t chip_addr) {
-    assert(chip_addr <= (4096 - sizeof(uint16_t))); // usually chip_addr is the program counter
-    return (instr_t) {
-        .data = be16toh( *((uint16_t *)(chip->memory + chip_addr)) )
-    };
+
+// 0NNN call( NNN ); - Calls machine code routine at address NNN.
+// only the first one of an instance is printed and on stderr: stdout has the results (es. chip8_batch), a rom can't flood it
+void i0NNN(chip8_t *chip, instr_t instr) {
+    if (!chip->bad_opcodes.count++) {
+        chip->bad_opcodes.first = instr.data;
+        dbg("%#06X call( %#03X ); - Calls machine code routine at address NNN.\n", instr.data, instr.NNN);
+    }
+    assert(0);
+}
+
+void not_an_opcode(chip8_t *chip, instr_t instr) {
+    if (!chip->bad_opcodes.count++) {
+        chip->bad_opcodes.first = instr.data;
+        dbg("NOT AN OPCODE: %#06X - b:%x,%x\n", instr.data, instr.byte[0], instr.byte[1]);
+    }
+    //assert(0);
+}
+
+// the handler of every OP_xxx (opcodes.h) and how much it moves the PC, a table per quirk profile (interp.h)
+typedef struct {
+    chip_handler_t exec;
+    uint8_t step;
+} chip_op_t;
+
+// why chip_run() returned
+typedef enum {
+    CHIP_RUN_BUDGET, // max_cycles executed
+    CHIP_RUN_WAIT,   // iFX0A is waiting a key
+    CHIP_RUN_DRAW,   // after a 00E0 or a DXYN (DXY0), the frontend may want to show it
+    CHIP_RUN_LOOP,   // after a 1NNN or BNNN that didn't move the PC forward, or a 00FD: only with chip->idle.probe (idle.h looks there)
+} chip_run_stop_t;
+
+// the handlers which depend on the quirks, the table of the handlers and chip_run() of every profile of CHIP_QUIRKS
+_Static_assert(CHIP_QUIRKS_LEN == 4, "one interp.h per quirk profile");
+
+#define INTERP_NAME DEFAULT
+#define INTERP_SUFFIX
+#include <interp.h>
+
+#define INTERP_NAME CHIP8
+#define INTERP_SUFFIX _chip8
+#include <interp.h>
+
+#define INTERP_NAME SCHIP
+#define INTERP_SUFFIX _schip
+#include <interp.h>
+
+#define INTERP_NAME XOCHIP
+#define INTERP_SUFFIX _xochip
+#include <interp.h>
+
+#define QUIRKS_OPS(_NAME_, _SUFFIX_, _FLAGS_) [CHIP_QUIRKS_##_NAME_] = interp_ops##_SUFFIX_,
+static const chip_op_t *const chip_ops[CHIP_QUIRKS_LEN] = { CHIP_QUIRKS(QUIRKS_OPS) };
+#undef QUIRKS_OPS
+
+// find the handler of an opcode in a quirk profile: an index from the table generated at build time, see opcodes.h
+decoded_t chip_decode_quirks(instr_t instr, chip_quirks_t quirks) {
+    const uint8_t op = chip_opcode_table[instr.data];
+    return (decoded_t){ .exec = chip_ops[quirks][op].exec, .instr = instr, .step = chip_ops[quirks][op].step, .op = op };
+}
+
+// same, with the DEFAULT handlers (the jit, lockstep)
+decoded_t chip_decode(instr_t instr) {
+    return chip_decode_quirks(instr, CHIP_QUIRKS_DEFAULT);
 }
 
 
@@ -507,182 +1041,72 @@ void chip_exec(chip8_t *chip, instr_t instr) {
         return;
 
 #ifdef CHIP_DEBUG
-    dump_instruction(instr);
+    dump_instruction(chip->cycles, instr);
 #endif
 
-    if (instr.data == 0x00E0) {
-        i00E0(chip);
-        chip->PC += sizeof(instr_t);
-        return;
-    } else if (instr.data == 0x00EE) {
-        i00EE(chip);
-        chip->PC += sizeof(instr_t);
+#ifdef CHIP_PROFILE
+    if (chip->profile) chip_profile_exec(chip->profile, chip->PC, instr);
+#endif
+
+#ifdef CHIP_TRACE
+    const uint16_t pc = chip->PC;
+#endif
+
+    const chip_op_t *const op = chip_ops[chip->quirks] + chip_opcode_table[instr.data];
+    op->exec(chip, instr);
+
+#ifdef CHIP_TRACE
+    if (chip->trace) chip_trace_exec(chip->trace, chip->cycles, pc, instr.data, chip->V, chip->I, chip->is_awaiting);
+#endif
+
+    chip->PC = (chip->PC + op->step) & (chip_mem_size(chip) - 1);
+    chip->cycles++;
+}
+
+// same of chip_exec(chip, chip_fetch(chip, chip->PC)) but the fetch & decode is done once per address
+void chip_step(chip8_t *chip) {
+
+    if (UNLIKELY(chip->is_awaiting)) // NOP
         return;
-    }
 
-    switch (instr.type) {
-        case 0:
-            printf("%#06X call( %#03X ); - Calls machine code routine at address NNN.\n",
-               instr.data,
-               instr.NNN
-            );
-            assert(0);
-            return;
-        case 1:
-            i1NNN(chip, instr); // it's a jump, do not move the PC
-            return;
-        case 2:
-            i2NNN(chip, instr); // it's a call-jump, do not move the PC
-            return;
-        case 3:
-            i3XNN(chip, instr);
-            chip->PC += sizeof(instr_t);
-            return;
-        case 4:
-            i4XNN(chip, instr);
-            chip->PC += sizeof(instr_t);
-            return;
-        case 5:
-            i5XY0(chip, instr);
-            chip->PC += sizeof(instr_t);
-            return;
-        case 6:
-            i6XNN(chip, instr);
-            chip->PC += sizeof(instr_t);
-            return;
-        case 7:
-            i7XNN(chip, instr);
-            chip->PC += sizeof(instr_t);
-            return;
-
-        case 8:
-            // check last nibble
-            switch (instr.N) {
-                case 0:
-                    i8XY0(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 1:
-                    i8XY1(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 2:
-                    i8XY2(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 3:
-                    i8XY3(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 4:
-                    i8XY4(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 5:
-                    i8XY5(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 6:
-                    i8XY6(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 7:
-                    i8XY7(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 0xE:
-                    i8XYE(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-
-                default:
-                    goto not_an_opcode;
-            }
+    decoded_t *const slot = chip->icache + chip->PC;
+    if (UNLIKELY(!slot->exec))
+        *slot = chip_decode_quirks(chip_fetch(chip, chip->PC), chip->quirks);
 
-        case 9:
-            i9XY0(chip, instr);
-            chip->PC += sizeof(instr_t);
-            return;
-        case 0xA:
-            iANNN(chip, instr);
-            chip->PC += sizeof(instr_t);
-            return;
-        case 0xB:
-            iBNNN(chip, instr);
-            return;
-        case 0xC:
-            iCXNN(chip, instr);
-            chip->PC += sizeof(instr_t);
-            return;
-        case 0xD:
-            iDXYN(chip, instr);
-            chip->PC += sizeof(instr_t);
-            return;
-        case 0xE:
-            switch (instr.NN) {
-                case 0x9E:
-                    iEX9E(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 0xA1:
-                    iEXA1(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-
-                default:
-                    goto not_an_opcode;
-            }
-        case 0xF:
-            switch (instr.NN) {
-                case 0x07:
-                    iFX07(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 0x0A:
-                    iFX0A(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 0x15:
-                    iFX15(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 0x18:
-                    iFX18(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 0x1E:
-                    iFX1E(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 0x29:
-                    iFX29(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 0x33:
-                    iFX33(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 0x55:
-                    iFX55(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-                case 0x65:
-                    iFX65(chip, instr);
-                    chip->PC += sizeof(instr_t);
-                    return;
-
-                default:
-                    goto not_an_opcode;
-            }
+#ifdef CHIP_DEBUG
+    dump_instruction(chip->cycles, slot->instr);
+#endif
 
-        default:
-            not_an_opcode:
-            printf("NOT AN OPCODE: %#06X - b:%x,%x\n",
-               instr.data, instr.byte[0], instr.byte[1]
-            );
-            //assert(0);
-            return;
+#ifdef CHIP_PROFILE
+    if (chip->profile) chip_profile_exec(chip->profile, chip->PC, slot->instr);
+#endif
 
-    }
+#ifdef CHIP_TRACE
+    const uint16_t pc = chip->PC;
+    const instr_t instr = slot->instr;
+#endif
+
+    const uint8_t step = slot->step; // exec() may invalidate its own slot (iFX55, iFX33)
+    slot->exec(chip, slot->instr);
+
+#ifdef CHIP_TRACE
+    if (chip->trace) chip_trace_exec(chip->trace, chip->cycles, pc, instr.data, chip->V, chip->I, chip->is_awaiting);
+#endif
+
+    chip->PC = (chip->PC + step) & (chip_mem_size(chip) - 1);
+    chip->cycles++;
+}
+
+/*
+ Up to max_cycles chip_step() in a row through the threaded interpreter of the quirk profile of the chip (interp.h).
+ Stops early on the events above, return how many cycles of max_cycles went by (chip->cycles counts only the executed ones):
+ the instructions executed, plus the rest of max_cycles after a draw with QUIRK_DISPLAY_WAIT, max_cycles is the rest of the frame.
+*/
+uint32_t chip_run(chip8_t *chip, uint32_t max_cycles, chip_run_stop_t *why) {
+
+#define QUIRKS_RUN(_NAME_, _SUFFIX_, _FLAGS_) [CHIP_QUIRKS_##_NAME_] = interp_run##_SUFFIX_,
+    static uint32_t (*const runs[CHIP_QUIRKS_LEN])(chip8_t *, uint32_t, chip_run_stop_t *) = { CHIP_QUIRKS(QUIRKS_RUN) };
+#undef QUIRKS_RUN
 
+    return runs[chip->quirks](chip, max_cycles, why);
 }
@@ -9,10 +9,12 @@
 #define dbg(fmt, ...) (fprintf(stderr, "[ %s ] " fmt, __func__, ##__VA_ARGS__))
 
 
-// can handle at most 255 byte dump and is not thread safe
-const char * byte_dump(const void *data, uint8_t size) {
+#define BYTE_DUMP_LEN(size) ((size) * 3 + 1) // +1 for '\0' of sprintf
 
-    static char buffer[256 * 3 + 1]; // +1 for '\0' of sprintf
+// can handle at most 255 byte dump, buffer must hold BYTE_DUMP_LEN(size) chars (no static state, es. char buf[BYTE_DUMP_LEN(16)])
+const char * byte_dump(char *buffer, const void *data, uint8_t size) {
+
+    buffer[0] = '\0';
 
     int from = 0;
     for (size_t i = 0; i < size; ++i) {
@@ -24,12 +26,12 @@ const char * byte_dump(const void *data, uint8_t size) {
     return buffer;
 }
 
-void dump_instruction(instr_t instr) {
+// n: instruction number, es. chip->cycles
+void dump_instruction(uint64_t n, instr_t instr) {
 
-    static size_t instruction_counter;
     assert(instr.type == nibble_slice16(instr.data, 0, 1));
 
-    printf("[%zu] ", ++instruction_counter);
+    printf("[%llu] ", (unsigned long long)n);
 
     if (instr.data == 0x00E0) {
         printf("%#06X disp_clear() - Clears the screen\n", instr.data);
@@ -37,6 +39,33 @@ void dump_instruction(instr_t instr) {
     } else if (instr.data == 0x00EE) {
         printf("%#06X return; - Returns from a subroutine.\n", instr.data);
         return;
+    } else if (instr.data == 0x00FB) {
+        printf("%#06X scroll_right() - SUPER-CHIP: Scrolls the screen right by 4 pixels.\n", instr.data);
+        return;
+    } else if (instr.data == 0x00FC) {
+        printf("%#06X scroll_left() - SUPER-CHIP: Scrolls the screen left by 4 pixels.\n", instr.data);
+        return;
+    } else if (instr.data == 0x00FD) {
+        printf("%#06X exit() - SUPER-CHIP: Exits the interpreter.\n", instr.data);
+        return;
+    } else if (instr.data == 0x00FE) {
+        printf("%#06X lores() - SUPER-CHIP: Disables the high resolution mode (64x32).\n", instr.data);
+        return;
+    } else if (instr.data == 0x00FF) {
+        printf("%#06X hires() - SUPER-CHIP: Enables the high resolution mode (128x64).\n", instr.data);
+        return;
+    } else if ((instr.data & 0xfff0) == 0x00C0) {
+        printf("%#06X scroll_down(%x) - SUPER-CHIP: Scrolls the screen down by N pixels.\n", instr.data, instr.N);
+        return;
+    } else if ((instr.data & 0xfff0) == 0x00D0) {
+        printf("%#06X scroll_up(%x) - XO-CHIP: Scrolls the screen up by N pixels.\n", instr.data, instr.N);
+        return;
+    } else if (instr.data == 0xF000) {
+        printf("%#06X I = long_addr - XO-CHIP: Loads I with the 16 bit address in the next 2 bytes (the instruction is 4 bytes long).\n", instr.data);
+        return;
+    } else if (instr.data == 0xF002) {
+        printf("%#06X audio() - XO-CHIP: Loads the 16 bytes from I into the audio pattern buffer.\n", instr.data);
+        return;
     }
 
     switch (instr.type) {
@@ -82,6 +111,17 @@ void dump_instruction(instr_t instr) {
         case 5:
             assert(X(instr.data) == instr.X);
             assert(Y(instr.data) == instr.Y);
+            if (instr.N == 2 || instr.N == 3) {
+                printf("%#06X %s(V%x - V%x) - XO-CHIP: %s from VX to VY (both included, backwards if X > Y) %s memory starting at address I, I doesn't change (a 5XY0 without QUIRK_XO).\n",
+                       instr.data,
+                       instr.N == 2 ? "save" : "load",
+                       instr.X,
+                       instr.Y,
+                       instr.N == 2 ? "Stores" : "Fills",
+                       instr.N == 2 ? "in" : "with values from"
+                );
+                return;
+            }
             printf("%#06X if (V%x == V%x) - Skips the next instruction if VX equals VY (usually the next instruction is a jump to skip a code block).\n",
                    instr.data,
                    instr.X,
@@ -235,6 +275,14 @@ void dump_instruction(instr_t instr) {
             assert(X(instr.data) == instr.X);
             assert(Y(instr.data) == instr.Y);
             assert(N(instr.data) == instr.N);
+            if (!instr.N) {
+                printf("%#06X draw16(V%x, V%x) - SUPER-CHIP: Draws a 16x16 sprite at coordinate (VX, VY), two bytes per row starting from memory location I. VF is set to 1 if any screen pixels are flipped from set to unset.\n",
+                       instr.data,
+                       instr.X,
+                       instr.Y
+                );
+                return;
+            }
             printf("%#06X draw(V%x, V%x, %x) - Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels. Each row of 8 pixels is read as bit-coded starting from memory location I; I value does not change after the execution of this instruction. As described above, VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if that does not happen.\n",
                    instr.data,
                    instr.X,
@@ -266,6 +314,13 @@ void dump_instruction(instr_t instr) {
         case 0xF:
             assert(NN(instr.data) == instr.NN);
             switch (instr.NN) {
+                case 0x01:
+                    assert(X(instr.data) == instr.X);
+                    printf("%#06X plane(%x) - XO-CHIP: Selects the planes which the drawing, clearing and scrolling instructions work on, a bit for each plane.\n",
+                           instr.data,
+                           instr.X
+                    );
+                    return;
                 case 0x07:
                     assert(X(instr.data) == instr.X);
                     printf("%#06X V%x = get_delay() - Sets VX to the value of the delay timer.\n",
@@ -308,6 +363,13 @@ void dump_instruction(instr_t instr) {
                            instr.X
                     );
                     return;
+                case 0x30:
+                    assert(X(instr.data) == instr.X);
+                    printf("%#06X I = big_sprite_addr[V%x] - SUPER-CHIP: Sets I to the location of the 8x10 sprite for the character in VX(only consider the lowest nibble).\n",
+                           instr.data,
+                           instr.X
+                    );
+                    return;
                 case 0x33:
                     assert(X(instr.data) == instr.X);
                     printf(
@@ -319,6 +381,13 @@ void dump_instruction(instr_t instr) {
                             instr.X
                     );
                     return;
+                case 0x3A:
+                    assert(X(instr.data) == instr.X);
+                    printf("%#06X pitch(V%x) - XO-CHIP: Sets the playback rate of the audio pattern to 4000 * 2^((VX - 64) / 48) samples per second.\n",
+                           instr.data,
+                           instr.X
+                    );
+                    return;
                 case 0x55:
                     assert(X(instr.data) == instr.X);
                     printf("%#06X reg_dump(V%x, &I)  - Stores from V0 to VX (including VX) in memory, starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified.\n",
@@ -333,6 +402,20 @@ void dump_instruction(instr_t instr) {
                            instr.X
                     );
                     return;
+                case 0x75:
+                    assert(X(instr.data) == instr.X);
+                    printf("%#06X rpl_dump(V%x) - SUPER-CHIP: Stores from V0 to VX (including VX) in the RPL user flags.\n",
+                           instr.data,
+                           instr.X
+                    );
+                    return;
+                case 0x85:
+                    assert(X(instr.data) == instr.X);
+                    printf("%#06X rpl_load(V%x) - SUPER-CHIP: Fills from V0 to VX (including VX) with the RPL user flags.\n",
+                           instr.data,
+                           instr.X
+                    );
+                    return;
 
                 default:
                     goto not_an_opcode;
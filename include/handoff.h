@@ -0,0 +1,137 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+
+#include <chip8.h>
+#include <screen.h>
+#include <bit_utility.h>
+
+/*
+ What the emulation thread and the render thread of the sdl frontend (main.c) exchange, both ways lock-free.
+
+ Frames go through a triple buffer: the emulation thread writes the back frame and swaps it with the middle one,
+ the render thread swaps its front frame with the middle one when there is a new frame in it. Each side always owns
+ one frame and the middle one changes hands with a single atomic exchange, nobody ever waits: a slow present
+ only means that some frames are never shown, the emulation goes on at its own pace.
+ The dirty rows of a frame never shown are carried over to the next one, the texture of the render thread is updated
+ from the last frame it took so every row changed since then must be there.
+
+ The input goes the other way through a single producer / single consumer ring of handoff_event_t,
+ drained by the emulation thread once per frame (the keys as the chip sees them and the commands of the frontend).
+*/
+
+#define HANDOFF_FRESH  0x4u // in middle: the frame there wasn't taken by the render thread yet
+#define HANDOFF_EVENTS 64   // a power of 2, more than enough for the events of a frame
+
+typedef struct {
+    alignas(32) uint64_t plane[SCREEN_PLANES][SCREEN_HEIGHT][SCREEN_WORDS];
+    uint64_t dirty; // rows changed since the last frame taken by the render thread
+    uint8_t planes_used;
+    bool hires;
+} handoff_frame_t;
+
+typedef enum {
+    HANDOFF_KEY,    // key, status (KEY_UP / KEY_DOWN)
+    HANDOFF_SAVE,   // the state in the state file
+    HANDOFF_LOAD,   // the state from the state file
+    HANDOFF_REWIND, // status: KEY_DOWN starts rewinding, KEY_UP stops
+} handoff_event_type_t;
+
+typedef struct {
+    uint8_t type; // handoff_event_type_t
+    uint8_t key;  // keycodes_t
+    uint8_t status;
+} handoff_event_t;
+
+typedef struct {
+
+    handoff_frame_t frame[3];
+
+    alignas(64) _Atomic uint8_t middle; // index of the middle frame | HANDOFF_FRESH
+
+    // the emulation thread
+    alignas(64) uint8_t back;
+    uint64_t events_tail;
+
+    // the render thread
+    alignas(64) uint8_t front;
+    uint64_t events_head;
+
+    alignas(64) _Atomic uint64_t events_published; // head as seen by the emulation thread
+    alignas(64) _Atomic uint64_t events_consumed;  // tail as seen by the render thread
+    handoff_event_t events[HANDOFF_EVENTS];
+
+} handoff_t;
+
+
+void handoff_init(handoff_t *self) {
+    memset(self, 0x00, sizeof(handoff_t));
+    self->back  = 0;
+    self->front = 1;
+    atomic_init(&self->middle, 2);
+    atomic_init(&self->events_published, 0);
+    atomic_init(&self->events_consumed, 0);
+}
+
+/*
+ emulation thread: the screen of chip becomes the newest frame (chip->screen_dirty isn't reset, up to the caller).
+ Return true when the render thread had already taken the previous one, es. it's the moment to wake it up:
+ otherwise a wake up is still pending and it will take this one instead.
+*/
+bool handoff_publish(handoff_t *self, const chip8_t *chip) {
+
+    handoff_frame_t *const back = self->frame + self->back;
+
+    memcpy(back->plane, chip->plane, sizeof(back->plane));
+    back->planes_used = chip->planes_used;
+    back->hires       = chip->hires;
+
+    // a middle frame still fresh is about to be dropped: its rows go in this one. Reading its dirty is safe, the render
+    // thread never writes a frame, if it takes the middle one meanwhile the exchange fails and it's done again without
+    uint8_t middle = atomic_load_explicit(&self->middle, memory_order_acquire);
+    do {
+        back->dirty = chip->screen_dirty | (middle & HANDOFF_FRESH ? self->frame[middle & 3].dirty : 0);
+    } while (!atomic_compare_exchange_weak_explicit(&self->middle, &middle, self->back | HANDOFF_FRESH, memory_order_acq_rel, memory_order_acquire));
+
+    self->back = middle & 3;
+    return !(middle & HANDOFF_FRESH);
+}
+
+// render thread: the newest frame if there is one it didn't take yet, NULL otherwise. It stays valid till the next call
+const handoff_frame_t * handoff_acquire(handoff_t *self) {
+
+    if (!(atomic_load_explicit(&self->middle, memory_order_relaxed) & HANDOFF_FRESH))
+        return NULL;
+
+    const uint8_t middle = atomic_exchange_explicit(&self->middle, self->front, memory_order_acq_rel);
+    self->front = middle & 3;
+    return self->frame + self->front;
+}
+
+
+// render thread: false when the ring is full (the emulation thread is stuck), the event is dropped
+bool handoff_push(handoff_t *self, handoff_event_t ev) {
+
+    const uint64_t head = self->events_head;
+    if (UNLIKELY(head - atomic_load_explicit(&self->events_consumed, memory_order_acquire) == HANDOFF_EVENTS))
+        return false;
+
+    self->events[head & (HANDOFF_EVENTS - 1)] = ev;
+    atomic_store_explicit(&self->events_published, self->events_head = head + 1, memory_order_release);
+    return true;
+}
+
+// emulation thread: the oldest event in *ev, false when there is none
+bool handoff_pop(handoff_t *self, handoff_event_t *ev) {
+
+    const uint64_t tail = self->events_tail;
+    if (tail == atomic_load_explicit(&self->events_published, memory_order_acquire))
+        return false;
+
+    *ev = self->events[tail & (HANDOFF_EVENTS - 1)];
+    atomic_store_explicit(&self->events_consumed, self->events_tail = tail + 1, memory_order_release);
+    return true;
+}
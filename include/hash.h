@@ -0,0 +1,91 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// FNV-1a 64 bit, cheap enough to fingerprint the framebuffer or the whole machine
+static inline uint64_t fnv1a64(const void *data, size_t len, uint64_t h) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; ++i)
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+#define FNV1A64_INIT 0xcbf29ce484222325ULL
+
+// splitmix64: one 64 bit word of state, any seed is fine (0 included)
+static inline uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// xxHash64 (Yann Collet), the fingerprint of a rom in a pack (rompack.h): 8 bytes per step, ~1 cycle per byte
+static inline uint64_t xxh64_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+#define XXH64_P1 0x9e3779b185ebca87ULL
+#define XXH64_P2 0xc2b2ae3d27d4eb4fULL
+#define XXH64_P3 0x165667b19e3779f9ULL
+#define XXH64_P4 0x85ebca77c2b2ae63ULL
+#define XXH64_P5 0x27d4eb2f165667c5ULL
+
+static inline uint64_t xxh64_read64(const uint8_t *p) {
+    return (uint64_t)p[0]       | (uint64_t)p[1] << 8  | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+           (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    return xxh64_rotl(acc + input * XXH64_P2, 31) * XXH64_P1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val) {
+    return (acc ^ xxh64_round(0, val)) * XXH64_P1 + XXH64_P4;
+}
+
+static inline uint64_t xxh64(const void *data, size_t len, uint64_t seed) {
+
+    const uint8_t *p = data, *const end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + XXH64_P1 + XXH64_P2, v2 = seed + XXH64_P2, v3 = seed, v4 = seed - XXH64_P1;
+
+        for (; p + 32 <= end; p += 32) {
+            v1 = xxh64_round(v1, xxh64_read64(p));
+            v2 = xxh64_round(v2, xxh64_read64(p + 8));
+            v3 = xxh64_round(v3, xxh64_read64(p + 16));
+            v4 = xxh64_round(v4, xxh64_read64(p + 24));
+        }
+
+        h = xxh64_rotl(v1, 1) + xxh64_rotl(v2, 7) + xxh64_rotl(v3, 12) + xxh64_rotl(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = seed + XXH64_P5;
+    }
+
+    h += len;
+
+    for (; p + 8 <= end; p += 8)
+        h = xxh64_rotl(h ^ xxh64_round(0, xxh64_read64(p)), 27) * XXH64_P1 + XXH64_P4;
+
+    if (p + 4 <= end) {
+        const uint64_t w = (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24;
+        h = xxh64_rotl(h ^ w * XXH64_P1, 23) * XXH64_P2 + XXH64_P3;
+        p += 4;
+    }
+
+    for (; p < end; ++p)
+        h = xxh64_rotl(h ^ *p * XXH64_P5, 11) * XXH64_P1;
+
+    h ^= h >> 33;
+    h *= XXH64_P2;
+    h ^= h >> 29;
+    h *= XXH64_P3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include <chip8.h>
+#include <jit.h>
+#include <idle.h>
+#include <hash.h>
+#include <movie.h>
+#include <video.h>
+
+/*
+ Run a rom without any frontend: no window, no audio, no sleep.
+ Time is measured in instructions, every ipf instructions is a 60 Hz frame and the timers tick once.
+*/
+
+#define HEADLESS_IPF 30 // instructions per frame, ~1800 Hz close to the pace of the SDL frontend
+
+// at the beginning of a frame the key is pressed or released
+typedef struct {
+    uint32_t frame;
+    uint8_t key;
+    keystate_t state;
+} key_event_t;
+
+typedef struct {
+    const key_event_t *keys; // sorted by frame
+    size_t keys_len;
+    uint64_t max_cycles;
+    uint32_t ipf;
+    chip_jit_t *jit; // optional, already attached to the chip (chip_jit_new() or chip_jit_reset())
+    bool idle;       // fast forward the idle loops (idle.h), same results. Not with the jit
+    movie_t *movie;  // optional, already started (movie_start()): the keys are recorded, or played back
+    video_t *video;  // optional: the screen of every frame, lossless (video_new())
+} headless_opts_t;
+
+typedef struct {
+    uint64_t cycles; // instructions elapsed, the ones spent waiting a key (iFX0A) included
+    uint32_t frames;
+    uint64_t idle;   // instructions fast forwarded by idle_run()
+    double seconds;  // wall clock
+} headless_result_t;
+
+
+static int key_event_cmp(const void *a, const void *b) {
+    const key_event_t *l = a, *r = b;
+    return (l->frame > r->frame) - (l->frame < r->frame);
+}
+
+/*
+ "frame:key:down|up" comma separated es. "60:5:down,64:5:up" (key is an hex digit),
+ events are appended to *events and sorted, return false on a malformed script.
+*/
+bool keyscript_parse(const char *script, key_event_t **events, size_t *len) {
+
+    for (const char *p = script; *p; ) {
+
+        char *end;
+        const unsigned long frame = strtoul(p, &end, 10);
+        if (end == p || *end != ':' || !isxdigit((unsigned char)end[1]) || end[2] != ':')
+            return false;
+
+        const uint8_t key = isdigit((unsigned char)end[1]) ? end[1] - '0' : tolower((unsigned char)end[1]) - 'a' + 10;
+        p = end + 3;
+
+        keystate_t state;
+        if (!strncmp(p, "down", 4))    state = KEY_DOWN, p += 4;
+        else if (!strncmp(p, "up", 2)) state = KEY_UP,   p += 2;
+        else return false;
+
+        if (*p == ',') ++p;
+        else if (*p) return false;
+
+        key_event_t *tmp;
+        if (!(tmp = realloc(*events, (*len + 1) * sizeof(key_event_t))))
+            return false;
+
+        *events = tmp;
+        (*events)[(*len)++] = (key_event_t){ .frame = frame, .key = key, .state = state };
+    }
+
+    qsort(*events, *len, sizeof(key_event_t), key_event_cmp);
+    return true;
+}
+
+// in lo-res only the words of its quarter (screen.h): the same hash the 64x32 screen always had.
+// The XO-CHIP planes after plane 0 are chained only once iFN01 used them, the other profiles keep their hash
+uint64_t chip_screen_hash(const chip8_t *chip) {
+
+    uint64_t h = FNV1A64_INIT;
+    for (uint8_t p = 0; p < SCREEN_PLANES; ++p) {
+
+        if (!(chip->planes_used >> p & 1))
+            continue;
+
+        if (chip->hires) {
+            h = fnv1a64(chip->plane[p], sizeof(chip->plane[p]), h);
+            continue;
+        }
+
+        for (uint8_t r = 0; r < SCREEN_LORES_HEIGHT; ++r)
+            h = fnv1a64(chip->plane[p][r], sizeof(chip->plane[p][r][0]), h);
+    }
+
+    return h;
+}
+
+void headless_run(chip8_t *chip, const headless_opts_t *opts, headless_result_t *result) {
+
+    assert(opts->ipf);
+
+    chip_jit_t *const jit = opts->jit;
+    movie_t *const movie = opts->movie;
+    size_t next_key = 0;
+
+    struct timespec beg, end;
+    clock_gettime(CLOCK_MONOTONIC, &beg);
+
+    memset(result, 0x00, sizeof(*result));
+    while (result->cycles < opts->max_cycles) {
+
+        for (; next_key < opts->keys_len && opts->keys[next_key].frame <= result->frames; ++next_key) {
+            if (movie) movie_press(movie, chip, opts->keys[next_key].key, opts->keys[next_key].state);
+            else chip_press_key(chip, opts->keys[next_key].key, opts->keys[next_key].state);
+        }
+
+        if (movie) movie_frame(movie, chip);
+
+        const uint64_t left = opts->max_cycles - result->cycles;
+        const uint32_t budget = left < opts->ipf ? left : opts->ipf;
+
+        if (jit) {
+            chip_jit_run(jit, budget);
+        } else if (opts->idle) {
+            result->idle += idle_run(chip, budget);
+        } else {
+            for (uint32_t i = 0; i < budget && !chip->is_awaiting; )
+                i += chip_run(chip, budget - i, NULL);
+        }
+
+        // while waiting a key the frame goes on anyway
+        result->cycles += budget;
+        if (budget < opts->ipf) break;
+
+        result->frames++;
+        chip_tick(chip);
+        if (movie) movie_tick(movie, chip);
+        if (opts->video) video_push(opts->video, chip);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->seconds = (end.tv_sec - beg.tv_sec) + (end.tv_nsec - beg.tv_nsec) / 1.0e9;
+}
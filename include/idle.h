@@ -0,0 +1,125 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <chip8.h>
+#include <bit_utility.h>
+
+/*
+ Idle loops: a rom waiting the delay timer (F407 3400 120E), a key (E19E 1202) or nothing at all (1NNN jump to self)
+ runs the same handful of instructions for the whole frame, and nothing can change until the next chip_tick().
+
+ idle_run() is the usual "up to budget chip_step()" of a frame (through chip_run()), but it remembers the state at the last IDLE_WINDOW
+ targets of a backward jump (1NNN or BNNN not moving the PC forward, every loop has one). Coming back to one
+ of them with the same registers, I, stack, timers, rng and no memory or screen write in between means the code
+ in the middle is a loop that will do exactly the same till the end of the frame: the whole periods left are counted
+ as executed without running them, the remainder (less than a period) runs as usual.
+ So the state at the end of the frame is exactly the one of chip_step() budget times, only much cheaper.
+*/
+
+#define IDLE_WINDOW 4 // loop heads remembered, a loop with more backward jumps than this isn't detected
+
+/*
+ Looking costs: every backward jump leaves the threaded loop of chip_run() and takes a signature. A rom which never
+ idles (es. it computes for the whole frame) would be slower than without idle_run(), so after a frame without an idle loop
+ the next 1, 2, 4 ... IDLE_BACKOFF_MAX frames run without looking, a frame with one (or waiting a key) starts over.
+*/
+#define IDLE_BACKOFF_MAX 64
+
+typedef struct {
+    uint64_t V[2];       // V0..VF
+    uint64_t rng;
+    uint32_t writes;     // chip->writes, the memory, the screen and the RPL flags
+    uint16_t I;
+    uint16_t stack_top;  // what a 00EE would read
+    uint8_t stack_idx;
+    uint8_t delay_timer, sound_timer;
+    uint8_t planes;      // iFN01 changes no memory
+    uint8_t pad[4]; // 0, compared with memcmp()
+} idle_sig_t;
+
+_Static_assert(sizeof(idle_sig_t) == 40, "padding in idle_sig_t");
+
+typedef struct {
+    idle_sig_t sig;
+    uint32_t at; // instructions of the frame when the PC was here
+    uint16_t PC;
+} idle_head_t;
+
+
+static FORCED(inline) void idle_signature(const chip8_t *chip, idle_sig_t *sig) {
+    memcpy(sig->V, chip->V, sizeof(sig->V));
+    sig->rng         = chip->rng;
+    sig->writes      = chip->writes;
+    sig->I           = chip->I;
+    sig->stack_idx   = chip->stack.idx;
+    sig->stack_top   = chip->stack.stack[(uint8_t)(chip->stack.idx - 1)];
+    sig->delay_timer = chip->delay_timer;
+    sig->sound_timer = chip->sound_timer;
+    sig->planes      = chip->planes;
+    memset(sig->pad, 0x00, sizeof(sig->pad));
+}
+
+// up to budget instructions of a frame, stops waiting a key (iFX0A). Return how many were counted without running them
+uint32_t idle_run(chip8_t *chip, uint32_t budget) {
+
+    if (chip->idle.wait) {
+        chip->idle.wait--;
+        for (uint32_t i = 0; i < budget && !chip->is_awaiting; )
+            i += chip_run(chip, budget - i, NULL);
+        return 0;
+    }
+
+    idle_head_t heads[IDLE_WINDOW];
+    uint8_t heads_len = 0, next = 0;
+    uint32_t skipped = 0;
+    bool found = false;
+
+    chip->idle.probe = true;
+
+    for (uint32_t i = 0; i < budget && !chip->is_awaiting; ) {
+
+        // only the jumps (1NNN, BNNN) not moving forward stop here, a loop of just calls and returns always moves forward
+        chip_run_stop_t why;
+        i += chip_run(chip, budget - i, &why);
+        if (LIKELY(why != CHIP_RUN_LOOP))
+            continue;
+
+        idle_sig_t sig;
+        idle_signature(chip, &sig);
+
+        uint8_t h = 0;
+        for (; h < heads_len && heads[h].PC != chip->PC; ++h);
+
+        if (h < heads_len && !memcmp(&heads[h].sig, &sig, sizeof(sig))) {
+            found = true;
+            // a period later, same state: the remaining whole periods would end here again
+            const uint32_t period = i - heads[h].at;
+            const uint32_t skip   = (budget - i) / period * period;
+
+            chip->cycles += skip;
+            skipped      += skip;
+            i            += skip;
+            heads[h].at   = i;
+            continue;
+        }
+
+        if (h == heads_len) {
+            h = heads_len < IDLE_WINDOW ? heads_len++ : next;
+            next = (next + 1) % IDLE_WINDOW;
+        }
+
+        heads[h] = (idle_head_t){ .sig = sig, .at = i, .PC = chip->PC };
+    }
+
+    chip->idle.probe = false;
+
+    if (found || chip->is_awaiting)
+        chip->idle.backoff = 0;
+    else
+        chip->idle.backoff = chip->idle.backoff ? (chip->idle.backoff < IDLE_BACKOFF_MAX / 2 ? chip->idle.backoff * 2 : IDLE_BACKOFF_MAX) : 1;
+
+    chip->idle.wait = chip->idle.backoff;
+    return skipped;
+}
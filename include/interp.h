@@ -0,0 +1,145 @@
+// no #pragma once: chip8.h includes this file once per quirk profile
+
+/*
+ The part of the interpreter specialised per quirk profile (quirks.h), chip8.h defines INTERP_NAME (es. CHIP8) and
+ INTERP_SUFFIX (es. _chip8) before every inclusion. Each one defines
+ - the instance of every handler marked in CHIP_OPCODES (opcodes.h), es. i8XY1_chip8(): the quirk_8XY1() of chip8.h
+   called with the flags of the profile as a constant, so the ifs on the flags are resolved at compile time
+ - interp_ops_chip8[], the handler of every OP_xxx and its step
+ - interp_run_chip8(), what chip_run() calls for a chip with this profile
+ DEFAULT has no suffix: i8XY1(), interp_ops[], interp_run().
+*/
+
+#if !defined(INTERP_NAME) || !defined(INTERP_SUFFIX)
+#error "define INTERP_NAME and INTERP_SUFFIX before including interp.h, see chip8.h"
+#endif
+
+#define INTERP_CAT(_A_, _B_)  INTERP_CAT_(_A_, _B_)
+#define INTERP_CAT_(_A_, _B_) _A_##_B_
+
+#define INTERP_FLAGS  INTERP_CAT(QUIRKS_FLAGS_, INTERP_NAME) // es. QUIRKS_FLAGS_CHIP8
+#define INTERP_OPS    INTERP_CAT(interp_ops, INTERP_SUFFIX)
+#define INTERP_DECODE INTERP_CAT(interp_decode, INTERP_SUFFIX)
+#define INTERP_RUN    INTERP_CAT(interp_run, INTERP_SUFFIX)
+
+
+#define INTERP_INSTANCE(_NAME_, _HANDLER_, _STEP_, _QUIRKS_) INTERP_INSTANCE_##_QUIRKS_(_NAME_, _HANDLER_)
+#define INTERP_INSTANCE_0(_NAME_, _HANDLER_)
+#define INTERP_INSTANCE_1(_NAME_, _HANDLER_) \
+    void OP_HANDLER(_HANDLER_, 1, INTERP_SUFFIX)(chip8_t *chip, instr_t instr) { quirk_##_NAME_(chip, instr, INTERP_FLAGS); }
+
+CHIP_OPCODES(INTERP_INSTANCE)
+
+#undef INTERP_INSTANCE_1
+#undef INTERP_INSTANCE_0
+#undef INTERP_INSTANCE
+
+
+#define INTERP_OP(_NAME_, _HANDLER_, _STEP_, _QUIRKS_) { .exec = OP_HANDLER(_HANDLER_, _QUIRKS_, INTERP_SUFFIX), .step = _STEP_ },
+static const chip_op_t INTERP_OPS[OP_LEN] = { CHIP_OPCODES(INTERP_OP) };
+#undef INTERP_OP
+
+static FORCED(inline) decoded_t INTERP_DECODE(instr_t instr) {
+    const uint8_t op = chip_opcode_table[instr.data];
+    return (decoded_t){ .exec = INTERP_OPS[op].exec, .instr = instr, .step = INTERP_OPS[op].step, .op = op };
+}
+
+
+/*
+ Up to max_cycles chip_step() in a row, threaded: every handler is a label (labels as values, gcc & clang) ending with
+ its own fetch from the icache and its own "goto *label", so there is no return to a caller loop and every
+ dispatch point gets its own slot in the branch predictor. The handlers are called directly, the compiler can inline them.
+ Stops early on the events of chip_run_stop_t, return how many cycles went by (see chip_run()).
+*/
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" // &&label and goto *ptr are gnu extensions
+static uint32_t INTERP_RUN(chip8_t *chip, uint32_t max_cycles, chip_run_stop_t *why) {
+
+#define OP_LABEL(_NAME_, _HANDLER_, _STEP_, _QUIRKS_) &&op_##_NAME_,
+    static const void *const labels[OP_LEN] = { CHIP_OPCODES(OP_LABEL) };
+#undef OP_LABEL
+
+    chip_run_stop_t stop;
+    decoded_t *slot;
+    instr_t instr;
+    uint16_t pc;
+    uint32_t n = 0, waited = 0;
+
+    if (UNLIKELY(chip->is_awaiting)) {
+        stop = CHIP_RUN_WAIT;
+        goto out;
+    }
+
+#ifdef CHIP_DEBUG
+    #define RUN_DEBUG() dump_instruction(chip->cycles + n, instr);
+#else
+    #define RUN_DEBUG()
+#endif
+
+#ifdef CHIP_PROFILE
+    #define RUN_PROFILE() if (chip->profile) chip_profile_exec(chip->profile, pc, instr);
+#else
+    #define RUN_PROFILE()
+#endif
+
+#ifdef CHIP_TRACE
+    #define RUN_TRACE() if (chip->trace) chip_trace_exec(chip->trace, chip->cycles + n, pc, instr.data, chip->V, chip->I, chip->is_awaiting);
+#else
+    #define RUN_TRACE()
+#endif
+
+#define RUN_STOP(_WHY_) do { stop = _WHY_; goto out; } while (0)
+
+#define RUN_DISPATCH() do { \
+    if (UNLIKELY(n == max_cycles)) RUN_STOP(CHIP_RUN_BUDGET); \
+    pc = chip->PC; \
+    slot = chip->icache + pc; \
+    if (UNLIKELY(!slot->exec)) \
+        *slot = INTERP_DECODE(chip_fetch(chip, pc)); \
+    instr = slot->instr; \
+    RUN_DEBUG() \
+    RUN_PROFILE() \
+    goto *labels[slot->op]; \
+} while (0)
+
+// the ifs on OP_##_NAME_ and on INTERP_FLAGS are constants, every label keeps only its own
+#define OP_BODY(_NAME_, _HANDLER_, _STEP_, _QUIRKS_) \
+    op_##_NAME_: \
+        OP_HANDLER(_HANDLER_, _QUIRKS_, INTERP_SUFFIX)(chip, instr); /* may invalidate its own slot (iFX55, iFX33), the step is a constant */ \
+        RUN_TRACE() \
+        chip->PC = (chip->PC + _STEP_) & CHIP_ADDR_MASK(INTERP_FLAGS); /* 4 KB wrap around without QUIRK_XO */ \
+        ++n; \
+        if ((OP_##_NAME_ == OP_1NNN || OP_##_NAME_ == OP_BNNN || OP_##_NAME_ == OP_00FD) && chip->PC <= pc && chip->idle.probe) RUN_STOP(CHIP_RUN_LOOP); \
+        if (OP_##_NAME_ == OP_00E0 || OP_##_NAME_ == OP_DXYN || OP_##_NAME_ == OP_DXY0) { \
+            if (INTERP_FLAGS & QUIRK_DISPLAY_WAIT) waited = max_cycles - n; /* the rest of the frame waits the vertical blank */ \
+            RUN_STOP(CHIP_RUN_DRAW); \
+        } \
+        if (OP_##_NAME_ == OP_FX0A && chip->is_awaiting) RUN_STOP(CHIP_RUN_WAIT); \
+        RUN_DISPATCH();
+
+    RUN_DISPATCH();
+    CHIP_OPCODES(OP_BODY)
+
+#undef OP_BODY
+#undef RUN_DISPATCH
+#undef RUN_STOP
+#undef RUN_TRACE
+#undef RUN_PROFILE
+#undef RUN_DEBUG
+
+out:
+    chip->cycles += n;
+    if (why) *why = stop;
+    return n + waited;
+}
+#pragma GCC diagnostic pop
+
+
+#undef INTERP_RUN
+#undef INTERP_DECODE
+#undef INTERP_OPS
+#undef INTERP_FLAGS
+#undef INTERP_CAT_
+#undef INTERP_CAT
+#undef INTERP_SUFFIX
+#undef INTERP_NAME
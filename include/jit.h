@@ -0,0 +1,607 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <chip8.h>
+
+/*
+ A dynamic recompiler for x86-64, it sits next to chip_exec() and translates basic blocks of the rom into native code.
+
+ A block begins at the PC and ends with the first jump, call, return, skip, memory write (iFX33, iFX55) or iFX0A,
+ the V registers used by the block (at most JIT_HOST_REGS of them) live in host registers from the entry to the exit.
+ Instructions too complex to be worth inlining (draw, rand, etc.) call their interpreter handler.
+
+ Blocks with a static successor (1NNN, 2NNN, skips) jump straight to the next block once it has been translated,
+ everything else returns to chip_jit_run() which looks up the next block.
+ When the rom writes into translated code the whole translation cache is dropped before the next dispatch.
+
+ Anything which can't be translated (0NNN, unknown opcodes, non x86-64 hosts) runs through chip_step().
+ Only for a chip with the DEFAULT quirks (quirks.h): the inlined code is the one of those handlers.
+*/
+
+#define JIT_ARENA_SIZE    (1 << 20)
+#define JIT_BLOCK_RESERVE (16 << 10)  // worst case size of a translated block
+#define JIT_MAX_BLOCK_LEN 64          // instructions
+#define JIT_MAX_LINKS     1024
+#define JIT_HOST_REGS     8
+
+typedef uint32_t (*jit_entry_t)(chip8_t *chip, int32_t *budget, const uint8_t *code);
+typedef void (*jit_fn_t)(void);
+
+// a direct jump still pointing to the exit, waiting for its target to be translated
+typedef struct {
+    uint32_t site; // arena offset of the rel32
+    uint16_t target;
+} jit_link_t;
+
+typedef struct {
+
+    chip8_t *chip;
+
+    uint8_t *arena;   // mmap'd, writable and executable
+    uint32_t used;
+    uint32_t code_beg; // first byte after the entry/exit trampolines
+
+    jit_entry_t enter;
+    const uint8_t *exit;
+
+    const uint8_t *block[0xfff + 1]; // translated block starting at each address (the 4 KB of the DEFAULT quirks)
+    uint8_t code_map[(0xfff + 1) / 8];  // memory bytes read by some translated block
+    bool dirty;                         // translated code has been overwritten, flush before the next dispatch
+
+    jit_link_t links[JIT_MAX_LINKS];
+    uint16_t links_len;
+
+} chip_jit_t;
+
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// registers holding the V registers, r15 holds the chip, r14d the budget
+static const uint8_t jit_host_regs[JIT_HOST_REGS] = { RBX, RBP, R12, R13, R8, R9, R10, R11 };
+
+// an 8 bit operand: a host register or [r15 + disp]
+typedef struct {
+    int8_t reg; // < 0 -> memory
+    int32_t disp;
+} jit_rm_t;
+
+static FORCED(inline) void jit_u8(chip_jit_t *self, uint8_t b) {
+    self->arena[self->used++] = b;
+}
+
+static FORCED(inline) void jit_u32(chip_jit_t *self, uint32_t v) {
+    memcpy(self->arena + self->used, &v, sizeof(v));
+    self->used += sizeof(v);
+}
+
+static FORCED(inline) void jit_u64(chip_jit_t *self, uint64_t v) {
+    memcpy(self->arena + self->used, &v, sizeof(v));
+    self->used += sizeof(v);
+}
+
+static FORCED(inline) jit_rm_t jit_mem(int32_t disp) {
+    return (jit_rm_t){ .reg = -1, .disp = disp };
+}
+
+static FORCED(inline) jit_rm_t jit_reg(uint8_t reg) {
+    return (jit_rm_t){ .reg = reg };
+}
+
+// REX opcode ModRM [disp32], the REX is always emitted so that 8 bit operands 4-7 are spl, bpl, sil, dil
+static void jit_rm(chip_jit_t *self, bool w, uint8_t reg, jit_rm_t rm, const uint8_t *opcode, uint8_t opcode_len) {
+
+    const uint8_t base = rm.reg < 0 ? R15 : rm.reg;
+    jit_u8(self, 0x40 | w << 3 | (reg >> 3) << 2 | (base >> 3));
+
+    for (uint8_t i = 0; i < opcode_len; ++i)
+        jit_u8(self, opcode[i]);
+
+    if (rm.reg >= 0) {
+        jit_u8(self, 0xC0 | (reg & 7) << 3 | (base & 7));
+        return;
+    }
+
+    jit_u8(self, 0x80 | (reg & 7) << 3 | (base & 7)); // [r15 + disp32]
+    jit_u32(self, rm.disp);
+}
+
+#define JIT_RM(_SELF_, _REG_, _RM_, ...) \
+    jit_rm(_SELF_, false, _REG_, _RM_, (const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ }))
+
+// rel32 of a jump or call emitted just before the current position
+static FORCED(inline) void jit_patch(chip_jit_t *self, uint32_t site, const uint8_t *target) {
+    const int32_t rel = (int32_t)(target - (self->arena + site + sizeof(int32_t)));
+    memcpy(self->arena + site, &rel, sizeof(rel));
+}
+
+static uint32_t jit_jmp(chip_jit_t *self, const uint8_t *target) {
+    jit_u8(self, 0xE9);
+    const uint32_t site = self->used;
+    jit_u32(self, 0);
+    jit_patch(self, site, target);
+    return site;
+}
+
+
+// the state of the block being translated
+typedef struct {
+    int8_t host[REG_LEN]; // V register -> host register (-1 in memory)
+    uint16_t pc;
+} jit_ctx_t;
+
+static FORCED(inline) jit_rm_t jit_v(const jit_ctx_t *ctx, uint8_t vreg) {
+    return ctx->host[vreg] >= 0
+        ? jit_reg(ctx->host[vreg])
+        : jit_mem(offsetof(chip8_t, V) + vreg);
+}
+
+// mapped registers: host <- chip->V
+static void jit_reload(chip_jit_t *self, const jit_ctx_t *ctx) {
+    for (uint8_t v = 0; v < REG_LEN; ++v)
+        if (ctx->host[v] >= 0)
+            JIT_RM(self, ctx->host[v], jit_mem(offsetof(chip8_t, V) + v), 0x0F, 0xB6); // movzx r32, byte [r15 + V + v]
+}
+
+// mapped registers: chip->V <- host (flags are preserved)
+static void jit_spill(chip_jit_t *self, const jit_ctx_t *ctx) {
+    for (uint8_t v = 0; v < REG_LEN; ++v)
+        if (ctx->host[v] >= 0)
+            JIT_RM(self, ctx->host[v], jit_mem(offsetof(chip8_t, V) + v), 0x88); // mov byte [r15 + V + v], r8
+}
+
+// rdi = chip, esi = instr, edx = pc; then call
+static void jit_call(chip_jit_t *self, jit_fn_t fn, instr_t instr, uint16_t pc) {
+    jit_u8(self, 0x4C); jit_u8(self, 0x89); jit_u8(self, 0xFF); // mov rdi, r15
+    jit_u8(self, 0xBE); jit_u32(self, instr.data);              // mov esi, imm32
+    jit_u8(self, 0xBA); jit_u32(self, pc);                      // mov edx, imm32
+    jit_u8(self, 0x48); jit_u8(self, 0xB8); jit_u64(self, (uintptr_t)fn); // mov rax, imm64
+    jit_u8(self, 0xFF); jit_u8(self, 0xD0);                     // call rax
+}
+
+// call an interpreter handler in the middle of the block, V registers are exchanged through memory
+static void jit_call_handler(chip_jit_t *self, const jit_ctx_t *ctx, chip_handler_t handler, instr_t instr) {
+    jit_spill(self, ctx);
+    jit_call(self, (jit_fn_t)handler, instr, ctx->pc);
+    jit_reload(self, ctx);
+}
+
+// a (not yet spilled) exit towards a known address, jump to its block if already translated
+static void jit_exit_static(chip_jit_t *self, uint16_t target) {
+
+    target &= 0xfff;
+    jit_u8(self, 0xB8); jit_u32(self, target); // mov eax, target
+
+    if (self->block[target]) {
+        jit_jmp(self, self->block[target]);
+        return;
+    }
+
+    const uint32_t site = jit_jmp(self, self->exit);
+    if (self->links_len < JIT_MAX_LINKS)
+        self->links[self->links_len++] = (jit_link_t){ .site = site, .target = target };
+}
+
+// executes the instruction through the interpreter and return to the dispatcher with the resulting PC
+static uint32_t jit_helper_exec(chip8_t *chip, instr_t instr, uint32_t pc) {
+    const decoded_t op = chip_decode(instr); // not chip_exec(), chip->cycles is updated by chip_jit_run()
+    chip->PC = pc;
+    op.exec(chip, op.instr);
+    chip->PC = (chip->PC + op.step) & 0xfff;
+    return chip->PC;
+}
+
+// the stack push of 2NNN, the jump itself is a static exit
+static void jit_helper_call(chip8_t *chip, instr_t instr, uint32_t pc) {
+    (void)instr;
+    stack_push(&chip->stack, pc);
+}
+
+// skip instruction: flags already set by a cmp, jcc is the condition to skip
+static void jit_exit_skip(chip_jit_t *self, const jit_ctx_t *ctx, uint8_t jcc) {
+
+    jit_spill(self, ctx);
+
+    jit_u8(self, 0x0F); jit_u8(self, jcc); // jcc rel32 -> skip
+    const uint32_t site = self->used;
+    jit_u32(self, 0);
+
+    jit_exit_static(self, ctx->pc + sizeof(instr_t));
+    jit_patch(self, site, self->arena + self->used);
+    jit_exit_static(self, ctx->pc + sizeof(instr_t) * 2);
+}
+
+// can this opcode be part of a block? is it the last instruction of the block?
+static bool jit_classify(instr_t instr, bool *is_last) {
+
+    const decoded_t op = chip_decode(instr);
+    if (op.exec == i0NNN || op.exec == not_an_opcode)
+        return false;
+
+    *is_last = op.step == 0 // jumps
+        || op.exec == i00EE
+        || op.exec == i3XNN || op.exec == i4XNN || op.exec == i5XY0 || op.exec == i9XY0
+        || op.exec == i5XY2 || op.exec == i5XY3 // a 5XY0 with the DEFAULT quirks
+        || op.exec == iF000 // 4 bytes
+        || op.exec == iEX9E || op.exec == iEXA1
+        || op.exec == iFX0A || op.exec == iFX33 || op.exec == iFX55;
+
+    return true;
+}
+
+// how many times the inlined code touches each V register
+static void jit_uses(instr_t instr, uint8_t uses[REG_LEN]) {
+    switch (instr.type) {
+        case 3: case 4: case 6: case 7:
+            ++uses[instr.X];
+            return;
+        case 5: case 9:
+            ++uses[instr.X], ++uses[instr.Y];
+            return;
+        case 8:
+            ++uses[instr.X], ++uses[instr.Y], ++uses[REG_VF];
+            return;
+        case 0xF:
+            uses[instr.X] += instr.NN == 0x07 || instr.NN == 0x15 || instr.NN == 0x18 || instr.NN == 0x1E || instr.NN == 0x29;
+            return;
+    }
+}
+
+static void jit_translate_instr(chip_jit_t *self, const jit_ctx_t *ctx, instr_t instr) {
+
+    const jit_rm_t VX = jit_v(ctx, instr.X);
+    const jit_rm_t VY = jit_v(ctx, instr.Y);
+    const jit_rm_t VF = jit_v(ctx, REG_VF);
+    const jit_rm_t AL = jit_reg(RAX);
+
+    switch (instr.type) {
+        case 1: // goto NNN
+            jit_spill(self, ctx);
+            jit_exit_static(self, instr.NNN);
+            return;
+        case 2: // *(NNN)()
+            jit_spill(self, ctx);
+            jit_call(self, (jit_fn_t)jit_helper_call, instr, ctx->pc);
+            jit_exit_static(self, instr.NNN);
+            return;
+        case 3: // if (VX == NN) skip
+            JIT_RM(self, 7, VX, 0x80); jit_u8(self, instr.NN); // cmp VX, imm8
+            jit_exit_skip(self, ctx, 0x84); // je
+            return;
+        case 4: // if (VX != NN) skip
+            JIT_RM(self, 7, VX, 0x80); jit_u8(self, instr.NN);
+            jit_exit_skip(self, ctx, 0x85); // jne
+            return;
+        case 5: // if (VX == VY) skip
+            JIT_RM(self, RAX, VY, 0x8A); // mov al, VY
+            JIT_RM(self, RAX, VX, 0x38); // cmp VX, al
+            jit_exit_skip(self, ctx, 0x84);
+            return;
+        case 9:
+            JIT_RM(self, RAX, VY, 0x8A);
+            JIT_RM(self, RAX, VX, 0x38);
+            jit_exit_skip(self, ctx, 0x85);
+            return;
+        case 6: // VX = NN
+            JIT_RM(self, 0, VX, 0xC6); jit_u8(self, instr.NN);
+            return;
+        case 7: // VX += NN
+            JIT_RM(self, 0, VX, 0x80); jit_u8(self, instr.NN);
+            return;
+
+        case 8:
+            switch (instr.N) {
+                case 0: // VX = VY
+                    JIT_RM(self, RAX, VY, 0x8A);
+                    JIT_RM(self, RAX, VX, 0x88);
+                    return;
+                case 1: case 2: case 3: { // VX |= VY, VX &= VY, VX ^= VY; VF = 0
+                    static const uint8_t alu[] = { [1] = 0x08, [2] = 0x20, [3] = 0x30 };
+                    JIT_RM(self, RAX, VY, 0x8A);
+                    JIT_RM(self, RAX, VX, alu[instr.N]);
+                    JIT_RM(self, 0, VF, 0xC6); jit_u8(self, 0);
+                    return;
+                }
+                case 4: // VX += VY; VF = carry
+                    JIT_RM(self, RAX, VY, 0x8A);
+                    JIT_RM(self, RAX, VX, 0x00);
+                    JIT_RM(self, 0, VF, 0x0F, 0x92); // setc VF
+                    return;
+                case 5: // VX -= VY; VF = borrow
+                    JIT_RM(self, RAX, VY, 0x8A);
+                    JIT_RM(self, RAX, VX, 0x28);
+                    JIT_RM(self, 0, VF, 0x0F, 0x92);
+                    return;
+                case 7: // VX = VY - VX; VF = borrow
+                    JIT_RM(self, RAX, VY, 0x8A);
+                    JIT_RM(self, RAX, VX, 0x2A); // sub al, VX
+                    JIT_RM(self, RAX, VX, 0x88);
+                    JIT_RM(self, 0, VF, 0x0F, 0x92);
+                    return;
+                case 6: case 0xE: // VF = access_bit(VX, 0); VX >>= 1 or VX <<= 1 (same bit of i8XY6 and i8XYE)
+                    JIT_RM(self, RAX, VX, 0x8A);
+                    JIT_RM(self, 5, AL, 0xC0); jit_u8(self, 7);       // shr al, 7
+                    JIT_RM(self, RAX, VF, 0x88);
+                    JIT_RM(self, instr.N == 6 ? 5 : 4, VX, 0xD0);     // shr VX, 1 or shl VX, 1
+                    return;
+            }
+            break;
+
+        case 0xA: // I = NNN
+            jit_u8(self, 0x66); jit_u8(self, 0x41); jit_u8(self, 0xC7); jit_u8(self, 0x87); // mov word [r15 + I], imm16
+            jit_u32(self, offsetof(chip8_t, I));
+            jit_u8(self, instr.NNN & 0xff); jit_u8(self, instr.NNN >> 8);
+            return;
+
+        case 0xF:
+            switch (instr.NN) {
+                case 0x07: // VX = delay_timer
+                    JIT_RM(self, RAX, jit_mem(offsetof(chip8_t, delay_timer)), 0x8A);
+                    JIT_RM(self, RAX, VX, 0x88);
+                    return;
+                case 0x15: // delay_timer = VX
+                    JIT_RM(self, RAX, VX, 0x8A);
+                    JIT_RM(self, RAX, jit_mem(offsetof(chip8_t, delay_timer)), 0x88);
+                    return;
+                case 0x18: // sound_timer = VX
+                    JIT_RM(self, RAX, VX, 0x8A);
+                    JIT_RM(self, RAX, jit_mem(offsetof(chip8_t, sound_timer)), 0x88);
+                    return;
+                case 0x1E: // I = (I + VX) & 0xfff
+                    JIT_RM(self, RAX, VX, 0x0F, 0xB6); // movzx eax, VX
+                    jit_u8(self, 0x66); jit_u8(self, 0x41); jit_u8(self, 0x03); jit_u8(self, 0x87); jit_u32(self, offsetof(chip8_t, I)); // add ax, [r15 + I]
+                    jit_u8(self, 0x66); jit_u8(self, 0x25); jit_u8(self, 0xff); jit_u8(self, 0x0f); // and ax, 0xfff
+                    jit_u8(self, 0x66); jit_u8(self, 0x41); jit_u8(self, 0x89); jit_u8(self, 0x87); jit_u32(self, offsetof(chip8_t, I)); // mov [r15 + I], ax
+                    return;
+                case 0x29: // I = (VX & 0xf) * 5
+                    JIT_RM(self, RAX, VX, 0x0F, 0xB6);
+                    jit_u8(self, 0x83); jit_u8(self, 0xE0); jit_u8(self, 0x0F); // and eax, 0xf
+                    jit_u8(self, 0x6B); jit_u8(self, 0xC0); jit_u8(self, sizeof(font_sprites[0])); // imul eax, eax, 5
+                    jit_u8(self, 0x66); jit_u8(self, 0x41); jit_u8(self, 0x89); jit_u8(self, 0x87); jit_u32(self, offsetof(chip8_t, I));
+                    return;
+                case 0x00: case 0x0A: case 0x33: case 0x55: // F000 NNNN is 4 bytes long
+                    goto dynamic_exit;
+            }
+            break;
+
+        case 0:
+            if (instr.data == 0x00EE || instr.data == 0x00FD)
+                goto dynamic_exit;
+            break;
+        case 0xB: case 0xE:
+            goto dynamic_exit;
+    }
+
+    // everything else: 00E0, the SUPER-CHIP screen ones (00CN, 00FB, 00FC, 00FE, 00FF), CXNN, DXYN, DXY0, FX30, FX65, FX75, FX85,
+    // the XO-CHIP ones (00DN, FN01, F002, FX3A)
+    jit_call_handler(self, ctx, chip_decode(instr).exec, instr);
+    return;
+
+    dynamic_exit:
+    jit_spill(self, ctx);
+    jit_call(self, (jit_fn_t)jit_helper_exec, instr, ctx->pc);
+    jit_jmp(self, self->exit); // eax: next PC
+}
+
+static void jit_flush(chip_jit_t *self) {
+    self->used      = self->code_beg;
+    self->dirty     = false;
+    self->links_len = 0;
+    memset(self->block, 0x00, sizeof(self->block));
+    memset(self->code_map, 0x00, sizeof(self->code_map));
+}
+
+static const uint8_t * jit_translate(chip_jit_t *self, uint16_t start) {
+
+    // 1. find the boundaries of the block
+    uint16_t len = 0;
+    uint8_t uses[REG_LEN] = {0};
+
+    for (uint16_t pc = start; pc <= sizeof(self->block) / sizeof(self->block[0]) - sizeof(instr_t) && len < JIT_MAX_BLOCK_LEN; pc += sizeof(instr_t)) {
+
+        const instr_t instr = chip_fetch(self->chip, pc);
+
+        bool is_last = false;
+        if (!jit_classify(instr, &is_last))
+            break;
+
+        ++len;
+        jit_uses(instr, uses);
+        if (is_last) break;
+    }
+
+    if (!len)
+        return NULL;
+
+    if (self->used + JIT_BLOCK_RESERVE > JIT_ARENA_SIZE)
+        jit_flush(self);
+
+    // 2. the most used V registers get a host register
+    jit_ctx_t ctx;
+    memset(ctx.host, -1, sizeof(ctx.host));
+
+    for (uint8_t r = 0; r < JIT_HOST_REGS; ++r) {
+        uint8_t best = 0;
+        for (uint8_t v = 1; v < REG_LEN; ++v)
+            if (uses[v] > uses[best]) best = v;
+        if (!uses[best]) break;
+        ctx.host[best] = jit_host_regs[r];
+        uses[best] = 0;
+    }
+
+    // 3. emit, the budget check comes first: the block runs only if it can run entirely
+    const uint8_t *const code = self->arena + self->used;
+    self->block[start] = code; // a block may jump to itself
+
+    jit_u8(self, 0x41); jit_u8(self, 0x81); jit_u8(self, 0xFE); jit_u32(self, len); // cmp r14d, len
+    jit_u8(self, 0x7D); jit_u8(self, 10);                                         // jge +10
+    jit_u8(self, 0xB8); jit_u32(self, start);                                     // mov eax, start
+    jit_jmp(self, self->exit);
+    jit_u8(self, 0x41); jit_u8(self, 0x81); jit_u8(self, 0xEE); jit_u32(self, len); // sub r14d, len
+
+    jit_reload(self, &ctx);
+
+    bool is_last = false;
+    ctx.pc = start;
+    for (uint16_t i = 0; i < len; ++i, ctx.pc += sizeof(instr_t)) {
+        const instr_t instr = chip_fetch(self->chip, ctx.pc);
+        jit_classify(instr, &is_last);
+        jit_translate_instr(self, &ctx, instr);
+    }
+
+    if (!is_last) { // stopped by an untranslatable instruction or by the maximum length
+        jit_spill(self, &ctx);
+        jit_exit_static(self, ctx.pc);
+    }
+
+    assert(self->used <= JIT_ARENA_SIZE);
+
+    // 4. bookkeeping: memory covered by the block, pending jumps into it
+    for (uint32_t addr = start; addr < (uint32_t)start + len * sizeof(instr_t); ++addr)
+        self->code_map[addr >> 3] |= 1 << (addr & 7);
+
+    for (uint16_t i = 0; i < self->links_len; ++i) {
+        if (self->links[i].target != start) continue;
+        jit_patch(self, self->links[i].site, code);
+        self->links[i--] = self->links[--self->links_len];
+    }
+
+    return code;
+}
+
+static void jit_on_write(void *ctx, uint16_t addr, uint32_t len) {
+    chip_jit_t *const self = ctx;
+    for (uint32_t a = addr; a < addr + len && a < sizeof(self->code_map) * 8 && !self->dirty; ++a)
+        self->dirty = (self->code_map[a >> 3] >> (a & 7)) & 1;
+}
+
+static void jit_emit_trampolines(chip_jit_t *self) {
+
+    // uint32_t enter(chip8_t *chip, int32_t *budget, const uint8_t *code)
+    self->enter = (jit_entry_t)(uintptr_t)(self->arena + self->used);
+    jit_u8(self, 0x53); jit_u8(self, 0x55);                        // push rbx, rbp
+    jit_u8(self, 0x41); jit_u8(self, 0x54); jit_u8(self, 0x41); jit_u8(self, 0x55); // push r12, r13
+    jit_u8(self, 0x41); jit_u8(self, 0x56); jit_u8(self, 0x41); jit_u8(self, 0x57); // push r14, r15
+    jit_u8(self, 0x56);                                            // push rsi (also aligns the stack to 16)
+    jit_u8(self, 0x49); jit_u8(self, 0x89); jit_u8(self, 0xFF);    // mov r15, rdi
+    jit_u8(self, 0x44); jit_u8(self, 0x8B); jit_u8(self, 0x36);    // mov r14d, [rsi]
+    jit_u8(self, 0xFF); jit_u8(self, 0xE2);                        // jmp rdx
+
+    // every block ends here with the next PC in eax
+    self->exit = self->arena + self->used;
+    jit_u8(self, 0x5E);                                            // pop rsi
+    jit_u8(self, 0x44); jit_u8(self, 0x89); jit_u8(self, 0x36);    // mov [rsi], r14d
+    jit_u8(self, 0x41); jit_u8(self, 0x5F); jit_u8(self, 0x41); jit_u8(self, 0x5E); // pop r15, r14
+    jit_u8(self, 0x41); jit_u8(self, 0x5D); jit_u8(self, 0x41); jit_u8(self, 0x5C); // pop r13, r12
+    jit_u8(self, 0x5D); jit_u8(self, 0x5B);                        // pop rbp, rbx
+    jit_u8(self, 0xC3);                                            // ret
+
+    self->code_beg = self->used;
+}
+
+// NULL when the host can't run translated code, keep using the interpreter
+chip_jit_t * chip_jit_new(chip8_t *chip) {
+
+    assert(!chip->on_write.fn); // a single listener
+
+    chip_jit_t *self;
+    if (!(self = calloc(1, sizeof(chip_jit_t))))
+        return NULL;
+
+    self->chip  = chip;
+
+    void *arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) {
+        dbg("cannot setup the jit: %s, fallback to the interpreter\n", "mmap failed");
+        free(self);
+        return NULL;
+    }
+
+    self->arena = arena;
+    jit_emit_trampolines(self);
+
+    chip->on_write.fn  = jit_on_write;
+    chip->on_write.ctx = self;
+    return self;
+}
+
+// the chip has been reinitialized in place (chip_init() forgets the listener), es. the next job of a batch worker
+void chip_jit_reset(chip_jit_t *self) {
+    assert(!self->chip->on_write.fn);
+    jit_flush(self);
+    self->chip->on_write.fn  = jit_on_write;
+    self->chip->on_write.ctx = self;
+}
+
+void chip_jit_free(chip_jit_t *self) {
+    if (!self) return;
+    self->chip->on_write.fn  = NULL;
+    self->chip->on_write.ctx = NULL;
+    munmap(self->arena, JIT_ARENA_SIZE);
+    free(self);
+}
+
+// execute up to max_cycles instructions (less if iFX0A starts waiting), return how many
+uint32_t chip_jit_run(chip_jit_t *self, uint32_t max_cycles) {
+
+    assert(max_cycles <= INT32_MAX);
+    assert(self->chip->quirks == CHIP_QUIRKS_DEFAULT);
+
+    chip8_t *const chip = self->chip;
+    int32_t budget = max_cycles;
+
+    while (budget > 0 && !chip->is_awaiting) {
+
+        if (UNLIKELY(self->dirty))
+            jit_flush(self);
+
+        const uint8_t *code = self->block[chip->PC];
+        if (UNLIKELY(!code))
+            code = jit_translate(self, chip->PC);
+
+        const int32_t before = budget;
+        if (LIKELY(!!code))
+            chip->PC = self->enter(chip, &budget, code);
+
+        // untranslatable instruction, or the budget left is too short for the whole block
+        if (budget == before) {
+            chip_step(chip);
+            --budget;
+        } else {
+            chip->cycles += before - budget;
+        }
+    }
+
+    return max_cycles - budget;
+}
+
+#else
+
+chip_jit_t * chip_jit_new(chip8_t *chip) {
+    (void)chip;
+    return NULL;
+}
+
+void chip_jit_reset(chip_jit_t *self) {
+    (void)self;
+}
+
+void chip_jit_free(chip_jit_t *self) {
+    (void)self;
+}
+
+uint32_t chip_jit_run(chip_jit_t *self, uint32_t max_cycles) {
+    (void)self, (void)max_cycles;
+    assert(0);
+    return 0;
+}
+
+#endif
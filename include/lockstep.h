@@ -0,0 +1,502 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdalign.h>
+#include <assert.h>
+
+#include <chip8.h>
+#include <bit_utility.h>
+#include <immintrin.h>
+
+/*
+ Many vm running the same rom in lockstep, one per vector lane (GCC vector extensions, -march=native picks AVX2/AVX-512).
+
+ V, I, PC, the timers and the keys of every lane are stored as structure of arrays, each step executes the opcode
+ of the lowest PC on every lane sitting on that PC at once, the other lanes are masked out and catch up later
+ (the lowest PC first is what makes lanes which took a different branch converge again).
+
+ Everything else (memory, screen, stack, rng) lives in a real chip8_t per lane: draw, rand, call/ret, BCD and the
+ load/store of the registers are peeled off and run lane by lane through the interpreter handlers.
+
+ Since every lane starts from the same rom the opcode at PC is the same for all of them, unless some lane wrote
+ in that part of the memory: then the opcode is fetched lane by lane and lanes with a different one are masked out.
+
+ Lanes are independent: each one runs its own budget of instructions per frame, exactly like headless_run().
+ The lanes have the DEFAULT quirks (quirks.h), the vector code is the one of those handlers.
+*/
+
+#ifndef LOCKSTEP_LANES
+    #define LOCKSTEP_LANES 32
+#endif
+
+_Static_assert(LOCKSTEP_LANES == 8 || LOCKSTEP_LANES == 16 || LOCKSTEP_LANES == 32, "LOCKSTEP_LANES must be 8, 16 or 32");
+
+typedef uint8_t  lane_u8  __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef int8_t   lane_i8  __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef uint16_t lane_u16 __attribute__((vector_size(LOCKSTEP_LANES * 2)));
+typedef int16_t  lane_i16 __attribute__((vector_size(LOCKSTEP_LANES * 2)));
+
+typedef uint32_t lane_bits_t; // bit l -> lane l
+
+// what the vector path does with an opcode, LS_PEEL -> through the interpreter lane by lane
+typedef enum {
+    LS_UNDECODED, LS_PEEL,
+    LS_1NNN, LS_3XNN, LS_4XNN, LS_5XY0, LS_9XY0, LS_6XNN, LS_7XNN,
+    LS_8XY0, LS_8XY1, LS_8XY2, LS_8XY3, LS_8XY4, LS_8XY5, LS_8XY6, LS_8XY7, LS_8XYE,
+    LS_ANNN, LS_BNNN, LS_EX9E, LS_EXA1, LS_FX07, LS_FX15, LS_FX18, LS_FX1E, LS_FX29,
+} lockstep_kind_t;
+
+typedef struct {
+    instr_t instr;
+    uint8_t kind;
+} lockstep_decoded_t;
+
+typedef struct {
+
+    alignas(64) lane_u8 V[REG_LEN];
+    lane_u16 I, PC;
+    lane_u8 delay_timer, sound_timer;
+    lane_u16 keys;     // bit k: key k is down, mirror of the keypad of the lane
+    lane_u16 budget;   // instructions left to the lane in this lockstep_run()
+    lane_u16 executed; // in this lockstep_run()
+
+    uint8_t lanes;         // in use, the others never run
+    uint64_t code_written; // bit n: some lane wrote into the bytes [64n, 64n+64)
+
+    lockstep_decoded_t cache[0xfff + 1]; // valid only where code_written is clear
+
+    chip8_t *lane; // LOCKSTEP_LANES chips, one allocation
+
+} lockstep_t;
+
+
+#define LS_SPLAT(_TYPE_, _VAL_) ((_TYPE_){0} + (_VAL_))
+#define LS_BLEND(_NEW_, _OLD_, _MASK_) (((_NEW_) & (_MASK_)) | ((_OLD_) & ~(_MASK_)))
+
+typedef uint16_t u16x8_t __attribute__((vector_size(16)));
+
+static FORCED(inline) lane_bits_t lane_bits(lane_i16 m) {
+
+    const lane_i8 m8 = __builtin_convertvector(m, lane_i8);
+
+#if defined(__AVX2__) && LOCKSTEP_LANES == 32
+    __m256i v; memcpy(&v, &m8, sizeof(v));
+    return (uint32_t)_mm256_movemask_epi8(v);
+#elif defined(__SSE2__)
+    uint8_t b[32] = {0};
+    memcpy(b, &m8, sizeof(m8));
+
+    __m128i lo, hi;
+    memcpy(&lo, b, sizeof(lo));
+    memcpy(&hi, b + 16, sizeof(hi));
+    return (uint16_t)_mm_movemask_epi8(lo) | (lane_bits_t)(uint16_t)_mm_movemask_epi8(hi) << 16;
+#else
+    lane_bits_t bits = 0;
+    for (uint8_t l = 0; l < LOCKSTEP_LANES; ++l)
+        bits |= (lane_bits_t)(m8[l] & 1) << l;
+    return bits;
+#endif
+}
+
+// halve the vector till 8 lanes, then phminposuw
+static FORCED(inline) uint16_t lane_min(lane_u16 v) {
+
+    u16x8_t part[LOCKSTEP_LANES / 8];
+    memcpy(part, &v, sizeof(v));
+
+    u16x8_t m = part[0];
+    for (uint8_t i = 1; i < LOCKSTEP_LANES / 8; ++i)
+        m ^= (m ^ part[i]) & (u16x8_t)(part[i] < m);
+
+#ifdef __SSE4_1__
+    __m128i x; memcpy(&x, &m, sizeof(x));
+    return _mm_extract_epi16(_mm_minpos_epu16(x), 0);
+#else
+    uint16_t r = m[0];
+    for (uint8_t l = 1; l < 8; ++l)
+        r = m[l] < r ? m[l] : r;
+    return r;
+#endif
+}
+
+static FORCED(inline) bool lane_any(lane_i16 m) {
+
+    u16x8_t part[LOCKSTEP_LANES / 8];
+    memcpy(part, &m, sizeof(m));
+
+    u16x8_t any = part[0];
+    for (uint8_t i = 1; i < LOCKSTEP_LANES / 8; ++i)
+        any |= part[i];
+
+#ifdef __SSE4_1__
+    __m128i x; memcpy(&x, &any, sizeof(x));
+    return !_mm_testz_si128(x, x);
+#else
+    uint64_t w[2]; memcpy(w, &any, sizeof(w));
+    return w[0] | w[1];
+#endif
+}
+
+// the lane chip is the one to be trusted only between these two
+static void lockstep_sync_in(lockstep_t *self, uint8_t l) {
+    chip8_t *chip = self->lane + l;
+    for (uint8_t r = 0; r < REG_LEN; ++r)
+        chip->V[r] = self->V[r][l];
+    chip->I  = self->I[l];
+    chip->PC = self->PC[l];
+    chip->delay_timer = self->delay_timer[l];
+    chip->sound_timer = self->sound_timer[l];
+}
+
+static void lockstep_sync_out(lockstep_t *self, uint8_t l) {
+    const chip8_t *chip = self->lane + l;
+    for (uint8_t r = 0; r < REG_LEN; ++r)
+        self->V[r][l] = chip->V[r];
+    self->I[l]  = chip->I;
+    self->PC[l] = chip->PC;
+    self->delay_timer[l] = chip->delay_timer;
+    self->sound_timer[l] = chip->sound_timer;
+}
+
+static void lockstep_on_write(void *ctx, uint16_t addr, uint32_t len) {
+    lockstep_t *self = ctx;
+    for (uint32_t line = addr / 64; line <= (uint32_t)(addr + len - 1) / 64 && line < 64; ++line)
+        self->code_written |= (uint64_t)1 << line;
+}
+
+static uint8_t lockstep_classify(instr_t instr) {
+
+    const chip_handler_t h = chip_decode(instr).exec;
+
+    if (h == i1NNN) return LS_1NNN;
+    if (h == i3XNN) return LS_3XNN;
+    if (h == i4XNN) return LS_4XNN;
+    if (h == i5XY0 || h == i5XY2 || h == i5XY3) return LS_5XY0; // the last two are a 5XY0 with the DEFAULT quirks
+    if (h == i9XY0) return LS_9XY0;
+    if (h == i6XNN) return LS_6XNN;
+    if (h == i7XNN) return LS_7XNN;
+    if (h == i8XY0) return LS_8XY0;
+    if (h == i8XY1) return LS_8XY1;
+    if (h == i8XY2) return LS_8XY2;
+    if (h == i8XY3) return LS_8XY3;
+    if (h == i8XY4) return LS_8XY4;
+    if (h == i8XY5) return LS_8XY5;
+    if (h == i8XY6) return LS_8XY6;
+    if (h == i8XY7) return LS_8XY7;
+    if (h == i8XYE) return LS_8XYE;
+    if (h == iANNN) return LS_ANNN;
+    if (h == iBNNN) return LS_BNNN;
+    if (h == iEX9E) return LS_EX9E;
+    if (h == iEXA1) return LS_EXA1;
+    if (h == iFX07) return LS_FX07;
+    if (h == iFX15) return LS_FX15;
+    if (h == iFX18) return LS_FX18;
+    if (h == iFX1E) return LS_FX1E;
+    if (h == iFX29) return LS_FX29;
+
+    return LS_PEEL; // 00E0, 00EE, 0NNN, 2NNN, CXNN, DXYN, FX0A, FX33, FX55, FX65, the SUPER-CHIP and XO-CHIP ones, unknown opcodes
+}
+
+// see lockstep_load_rom_mem(), return NULL on failure
+lockstep_t * lockstep_new(void) {
+
+    lockstep_t *self;
+    if (!(self = aligned_alloc(64, (sizeof(lockstep_t) + 63) / 64 * 64)))
+        return NULL;
+
+    if (!(self->lane = aligned_alloc(64, (sizeof(chip8_t) * LOCKSTEP_LANES + 63) / 64 * 64))) {
+        free(self);
+        return NULL;
+    }
+
+    for (uint8_t l = 0; l < LOCKSTEP_LANES; ++l)
+        self->lane[l].xo = NULL; // see chip_init(), the lanes have only the default profile
+
+    return self;
+}
+
+void lockstep_free(lockstep_t *self) {
+    if (!self) return;
+    free(self->lane);
+    free(self);
+}
+
+// (re)start every lane from the rom, lanes after the first lanes_len stay idle
+bool lockstep_load_rom_mem(lockstep_t *self, const uint8_t *rom, size_t rom_size, uint8_t lanes_len) {
+
+    assert(lanes_len && lanes_len <= LOCKSTEP_LANES);
+
+    chip8_t *const lane = self->lane;
+    memset(self, 0x00, sizeof(lockstep_t));
+    self->lane  = lane;
+    self->lanes = lanes_len;
+
+    for (uint8_t l = 0; l < lanes_len; ++l) {
+        chip_init(self->lane + l);
+        if (!chip_load_rom_mem(self->lane + l, rom, rom_size))
+            return false;
+
+        // only the writes made by the rom itself matter
+        self->lane[l].on_write.fn  = lockstep_on_write;
+        self->lane[l].on_write.ctx = self;
+        lockstep_sync_out(self, l);
+    }
+
+    return true;
+}
+
+void lockstep_seed(lockstep_t *self, uint8_t l, uint64_t seed) {
+    assert(l < self->lanes);
+    chip_seed(self->lane + l, seed);
+}
+
+void lockstep_press_key(lockstep_t *self, uint8_t l, keycodes_t key_code, keystate_t status) {
+
+    assert(l < self->lanes);
+
+    // may resume an iFX0A storing the key in a register
+    lockstep_sync_in(self, l);
+    chip_press_key(self->lane + l, key_code, status);
+    lockstep_sync_out(self, l);
+
+    uint16_t keys = 0;
+    for (uint8_t k = 0; k < HKEY_LEN; ++k)
+        keys |= (uint16_t)(self->lane[l].keypad[k] == KEY_DOWN) << k;
+    self->keys[l] = keys;
+}
+
+void lockstep_tick(lockstep_t *self) {
+    // true is -1 in a vector compare: x + -1 if non zero
+    self->delay_timer += (lane_u8)(self->delay_timer != 0);
+    self->sound_timer += (lane_u8)(self->sound_timer != 0);
+}
+
+// the whole state of lane l in a plain chip8_t, es. to hash the screen. Valid until the next lockstep_run()
+const chip8_t * lockstep_lane(lockstep_t *self, uint8_t l) {
+    assert(l < self->lanes);
+    lockstep_sync_in(self, l);
+    return self->lane + l;
+}
+
+// one instruction of the lanes in group through the interpreter
+static void lockstep_peel(lockstep_t *self, lane_bits_t group) {
+
+    for (; group; group &= group - 1) {
+
+        const uint8_t l = __builtin_ctz(group);
+        chip8_t *chip = self->lane + l;
+        lockstep_sync_in(self, l);
+
+        // chip_step() without counting, chip->cycles is updated at the end of lockstep_run()
+        decoded_t *const slot = chip->icache + chip->PC;
+        if (UNLIKELY(!slot->exec))
+            *slot = chip_decode(chip_fetch(chip, chip->PC));
+
+        const uint8_t step = slot->step;
+        slot->exec(chip, slot->instr);
+        chip->PC = (chip->PC + step) & 0xfff;
+
+        lockstep_sync_out(self, l);
+
+        // iFX0A: the lane is done for this run
+        if (UNLIKELY(chip->is_awaiting))
+            self->budget[l] = 0;
+    }
+}
+
+/*
+ Execute up to max_cycles instructions on each lane (less if iFX0A starts waiting) like headless_run() does
+ for a single chip in a frame. Lanes waiting a key do nothing.
+*/
+void lockstep_run(lockstep_t *self, uint16_t max_cycles) {
+
+    self->budget = LS_SPLAT(lane_u16, 0);
+    for (uint8_t l = 0; l < self->lanes; ++l)
+        self->budget[l] = self->lane[l].is_awaiting ? 0 : max_cycles;
+
+    self->executed = LS_SPLAT(lane_u16, 0);
+
+    uint16_t pc  = 0;
+    uint16_t run = 0; // steps the group can still go without looking at the other lanes
+    lane_i16 m16 = {0};
+
+    for (;;) {
+
+        if (!run) {
+            const lane_i16 eligible = self->budget != 0;
+            if (UNLIKELY(!lane_any(eligible)))
+                break;
+
+            // lowest PC first, non eligible lanes count as 0xffff
+            pc  = lane_min(self->PC | (lane_u16)~eligible);
+            m16 = eligible & (self->PC == pc);
+
+            // converged: every eligible lane is here, the group goes on alone till one of them runs out of budget or takes another path
+            run = lane_any(eligible & ~m16) ? 1 : lane_min(self->budget | (lane_u16)~m16);
+        }
+
+        --run;
+
+        lockstep_decoded_t op;
+        const uint64_t lines = (uint64_t)1 << (pc / 64) | (uint64_t)1 << ((pc + 1) / 64 % 64);
+
+        if (LIKELY(!(self->code_written & lines))) {
+            op = self->cache[pc];
+            if (UNLIKELY(op.kind == LS_UNDECODED)) {
+                op.instr = chip_fetch(self->lane, pc);
+                op.kind  = lockstep_classify(op.instr);
+                self->cache[pc] = op;
+            }
+        } else {
+            // the opcode at pc may differ: follow the first lane and mask out the others
+            lane_bits_t group = lane_bits(m16);
+            const uint8_t first = __builtin_ctz(group);
+
+            op.instr = chip_fetch(self->lane + first, pc);
+            op.kind  = lockstep_classify(op.instr);
+
+            for (group &= group - 1; group; group &= group - 1) {
+                const uint8_t l = __builtin_ctz(group);
+                if (chip_fetch(self->lane + l, pc).data != op.instr.data)
+                    m16[l] = 0, run = 0;
+            }
+        }
+
+        const instr_t instr = op.instr;
+        const lane_u16 mask16 = (lane_u16)m16;
+        const lane_u8  mask8  = (lane_u8)__builtin_convertvector(m16, lane_i8);
+
+        self->budget   += (lane_u16)m16; // -1
+        self->executed -= (lane_u16)m16;
+
+        lane_u8 *const VX = self->V + instr.X;
+        const lane_u8 vx  = self->V[instr.X];
+        const lane_u8 vy  = self->V[instr.Y];
+
+        lane_u16 next = self->PC + 2;
+        int32_t same  = pc + 2; // next PC of the whole group, -1 if it depends on the lane
+
+        switch (op.kind) {
+
+            case LS_PEEL:
+                lockstep_peel(self, lane_bits(m16));
+                run = 0;
+                continue;
+
+            case LS_1NNN:
+                next = LS_SPLAT(lane_u16, instr.NNN);
+                same = instr.NNN;
+                break;
+
+            case LS_BNNN:
+                next = __builtin_convertvector(self->V[REG_V0], lane_u16) + instr.NNN;
+                same = -1;
+                break;
+
+            // skips: PC += 2 + 2 * cond (true is -1)
+            case LS_3XNN:
+                next += (lane_u16)__builtin_convertvector(vx == instr.NN, lane_i16) & 2;
+                same  = -2;
+                break;
+            case LS_4XNN:
+                next += (lane_u16)__builtin_convertvector(vx != instr.NN, lane_i16) & 2;
+                same  = -2;
+                break;
+            case LS_5XY0:
+                next += (lane_u16)__builtin_convertvector(vx == vy, lane_i16) & 2;
+                same  = -2;
+                break;
+            case LS_9XY0:
+                next += (lane_u16)__builtin_convertvector(vx != vy, lane_i16) & 2;
+                same  = -2;
+                break;
+
+            case LS_EX9E:
+            case LS_EXA1: {
+                const lane_u16 down = (self->keys >> __builtin_convertvector(vx & 0xf, lane_u16)) & 1;
+                next += (op.kind == LS_EX9E ? down : down ^ 1) << 1;
+                same  = -2;
+                break;
+            }
+
+            case LS_6XNN: *VX = LS_BLEND(LS_SPLAT(lane_u8, instr.NN), vx, mask8); break;
+            case LS_7XNN: *VX = LS_BLEND(vx + instr.NN, vx, mask8); break;
+            case LS_8XY0: *VX = LS_BLEND(vy, vx, mask8); break;
+
+            // same order of the interpreter handlers, X may be F
+            case LS_8XY1:
+                *VX = LS_BLEND(vx | vy, vx, mask8);
+                self->V[REG_VF] &= ~mask8;
+                break;
+            case LS_8XY2:
+                *VX = LS_BLEND(vx & vy, vx, mask8);
+                self->V[REG_VF] &= ~mask8;
+                break;
+            case LS_8XY3:
+                *VX = LS_BLEND(vx ^ vy, vx, mask8);
+                self->V[REG_VF] &= ~mask8;
+                break;
+            case LS_8XY4: {
+                const lane_u8 sum = vx + vy;
+                *VX = LS_BLEND(sum, vx, mask8);
+                self->V[REG_VF] = LS_BLEND((lane_u8)(sum < vx) & 1, self->V[REG_VF], mask8);
+                break;
+            }
+            case LS_8XY5:
+                *VX = LS_BLEND(vx - vy, vx, mask8);
+                self->V[REG_VF] = LS_BLEND((lane_u8)(vx < vy) & 1, self->V[REG_VF], mask8);
+                break;
+            case LS_8XY7:
+                *VX = LS_BLEND(vy - vx, vx, mask8);
+                self->V[REG_VF] = LS_BLEND((lane_u8)(vy < vx) & 1, self->V[REG_VF], mask8);
+                break;
+
+            // i8XY6 and i8XYE both take the msb (see access_bit()), then shift what's in VX after the flag
+            case LS_8XY6:
+                self->V[REG_VF] = LS_BLEND(vx >> 7, self->V[REG_VF], mask8);
+                *VX = LS_BLEND(*VX >> 1, *VX, mask8);
+                break;
+            case LS_8XYE:
+                self->V[REG_VF] = LS_BLEND(vx >> 7, self->V[REG_VF], mask8);
+                *VX = LS_BLEND(*VX << 1, *VX, mask8);
+                break;
+
+            case LS_ANNN:
+                self->I = LS_BLEND(LS_SPLAT(lane_u16, instr.NNN), self->I, mask16);
+                break;
+            case LS_FX1E:
+                self->I = LS_BLEND((self->I + __builtin_convertvector(vx, lane_u16)) & 0xfff, self->I, mask16);
+                break;
+            case LS_FX29:
+                self->I = LS_BLEND(__builtin_convertvector(vx & 0xf, lane_u16) * sizeof(font_sprites[0]), self->I, mask16);
+                break;
+
+            case LS_FX07: *VX = LS_BLEND(self->delay_timer, vx, mask8); break;
+            case LS_FX15: self->delay_timer = LS_BLEND(vx, self->delay_timer, mask8); break;
+            case LS_FX18: self->sound_timer = LS_BLEND(vx, self->sound_timer, mask8); break;
+
+            default:
+                assert(0);
+        }
+
+        self->PC = LS_BLEND(next & 0xfff, self->PC, mask16);
+
+        // a skip: still converged if every lane took it (or none did)
+        if (same == -2 && run) {
+            if (!lane_any(m16 & (self->PC != ((pc + 2) & 0xfff))))      same = pc + 2;
+            else if (!lane_any(m16 & (self->PC != ((pc + 4) & 0xfff)))) same = pc + 4;
+        }
+
+        if (same < 0) run = 0;
+        else pc = same & 0xfff;
+    }
+
+    for (uint8_t l = 0; l < self->lanes; ++l)
+        self->lane[l].cycles += self->executed[l];
+}
+
+#undef LS_SPLAT
+#undef LS_BLEND
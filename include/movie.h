@@ -0,0 +1,195 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <endian.h>
+
+#include <chip8.h>
+#include <quirks.h>
+#include <savestate.h>
+#include <hash.h>
+
+/*
+ Input movies: the key events of a session and the frame they happened in, enough to play it again bit for bit.
+
+ Both frontends press the keys only at the beginning of a frame and a frame is always ipf instructions (the ones
+ spent waiting a key included), so the frame number is an exact instruction count: with the same rom, quirks,
+ ipf and seed of CXNN the replay goes through the very same states, with or without the jit and the idle fast forward.
+
+ A movie is a movie_file_t followed by one uint32_t per event, frame << 5 | state << 4 | key, little endian and
+ sorted by frame. start and end are the xxh64 of the whole machine (a chip_state_t as saved on disk) at the
+ first frame and after the last one: the first one tells a movie of another rom (or save state) apart, the second
+ one whether the replay went the same way (es. the emulator changed in between).
+*/
+
+#define MOVIE_MAGIC   "CH8M"
+#define MOVIE_VERSION 1
+#define MOVIE_FRAMES_MAX (UINT32_MAX >> 5) // ~2 years at 60 Hz
+
+typedef struct {
+    char magic[4];    // MOVIE_MAGIC
+    uint32_t version; // MOVIE_VERSION
+    uint64_t seed;    // of chip_seed()
+    uint64_t start;   // movie_state_hash() at the first frame
+    uint64_t end;     // movie_state_hash() after the last frame
+    uint32_t frames;  // how many frames the recording lasted
+    uint32_t ipf;
+    uint8_t quirks;   // chip_quirks_t
+    uint8_t pad[7];
+} movie_file_t;
+
+_Static_assert(sizeof(movie_file_t) == 48, "padding in movie_file_t");
+
+typedef enum {
+    MOVIE_RECORDING,
+    MOVIE_PLAYING,
+    MOVIE_SYNC,   // the replay is over and it ended in the same state of the recording
+    MOVIE_DESYNC, // it's over in another state
+} movie_status_t;
+
+typedef struct {
+    FILE *file;
+    movie_file_t header; // host byte order
+    movie_status_t status;
+    uint32_t frame;      // the current one, from the start of the movie
+    uint32_t next;       // replay: the next event, valid if has_next
+    bool has_next;
+    bool failed;         // recording: a write error
+} movie_t;
+
+
+// xxh64 of the state of the chip as saved on disk (little endian), the same on every machine
+uint64_t movie_state_hash(const chip8_t *chip) {
+    chip_state_t state;
+    chip_snapshot(chip, &state);
+    chip_state_swap_le(&state);
+    return xxh64(&state, sizeof(state), 0);
+}
+
+static void movie_header_swap_le(movie_file_t *header) {
+    header->version = htole32(header->version);
+    header->seed    = htole64(header->seed);
+    header->start   = htole64(header->start);
+    header->end     = htole64(header->end);
+    header->frames  = htole32(header->frames);
+    header->ipf     = htole32(header->ipf);
+}
+
+static void movie_read_next(movie_t *self) {
+    uint32_t ev;
+    self->has_next = fread(&ev, sizeof(ev), 1, self->file) == 1;
+    self->next = le32toh(ev);
+}
+
+// a new movie in path (truncated), it begins with movie_start()
+movie_t * movie_record(const char *path) {
+
+    movie_t *self;
+    if (!(self = calloc(1, sizeof(movie_t))))
+        return NULL;
+
+    if (!(self->file = fopen(path, "wb"))) {
+        free(self);
+        return NULL;
+    }
+
+    self->status = MOVIE_RECORDING;
+    return self;
+}
+
+// NULL if path isn't a movie of this version. The chip must get header.quirks, header.ipf and header.seed before movie_start()
+movie_t * movie_replay(const char *path) {
+
+    movie_t *self;
+    if (!(self = calloc(1, sizeof(movie_t))))
+        return NULL;
+
+    if (!(self->file = fopen(path, "rb")))
+        goto fail;
+
+    if (fread(&self->header, sizeof(self->header), 1, self->file) != 1 || memcmp(self->header.magic, MOVIE_MAGIC, sizeof(self->header.magic)))
+        goto fail;
+
+    movie_header_swap_le(&self->header);
+    if (self->header.version != MOVIE_VERSION || self->header.quirks >= CHIP_QUIRKS_LEN || !self->header.ipf)
+        goto fail;
+
+    self->status = MOVIE_PLAYING;
+    movie_read_next(self);
+    return self;
+
+fail:
+    if (self->file) fclose(self->file);
+    free(self);
+    return NULL;
+}
+
+/*
+ the chip is at the first frame (rom loaded, seeded, es. a save state loaded).
+ Recording: the header is written. Replay: false if it's not where the recording started, or with another ipf
+*/
+bool movie_start(movie_t *self, const chip8_t *chip, uint32_t ipf, uint64_t seed) {
+
+    if (self->status != MOVIE_RECORDING) {
+        if (!self->header.frames) // nothing to play
+            self->status = self->header.end == movie_state_hash(chip) ? MOVIE_SYNC : MOVIE_DESYNC;
+        return self->header.start == movie_state_hash(chip) && self->header.ipf == ipf && self->header.quirks == chip->quirks;
+    }
+
+    self->header = (movie_file_t){ .magic = MOVIE_MAGIC, .version = MOVIE_VERSION, .seed = seed, .start = movie_state_hash(chip), .ipf = ipf, .quirks = chip->quirks };
+
+    movie_file_t header = self->header;
+    movie_header_swap_le(&header);
+    self->failed = fwrite(&header, sizeof(header), 1, self->file) != 1;
+    return !self->failed;
+}
+
+// a key pressed at the beginning of the current frame: recorded, then pressed. While playing only pressed
+void movie_press(movie_t *self, chip8_t *chip, keycodes_t key, keystate_t state) {
+
+    if (self->status == MOVIE_RECORDING && self->frame < MOVIE_FRAMES_MAX) {
+        const uint32_t ev = htole32(self->frame << 5 | (state == KEY_DOWN) << 4 | (key & 0xf));
+        self->failed |= fwrite(&ev, sizeof(ev), 1, self->file) != 1;
+    }
+
+    chip_press_key(chip, key, state);
+}
+
+// at the beginning of every frame, before its instructions: the replay presses the keys of this frame
+void movie_frame(movie_t *self, chip8_t *chip) {
+
+    for (; self->status == MOVIE_PLAYING && self->has_next && self->next >> 5 == self->frame; movie_read_next(self))
+        chip_press_key(chip, self->next & 0xf, self->next >> 4 & 1 ? KEY_DOWN : KEY_UP);
+}
+
+// at the end of every frame, after chip_tick(): the replay is over after the last frame of the recording
+void movie_tick(movie_t *self, const chip8_t *chip) {
+
+    self->frame++;
+
+    if (self->status == MOVIE_PLAYING && self->frame == self->header.frames)
+        self->status = self->header.end == movie_state_hash(chip) ? MOVIE_SYNC : MOVIE_DESYNC;
+}
+
+// recording: the header gets the frames and the state of the end, false on a write error. Replay: true
+bool movie_close(movie_t *self, const chip8_t *chip) {
+
+    if (!self) return true;
+    bool ok = true;
+
+    if (self->status == MOVIE_RECORDING) {
+
+        self->header.frames = self->frame < MOVIE_FRAMES_MAX ? self->frame : MOVIE_FRAMES_MAX;
+        self->header.end    = movie_state_hash(chip);
+
+        movie_file_t header = self->header;
+        movie_header_swap_le(&header);
+        ok = !self->failed && !fseek(self->file, 0, SEEK_SET) && fwrite(&header, sizeof(header), 1, self->file) == 1;
+    }
+
+    ok = !fclose(self->file) && ok;
+    free(self);
+    return ok;
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <stdint.h>
+#include <stdalign.h>
+
+#include <instruction.h>
+
+/*
+ The opcodes of chip8.h, one index (OP_xxx) per handler.
+
+ op_classify() is the decoding by the book (the special cases 00E0 / 00EE, then a switch on the type and on the
+ last nibble or byte): it runs only in src/gen_opcodes.c, at build time, for all the 65536 values of an instruction.
+ What comes out is chip_opcode_table (opcode_table.h in the build directory): opcode -> OP_xxx, so chip_exec() and
+ chip_decode() are a load from there and a load from the chip_ops[] of the quirk profile (chip8.h), no branches.
+*/
+
+/*
+ name, handler, how much the PC moves after the handler: sizeof(instr_t) or 0 for jumps (the handler did it),
+ 1 if the handler depends on the quirk profile: then there's one instance of it per profile, es. i8XY1, i8XY1_chip8 (quirks.h)
+ Then the SUPER-CHIP opcodes (screen.h) and the XO-CHIP ones, every profile has them: those which clash with CHIP-8
+ (5XY2, 5XY3) or need the 64 KB of XO-CHIP are quirked on QUIRK_XO. F000 NNNN is the only 4 bytes long instruction.
+*/
+#define CHIP_OPCODES(_) \
+    _(0NNN, i0NNN, 0, 0) _(00E0, i00E0, 2, 0) _(00EE, i00EE, 2, 0) _(1NNN, i1NNN, 0, 0) _(2NNN, i2NNN, 0, 0) \
+    _(3XNN, i3XNN, 2, 1) _(4XNN, i4XNN, 2, 1) _(5XY0, i5XY0, 2, 1) _(6XNN, i6XNN, 2, 0) _(7XNN, i7XNN, 2, 0) \
+    _(8XY0, i8XY0, 2, 0) _(8XY1, i8XY1, 2, 1) _(8XY2, i8XY2, 2, 1) _(8XY3, i8XY3, 2, 1) _(8XY4, i8XY4, 2, 0) \
+    _(8XY5, i8XY5, 2, 0) _(8XY6, i8XY6, 2, 1) _(8XY7, i8XY7, 2, 0) _(8XYE, i8XYE, 2, 1) _(9XY0, i9XY0, 2, 1) \
+    _(ANNN, iANNN, 2, 0) _(BNNN, iBNNN, 0, 1) _(CXNN, iCXNN, 2, 0) _(DXYN, iDXYN, 2, 1) _(EX9E, iEX9E, 2, 1) \
+    _(EXA1, iEXA1, 2, 1) _(FX07, iFX07, 2, 0) _(FX0A, iFX0A, 2, 0) _(FX15, iFX15, 2, 0) _(FX18, iFX18, 2, 0) \
+    _(FX1E, iFX1E, 2, 1) _(FX29, iFX29, 2, 0) _(FX33, iFX33, 2, 0) _(FX55, iFX55, 2, 1) _(FX65, iFX65, 2, 1) \
+    _(00CN, i00CN, 2, 0) _(00FB, i00FB, 2, 0) _(00FC, i00FC, 2, 0) _(00FD, i00FD, 0, 0) _(00FE, i00FE, 2, 0) \
+    _(00FF, i00FF, 2, 0) _(DXY0, iDXY0, 2, 1) _(FX30, iFX30, 2, 0) _(FX75, iFX75, 2, 0) _(FX85, iFX85, 2, 0) \
+    _(00DN, i00DN, 2, 0) _(5XY2, i5XY2, 2, 1) _(5XY3, i5XY3, 2, 1) _(F000, iF000, 4, 1) _(FN01, iFN01, 2, 1) \
+    _(F002, iF002, 2, 0) _(FX3A, iFX3A, 2, 0) \
+    _(UNKNOWN, not_an_opcode, 0, 0)
+
+// the handler of an opcode in the profile with this suffix, es. OP_HANDLER(i8XY1, 1, _chip8) -> i8XY1_chip8, OP_HANDLER(i6XNN, 0, _chip8) -> i6XNN
+#define OP_HANDLER(_HANDLER_, _QUIRKS_, _SUFFIX_)  OP_HANDLER_(_HANDLER_, _QUIRKS_, _SUFFIX_)
+#define OP_HANDLER_(_HANDLER_, _QUIRKS_, _SUFFIX_) OP_HANDLER_##_QUIRKS_(_HANDLER_, _SUFFIX_)
+#define OP_HANDLER_0(_HANDLER_, _SUFFIX_) _HANDLER_
+#define OP_HANDLER_1(_HANDLER_, _SUFFIX_) _HANDLER_##_SUFFIX_
+
+#define OP_ENUM(_NAME_, _HANDLER_, _STEP_, _QUIRKS_) OP_##_NAME_,
+enum { CHIP_OPCODES(OP_ENUM) OP_LEN };
+#undef OP_ENUM
+
+#define OP_NAME(_NAME_, _HANDLER_, _STEP_, _QUIRKS_) #_NAME_,
+static const char *const op_names[OP_LEN] = { CHIP_OPCODES(OP_NAME) };
+#undef OP_NAME
+
+_Static_assert(OP_LEN <= UINT8_MAX, "an OP_xxx must fit in the uint8_t of chip_opcode_table");
+
+
+static uint8_t op_classify(instr_t instr) {
+
+    if (instr.data == 0x00E0) return OP_00E0;
+    if (instr.data == 0x00EE) return OP_00EE;
+
+    // SUPER-CHIP
+    if (instr.data == 0x00FB) return OP_00FB;
+    if (instr.data == 0x00FC) return OP_00FC;
+    if (instr.data == 0x00FD) return OP_00FD;
+    if (instr.data == 0x00FE) return OP_00FE;
+    if (instr.data == 0x00FF) return OP_00FF;
+    if ((instr.data & 0xfff0) == 0x00C0) return OP_00CN;
+
+    // XO-CHIP
+    if ((instr.data & 0xfff0) == 0x00D0) return OP_00DN;
+    if (instr.data == 0xF000) return OP_F000;
+    if (instr.data == 0xF002) return OP_F002;
+
+    switch (instr.type) {
+        case 0x0: return OP_0NNN;
+        case 0x1: return OP_1NNN;
+        case 0x2: return OP_2NNN;
+        case 0x3: return OP_3XNN;
+        case 0x4: return OP_4XNN;
+        case 0x5: return instr.N == 2 ? OP_5XY2 : instr.N == 3 ? OP_5XY3 : OP_5XY0;
+        case 0x6: return OP_6XNN;
+        case 0x7: return OP_7XNN;
+        case 0x8:
+            switch (instr.N) {
+                case 0x0: return OP_8XY0;
+                case 0x1: return OP_8XY1;
+                case 0x2: return OP_8XY2;
+                case 0x3: return OP_8XY3;
+                case 0x4: return OP_8XY4;
+                case 0x5: return OP_8XY5;
+                case 0x6: return OP_8XY6;
+                case 0x7: return OP_8XY7;
+                case 0xE: return OP_8XYE;
+                default:  return OP_UNKNOWN;
+            }
+        case 0x9: return OP_9XY0;
+        case 0xA: return OP_ANNN;
+        case 0xB: return OP_BNNN;
+        case 0xC: return OP_CXNN;
+        case 0xD: return instr.N ? OP_DXYN : OP_DXY0;
+        case 0xE:
+            switch (instr.NN) {
+                case 0x9E: return OP_EX9E;
+                case 0xA1: return OP_EXA1;
+                default:   return OP_UNKNOWN;
+            }
+        case 0xF:
+            switch (instr.NN) {
+                case 0x01: return OP_FN01;
+                case 0x07: return OP_FX07;
+                case 0x0A: return OP_FX0A;
+                case 0x15: return OP_FX15;
+                case 0x18: return OP_FX18;
+                case 0x1E: return OP_FX1E;
+                case 0x29: return OP_FX29;
+                case 0x30: return OP_FX30;
+                case 0x33: return OP_FX33;
+                case 0x3A: return OP_FX3A;
+                case 0x55: return OP_FX55;
+                case 0x65: return OP_FX65;
+                case 0x75: return OP_FX75;
+                case 0x85: return OP_FX85;
+                default:   return OP_UNKNOWN;
+            }
+    }
+
+    return OP_UNKNOWN;
+}
+
+// the generator itself defines CHIP_OPCODES_GENERATOR, it's there to write this
+#ifndef CHIP_OPCODES_GENERATOR
+#include <opcode_table.h> // alignas(64) static const uint8_t chip_opcode_table[0xffff + 1]
+#endif
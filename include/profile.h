@@ -0,0 +1,247 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include <instruction.h>
+#include <screen.h>
+#include <opcodes.h>
+#include <bit_utility.h>
+
+/*
+ Execution profiler of the interpreter, only with -DCHIP_PROFILE (cmake -DCHIP8_PROFILE=ON): otherwise
+ chip8.h doesn't even include this file and chip_exec() / chip_step() are the same as always.
+
+ With a chip_profile_t attached (chip->profile) every instruction executed by chip_exec() / chip_step() is counted
+ per address and per opcode, the 2NNN / 00EE pairs are followed in a call tree where every instruction is charged
+ to the subroutine running it, and iDXYN counts its sprites.
+ The jit and lockstep don't pass from there, profile through the interpreter.
+
+ Two dumps: the folded stacks (one "main;sub_2a0;sub_31c count" line per call path, the input of flamegraph.pl,
+ inferno, speedscope...) and a json summary.
+*/
+
+#define PROF_MAX_NODES 4096 // distinct call paths, the calls after that are charged to the caller
+#define PROF_HOT_PCS   32   // addresses in the json
+
+// a node of the call tree, nodes[0] is the code outside any subroutine
+typedef struct {
+    uint32_t parent, child, sibling; // 0 -> none (the root is never a child)
+    uint16_t addr;
+    uint64_t calls;
+    uint64_t self; // instructions executed in this subroutine on this call path, not in the ones it called
+} prof_node_t;
+
+typedef struct {
+
+    uint64_t pc[0xffff + 1]; // the 64 KB of XO-CHIP
+    uint64_t op[OP_LEN];
+    uint64_t instructions;
+
+    prof_node_t *nodes;
+    uint32_t nodes_len, cur;
+    uint64_t untracked_calls; // PROF_MAX_NODES exceeded
+    uint32_t untracked_depth; // returns to skip before popping cur again
+
+    struct {
+        uint64_t sprites;
+        uint64_t rows;
+        uint64_t collisions;
+        uint64_t wrapped; // crossing the right or the bottom edge of the screen (lo-res or hi-res)
+        uint64_t height[16]; // the 8 pixels wide sprites by rows (iDXYN)
+        uint64_t big;        // the 16x16 ones (iDXY0)
+    } draw;
+
+} chip_profile_t;
+
+
+chip_profile_t * chip_profile_new(void) {
+
+    chip_profile_t *self;
+    if (!(self = calloc(1, sizeof(chip_profile_t))))
+        return NULL;
+
+    if (!(self->nodes = calloc(PROF_MAX_NODES, sizeof(prof_node_t)))) {
+        free(self);
+        return NULL;
+    }
+
+    self->nodes_len = 1; // the root
+    return self;
+}
+
+void chip_profile_free(chip_profile_t *self) {
+    if (!self) return;
+    free(self->nodes);
+    free(self);
+}
+
+// the child of cur for a call to addr, created the first time
+static uint32_t prof_enter(chip_profile_t *self, uint16_t addr) {
+
+    prof_node_t *const nodes = self->nodes;
+
+    uint32_t n = nodes[self->cur].child;
+    for (; n && nodes[n].addr != addr; n = nodes[n].sibling);
+
+    if (UNLIKELY(!n)) {
+        if (self->nodes_len == PROF_MAX_NODES) {
+            self->untracked_calls++;
+            self->untracked_depth++;
+            return self->cur;
+        }
+
+        n = self->nodes_len++;
+        nodes[n] = (prof_node_t){ .parent = self->cur, .sibling = nodes[self->cur].child, .addr = addr };
+        nodes[self->cur].child = n;
+    }
+
+    nodes[n].calls++;
+    return n;
+}
+
+// before the instruction at pc is executed
+void chip_profile_exec(chip_profile_t *self, uint16_t pc, instr_t instr) {
+
+    const uint8_t op = chip_opcode_table[instr.data];
+
+    self->pc[pc]++;
+    self->op[op]++;
+    self->instructions++;
+    self->nodes[self->cur].self++;
+
+    // the call is charged to the caller, the return to the subroutine
+    if (op == OP_2NNN)
+        self->cur = prof_enter(self, instr.NNN);
+    else if (op == OP_00EE && self->untracked_depth)
+        self->untracked_depth--;
+    else if (op == OP_00EE)
+        self->cur = self->nodes[self->cur].parent; // a return without a call stays in the root
+}
+
+// from iDXYN / iDXY0
+void chip_profile_draw(chip_profile_t *self, uint8_t x, uint8_t y, uint8_t w, uint8_t h, bool hires, bool collision) {
+
+    const uint8_t width  = hires ? SCREEN_WIDTH  : SCREEN_LORES_WIDTH;
+    const uint8_t height = hires ? SCREEN_HEIGHT : SCREEN_LORES_HEIGHT;
+
+    self->draw.sprites++;
+    self->draw.rows       += h;
+    self->draw.collisions += collision;
+    self->draw.wrapped    += x % width > width - w || y % height + h > height;
+
+    if (w == 16) self->draw.big++;
+    else self->draw.height[h & 0xf]++;
+}
+
+
+// flamegraph.pl input: a line for every call path with instructions of its own
+void chip_profile_folded(const chip_profile_t *self, FILE *out) {
+
+    uint32_t path[PROF_MAX_NODES];
+
+    for (uint32_t n = 0; n < self->nodes_len; ++n) {
+        if (!self->nodes[n].self)
+            continue;
+
+        uint32_t depth = 0;
+        for (uint32_t p = n; p; p = self->nodes[p].parent)
+            path[depth++] = p;
+
+        fputs("main", out);
+        while (depth)
+            fprintf(out, ";sub_%03x", self->nodes[path[--depth]].addr);
+
+        fprintf(out, " %llu\n", (unsigned long long)self->nodes[n].self);
+    }
+}
+
+// memory (optional) is used to show the opcode at the hot addresses
+void chip_profile_json(const chip_profile_t *self, const uint8_t *memory, FILE *out) {
+
+    const uint32_t nodes_len = self->nodes_len;
+    const prof_node_t *const nodes = self->nodes;
+
+    fprintf(out, "{\n  \"instructions\": %llu,\n  \"untracked_calls\": %llu,\n",
+        (unsigned long long)self->instructions, (unsigned long long)self->untracked_calls
+    );
+
+    fprintf(out, "  \"opcodes\": {");
+    for (uint8_t o = 0, first = 1; o < OP_LEN; ++o) {
+        if (!self->op[o]) continue;
+        fprintf(out, "%s\n    \"%s\": %llu", first ? "" : ",", op_names[o], (unsigned long long)self->op[o]);
+        first = 0;
+    }
+    fprintf(out, "\n  },\n");
+
+    // the hottest addresses, a selection of the top PROF_HOT_PCS
+    uint16_t hot[PROF_HOT_PCS];
+    uint32_t hot_len = 0;
+    for (uint32_t pc = 0; pc < 0xffff + 1; ++pc) {
+
+        const uint64_t count = self->pc[pc];
+        if (!count || (hot_len == PROF_HOT_PCS && self->pc[hot[PROF_HOT_PCS - 1]] >= count))
+            continue;
+
+        uint32_t i = hot_len < PROF_HOT_PCS ? hot_len++ : PROF_HOT_PCS - 1;
+        for (; i && self->pc[hot[i - 1]] < count; --i)
+            hot[i] = hot[i - 1];
+        hot[i] = pc;
+    }
+
+    fprintf(out, "  \"hot_pcs\": [");
+    for (uint32_t i = 0; i < hot_len; ++i) {
+        fprintf(out, "%s\n    { \"pc\": \"%03x\", \"count\": %llu", i ? "," : "", hot[i], (unsigned long long)self->pc[hot[i]]);
+        if (memory && hot[i] < 0xffff) fprintf(out, ", \"opcode\": \"%02X%02X\"", memory[hot[i]], memory[hot[i] + 1]);
+        fprintf(out, " }");
+    }
+    fprintf(out, "\n  ],\n");
+
+    // parents come before their children: the totals are summed from the leaves up
+    uint64_t *total = malloc(sizeof(uint64_t) * nodes_len);
+    uint64_t (*sub)[3] = calloc(0xffff + 1, sizeof(*sub)); // calls, self, inclusive per address
+
+    if (total && sub) {
+
+        for (uint32_t n = 0; n < nodes_len; ++n)
+            total[n] = nodes[n].self;
+        for (uint32_t n = nodes_len - 1; n; --n)
+            total[nodes[n].parent] += total[n];
+
+        for (uint32_t n = 1; n < nodes_len; ++n) {
+            sub[nodes[n].addr][0] += nodes[n].calls;
+            sub[nodes[n].addr][1] += nodes[n].self;
+
+            // inclusive counts only the outermost call of a recursion
+            uint32_t p = nodes[n].parent;
+            for (; p && nodes[p].addr != nodes[n].addr; p = nodes[p].parent);
+            if (!p) sub[nodes[n].addr][2] += total[n];
+        }
+
+        fprintf(out, "  \"subroutines\": [");
+        bool first = true;
+        for (uint32_t addr = 0; addr < 0xffff + 1; ++addr) {
+            if (!sub[addr][0]) continue;
+            fprintf(out, "%s\n    { \"addr\": \"%03x\", \"calls\": %llu, \"self\": %llu, \"inclusive\": %llu }",
+                first ? "" : ",", addr,
+                (unsigned long long)sub[addr][0], (unsigned long long)sub[addr][1], (unsigned long long)sub[addr][2]
+            );
+            first = false;
+        }
+        fprintf(out, "\n  ],\n");
+    }
+
+    free(total);
+    free(sub);
+
+    fprintf(out, "  \"draw\": { \"sprites\": %llu, \"rows\": %llu, \"collisions\": %llu, \"wrapped\": %llu, \"height\": [",
+        (unsigned long long)self->draw.sprites, (unsigned long long)self->draw.rows,
+        (unsigned long long)self->draw.collisions, (unsigned long long)self->draw.wrapped
+    );
+    for (uint8_t h = 0; h < 16; ++h)
+        fprintf(out, "%s%llu", h ? ", " : "", (unsigned long long)self->draw.height[h]);
+    fprintf(out, "], \"big\": %llu }\n}\n", (unsigned long long)self->draw.big);
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+/*
+ The CHIP-8 descendants disagree on a handful of instructions, a rom written for one of them may not work on the others.
+ A quirk profile is a set of QUIRK_xxx flags fixed at build time: chip8.h instantiates the handlers which depend on
+ them and chip_run() once per profile (interp.h) with the flags as constants, so every instance has its own straight
+ code and there is no check on the flags while the rom runs.
+ The profile of a chip is chosen before the rom is loaded (chip_set_quirks()), vm with different profiles can run
+ side by side in the same process (es. chip8_batch).
+
+ https://github.com/Timendus/chip8-test-suite#quirks-test for what each one does on the real thing
+*/
+
+enum {
+    QUIRK_VF_RESET     = 1 << 0, // 8XY1, 8XY2, 8XY3 set VF to 0
+    QUIRK_MEMORY       = 1 << 1, // FX55, FX65 leave I after the last register (I += X + 1)
+    QUIRK_SHIFT_VY     = 1 << 2, // 8XY6, 8XYE shift VY into VX, otherwise VX in place
+    QUIRK_CLIP         = 1 << 3, // DXYN clips the sprites at the borders, otherwise they wrap around
+    QUIRK_JUMP_VX      = 1 << 4, // BXNN jumps to XNN + VX, otherwise BNNN jumps to NNN + V0
+    QUIRK_DISPLAY_WAIT = 1 << 5, // 00E0, DXYN wait the vertical blank: the rest of the frame goes by without instructions
+    QUIRK_SHIFT_MSB    = 1 << 6, // 8XY6 puts the msb in VF instead of the lsb: no real machine does it, DEFAULT always did
+    QUIRK_LORES_DXY0   = 1 << 7, // DXY0 draws a 16x16 sprite in lo-res too, otherwise nothing as on CHIP-8 (in hi-res it always does)
+    QUIRK_XO           = 1 << 8, // XO-CHIP: 64 KB of memory (the 4 KB of CHIP-8 otherwise), F000 NNNN, 5XY2 / 5XY3 and the skips jump over F000 NNNN
+};
+
+/*
+ name, suffix of the handler instances (es. i8XY1_chip8), flags.
+ DEFAULT is what this emulator always did (a mix which runs most of the classic roms,
+ es. Space Invaders [David Winter] wants the shift in place), its handlers keep the plain names
+ and it's the only profile of the jit (jit.h) and of lockstep (lockstep.h), which mirror those handlers.
+*/
+#define CHIP_QUIRKS(_) \
+    _(DEFAULT, ,        QUIRK_VF_RESET | QUIRK_MEMORY | QUIRK_SHIFT_MSB) \
+    _(CHIP8,   _chip8,  QUIRK_VF_RESET | QUIRK_MEMORY | QUIRK_SHIFT_VY | QUIRK_CLIP | QUIRK_DISPLAY_WAIT) \
+    _(SCHIP,   _schip,  QUIRK_CLIP | QUIRK_JUMP_VX | QUIRK_LORES_DXY0) \
+    _(XOCHIP,  _xochip, QUIRK_MEMORY | QUIRK_SHIFT_VY | QUIRK_LORES_DXY0 | QUIRK_XO)
+
+#define QUIRKS_ENUM(_NAME_, _SUFFIX_, _FLAGS_) CHIP_QUIRKS_##_NAME_,
+typedef enum { CHIP_QUIRKS(QUIRKS_ENUM) CHIP_QUIRKS_LEN } chip_quirks_t;
+#undef QUIRKS_ENUM
+
+// the flags of every profile as constants, es. QUIRKS_FLAGS_CHIP8
+#define QUIRKS_FLAGS(_NAME_, _SUFFIX_, _FLAGS_) QUIRKS_FLAGS_##_NAME_ = (_FLAGS_),
+enum { CHIP_QUIRKS(QUIRKS_FLAGS) };
+#undef QUIRKS_FLAGS
+
+// the same at runtime, for the few places which don't run inside an instance (es. chip_fetch())
+#define QUIRKS_FLAGS_OF(_NAME_, _SUFFIX_, _FLAGS_) [CHIP_QUIRKS_##_NAME_] = (_FLAGS_),
+static const uint16_t chip_quirks_flags[CHIP_QUIRKS_LEN] = { CHIP_QUIRKS(QUIRKS_FLAGS_OF) };
+#undef QUIRKS_FLAGS_OF
+
+static const char *const chip_quirks_names[CHIP_QUIRKS_LEN] = { "default", "chip8", "schip", "xochip" };
+
+_Static_assert(CHIP_QUIRKS_LEN <= UINT8_MAX, "a profile must fit in an uint8_t (chip8_t, rompack_entry_t)");
+
+
+// "default", "chip8", "schip" or "xochip", CHIP_QUIRKS_LEN if it's none of them
+chip_quirks_t chip_quirks_parse(const char *name) {
+
+    for (uint8_t q = 0; q < CHIP_QUIRKS_LEN; ++q)
+        if (!strcmp(chip_quirks_names[q], name))
+            return q;
+
+    return CHIP_QUIRKS_LEN;
+}
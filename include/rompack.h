@@ -0,0 +1,206 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <chip8.h>
+#include <hash.h>
+
+/*
+ Many roms in one file, built by chip8_rompack (src/rompack.c) and mapped read only: finding a rom is a binary search
+ on its xxh64 (or on the xxh64 of its name) and loading it is chip_load_rom_mem() straight from the mapping,
+ no open / seek / read per rom. Identical roms are stored once.
+
+ rompack_header_t
+ rompack_entry_t[roms]  sorted by hash
+ rompack_name_t[names]  sorted by hash of the name
+ names                  '\0' terminated
+ data                   the roms
+
+ Every number is little endian, offsets are from the beginning of the file.
+*/
+
+#define ROMPACK_MAGIC   "CH8P"
+#define ROMPACK_VERSION 1
+
+typedef struct {
+    char magic[4];       // ROMPACK_MAGIC
+    uint32_t version;    // ROMPACK_VERSION
+    uint32_t roms;
+    uint32_t names;
+    uint64_t index;      // rompack_entry_t[roms]
+    uint64_t name_index; // rompack_name_t[names]
+    uint64_t strings;    // the names
+} rompack_header_t;
+
+typedef struct {
+    uint64_t hash;   // xxh64 of the rom, seed 0
+    uint32_t offset; // of the rom
+    uint16_t size;
+    uint16_t ipf;    // preferred instructions per frame, 0 -> the default of who runs it
+    uint8_t quirks;  // preferred quirk profile (quirks.h), CHIP_QUIRKS_DEFAULT -> the default of who runs it
+    uint8_t pad[7];
+    char keymap[16]; // host key of every chip-8 key 0..F (es. "x123qweasdzc4rfv"), '\0' -> the default layout
+} rompack_entry_t;
+
+typedef struct {
+    uint64_t hash;   // xxh64 of the name, seed 0
+    uint32_t name;   // offset of the name in the strings
+    uint32_t rom;    // index of its rompack_entry_t
+} rompack_name_t;
+
+_Static_assert(sizeof(rompack_header_t) == 40, "padding in rompack_header_t");
+_Static_assert(sizeof(rompack_entry_t) == 40, "padding in rompack_entry_t");
+_Static_assert(sizeof(rompack_name_t) == 16, "padding in rompack_name_t");
+
+typedef struct {
+    const uint8_t *base;
+    size_t size;
+    const rompack_entry_t *roms;
+    const rompack_name_t *names;
+    const char *strings;
+    uint32_t roms_len, names_len;
+} rompack_t;
+
+
+// the index and every rom must lie inside the file, every rom size the one of chip_read_rom(): false on a truncated or corrupted pack
+static bool rompack_check(const rompack_t *self, const rompack_header_t *h) {
+
+    const uint64_t index = le64toh(h->index), name_index = le64toh(h->name_index), strings = le64toh(h->strings);
+
+    if (index > self->size || (self->size - index) / sizeof(rompack_entry_t) < self->roms_len)
+        return false;
+    if (name_index > self->size || (self->size - name_index) / sizeof(rompack_name_t) < self->names_len)
+        return false;
+    if (strings > self->size || (index | name_index) % 8)
+        return false;
+
+    for (uint32_t i = 0; i < self->roms_len; ++i) {
+        const uint64_t offset = le32toh(self->roms[i].offset), size = le16toh(self->roms[i].size);
+        if (size < sizeof(uint16_t) || size >= CHIP_ROM_MAX || offset + size > self->size || self->roms[i].quirks >= CHIP_QUIRKS_LEN)
+            return false;
+    }
+
+    for (uint32_t i = 0; i < self->names_len; ++i) {
+        const uint64_t name = strings + le32toh(self->names[i].name);
+        if (le32toh(self->names[i].rom) >= self->roms_len || name >= self->size || !memchr(self->base + name, '\0', self->size - name))
+            return false;
+    }
+
+    return true;
+}
+
+rompack_t * rompack_open(const char *path) {
+
+    rompack_t *self;
+    if (!(self = calloc(1, sizeof(rompack_t))))
+        return NULL;
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) || (size_t)st.st_size < sizeof(rompack_header_t)) {
+        if (fd != -1) close(fd);
+        free(self);
+        return NULL;
+    }
+
+    self->size = st.st_size;
+    void *base = mmap(NULL, self->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file
+
+    if (base == MAP_FAILED) {
+        free(self);
+        return NULL;
+    }
+
+    self->base = base;
+    const rompack_header_t *h = base;
+
+    self->roms_len  = le32toh(h->roms);
+    self->names_len = le32toh(h->names);
+    self->roms      = (const rompack_entry_t *)(self->base + le64toh(h->index));
+    self->names     = (const rompack_name_t *)(self->base + le64toh(h->name_index));
+    self->strings   = (const char *)(self->base + le64toh(h->strings));
+
+    if (memcmp(h->magic, ROMPACK_MAGIC, sizeof(h->magic)) || le32toh(h->version) != ROMPACK_VERSION || !rompack_check(self, h)) {
+        munmap(base, self->size);
+        free(self);
+        return NULL;
+    }
+
+    return self;
+}
+
+void rompack_close(rompack_t *self) {
+    if (!self) return;
+    munmap((void *)self->base, self->size);
+    free(self);
+}
+
+// by the xxh64 of its content, NULL if missing
+const rompack_entry_t * rompack_find(const rompack_t *self, uint64_t hash) {
+
+    uint32_t lo = 0, hi = self->roms_len;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (le64toh(self->roms[mid].hash) < hash) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo < self->roms_len && le64toh(self->roms[lo].hash) == hash ? self->roms + lo : NULL;
+}
+
+// by name, es. "pong.ch8". NULL if missing
+const rompack_entry_t * rompack_find_name(const rompack_t *self, const char *name) {
+
+    const uint64_t hash = xxh64(name, strlen(name), 0);
+
+    uint32_t lo = 0, hi = self->names_len;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (le64toh(self->names[mid].hash) < hash) lo = mid + 1;
+        else hi = mid;
+    }
+
+    // different names may share the hash, they are next to each other
+    for (; lo < self->names_len && le64toh(self->names[lo].hash) == hash; ++lo)
+        if (!strcmp(self->strings + le32toh(self->names[lo].name), name))
+            return self->roms + le32toh(self->names[lo].rom);
+
+    return NULL;
+}
+
+/*
+ "name" or the 16 hex digits of the hash, es. "pong.ch8" or "0x3c5f0e2a9b1d7784".
+ Names are tried first, a rom called like an hash stays reachable.
+*/
+const rompack_entry_t * rompack_lookup(const rompack_t *self, const char *key) {
+
+    const rompack_entry_t *e;
+    if ((e = rompack_find_name(self, key)))
+        return e;
+
+    char *end;
+    const uint64_t hash = strtoull(key, &end, 16);
+    return end != key && !*end ? rompack_find(self, hash) : NULL;
+}
+
+static inline const uint8_t * rompack_data(const rompack_t *self, const rompack_entry_t *e) {
+    return self->base + le32toh(e->offset);
+}
+
+static inline uint16_t rompack_size(const rompack_entry_t *e) {
+    return le16toh(e->size);
+}
+
+// same of chip_load_rom() but from the pack, a copy of less than CHIP_ROM_MAX bytes (rompack_check())
+bool chip_load_rom_pack(chip8_t *chip, const rompack_t *pack, const rompack_entry_t *e) {
+    return chip_load_rom_mem(chip, rompack_data(pack, e), rompack_size(e));
+}
@@ -0,0 +1,433 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <endian.h>
+#include <bit_utility.h>
+
+#include <chip8.h>
+
+/*
+ Save states: the whole machine in a chip_state_t, a fixed size struct of fixed width fields without padding.
+ The icache, the on_write hook and the like aren't state, they're rebuilt (see chip_restore()).
+
+ On disk it's a chip_state_file_t header followed by the chip_state_t, every multi-byte field little endian.
+ Bump CHIP_STATE_VERSION every time chip_state_t changes.
+
+ Rewind: a ring of per frame snapshots, each one stored as the XOR against the previous frame run-length
+ compressed in 64 bit words; between two frames almost every word of the memory and of the screen is unchanged,
+ so a frame usually costs a few dozen bytes. Only the newest frame is kept whole, going back n frames applies the
+ newest n deltas to it: everything is sequential memory, a frame costs less than a microsecond.
+*/
+
+#define CHIP_STATE_MAGIC   "CH8S"
+#define CHIP_STATE_VERSION 4 // 3: the SUPER-CHIP screen, 4: XO-CHIP (64 KB, the planes, the audio), older states aren't loaded
+
+typedef struct {
+    uint8_t  memory[CHIP_MEM_MAX];
+    uint64_t plane[SCREEN_PLANES][SCREEN_HEIGHT][SCREEN_WORDS];
+    uint64_t cycles;
+    uint64_t rng;
+    uint16_t stack[256];
+    uint16_t I, PC;
+    uint16_t rom_size;
+    uint8_t  V[REG_LEN];
+    uint8_t  keypad[HKEY_LEN];
+    uint8_t  rpl[REG_LEN];
+    uint8_t  audio_pattern[16];
+    uint8_t  stack_idx;
+    uint8_t  delay_timer, sound_timer;
+    uint8_t  is_awaiting, await_dreg;
+    uint8_t  quirks;
+    uint8_t  hires;
+    uint8_t  planes, planes_used;
+    uint8_t  audio_pitch, audio_loaded;
+    uint8_t  pad[7]; // always 0, the struct is a whole number of uint64_t (rewind_t works on words)
+} chip_state_t;
+
+_Static_assert(sizeof(chip_state_t) % sizeof(uint64_t) == 0, "chip_state_t must be a whole number of words");
+_Static_assert(sizeof(chip_state_t) == 70248, "padding in chip_state_t, or a field changed without a new CHIP_STATE_VERSION");
+
+typedef struct {
+    char magic[4];    // CHIP_STATE_MAGIC
+    uint32_t version; // CHIP_STATE_VERSION
+    uint32_t size;    // sizeof(chip_state_t)
+    uint32_t reserved;
+} chip_state_file_t;
+
+
+void chip_snapshot(const chip8_t *chip, chip_state_t *state) {
+
+    // the 60 KB above the 4 KB of the profiles without QUIRK_XO are 0
+    memcpy(state->memory, chip->memory, chip_mem_size(chip));
+    memset(state->memory + chip_mem_size(chip), 0x00, sizeof(state->memory) - chip_mem_size(chip));
+    memcpy(state->plane, chip->plane, sizeof(state->plane));
+    memcpy(state->stack, chip->stack.stack, sizeof(state->stack));
+    memcpy(state->V, chip->V, sizeof(state->V));
+    memcpy(state->keypad, chip->keypad, sizeof(state->keypad));
+    memcpy(state->rpl, chip->rpl, sizeof(state->rpl));
+    memcpy(state->audio_pattern, chip->audio.pattern, sizeof(state->audio_pattern));
+    memset(state->pad, 0x00, sizeof(state->pad));
+
+    state->cycles      = chip->cycles;
+    state->rng         = chip->rng;
+    state->I           = chip->I;
+    state->PC          = chip->PC;
+    state->rom_size    = chip->rom_size;
+    state->stack_idx   = chip->stack.idx;
+    state->delay_timer = chip->delay_timer;
+    state->sound_timer = chip->sound_timer;
+    state->is_awaiting = chip->is_awaiting;
+    state->await_dreg  = chip->await_dreg;
+    state->quirks      = chip->quirks;
+    state->hires       = chip->hires;
+    state->planes      = chip->planes;
+    state->planes_used = chip->planes_used;
+    state->audio_pitch  = chip->audio.pitch;
+    state->audio_loaded = chip->audio.loaded;
+}
+
+/*
+ the hook (es. the jit) is kept and told about the memory which changed, the whole screen must be presented again.
+ False only if the state is of XO-CHIP and its 64 KB can't be allocated, the chip is untouched
+*/
+bool chip_restore(chip8_t *chip, const chip_state_t *state) {
+
+    if (!chip_set_quirks(chip, state->quirks)) // a no-op unless the state comes from another profile
+        return false;
+
+    // only the lines that differ lose their predecoded instructions
+    for (uint32_t a = 0; a < chip_mem_size(chip); a += 64) {
+        if (!memcmp(chip->memory + a, state->memory + a, 64))
+            continue;
+
+        memcpy(chip->memory + a, state->memory + a, 64);
+        chip_invalidate(chip, a, 64);
+    }
+
+    memcpy(chip->plane, state->plane, sizeof(chip->plane));
+    memcpy(chip->stack.stack, state->stack, sizeof(chip->stack.stack));
+    memcpy(chip->V, state->V, sizeof(chip->V));
+    memcpy(chip->keypad, state->keypad, sizeof(chip->keypad));
+    memcpy(chip->rpl, state->rpl, sizeof(chip->rpl));
+    memcpy(chip->audio.pattern, state->audio_pattern, sizeof(chip->audio.pattern));
+
+    chip->screen_dirty = SCREEN_ROWS_ALL;
+    chip->cycles       = state->cycles;
+    chip->rng          = state->rng;
+    chip->I            = state->I;
+    chip->PC           = state->PC;
+    chip->rom_size     = state->rom_size;
+    chip->stack.idx    = state->stack_idx;
+    chip->delay_timer  = state->delay_timer;
+    chip->sound_timer  = state->sound_timer;
+    chip->is_awaiting  = state->is_awaiting;
+    chip->await_dreg   = state->await_dreg;
+    chip->hires        = state->hires;
+    chip->planes       = state->planes;
+    chip->planes_used  = state->planes_used;
+    chip->audio.pitch  = state->audio_pitch;
+    chip->audio.loaded = state->audio_loaded;
+    return true;
+}
+
+// host <-> little endian, the same swap both ways (nothing to do on x86)
+static void chip_state_swap_le(chip_state_t *state) {
+
+    for (uint8_t p = 0; p < SCREEN_PLANES; ++p)
+        for (uint16_t r = 0; r < SCREEN_HEIGHT; ++r)
+            for (uint8_t w = 0; w < SCREEN_WORDS; ++w)
+                state->plane[p][r][w] = htole64(state->plane[p][r][w]);
+
+    for (uint16_t i = 0; i < 256; ++i)
+        state->stack[i] = htole16(state->stack[i]);
+
+    state->cycles   = htole64(state->cycles);
+    state->rng      = htole64(state->rng);
+    state->I        = htole16(state->I);
+    state->PC       = htole16(state->PC);
+    state->rom_size = htole16(state->rom_size);
+}
+
+bool chip_save_state(const chip8_t *chip, const char *fpath) {
+
+    chip_state_file_t header = {0};
+    memcpy(header.magic, CHIP_STATE_MAGIC, sizeof(header.magic));
+    header.version = htole32(CHIP_STATE_VERSION);
+    header.size    = htole32(sizeof(chip_state_t));
+
+    chip_state_t state;
+    chip_snapshot(chip, &state);
+    chip_state_swap_le(&state);
+
+    FILE *file;
+    if (!(file = fopen(fpath, "wb")))
+        return false;
+
+    const bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&state, sizeof(state), 1, file) == 1;
+    return !fclose(file) && ok;
+}
+
+// false if the file can't be read or it's not a state of this version, the chip is untouched
+bool chip_load_state(chip8_t *chip, const char *fpath) {
+
+    FILE *file;
+    if (!(file = fopen(fpath, "rb")))
+        return false;
+
+    chip_state_file_t header;
+    chip_state_t state;
+
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+        && !memcmp(header.magic, CHIP_STATE_MAGIC, sizeof(header.magic))
+        && le32toh(header.version) == CHIP_STATE_VERSION
+        && le32toh(header.size) == sizeof(chip_state_t)
+        && fread(&state, sizeof(state), 1, file) == 1;
+
+    fclose(file);
+    if (!ok || state.quirks >= CHIP_QUIRKS_LEN || state.hires > 1 || state.audio_loaded > 1 || state.is_awaiting > 1 || state.await_dreg > 0xf)
+        return false;
+
+    chip_state_swap_le(&state);
+
+    // a damaged file mustn't reach the asserts of the handlers: the PC and I inside the memory of its profile, 4 planes at most
+    const uint32_t mem_size = CHIP_MEM_SIZE(chip_quirks_flags[state.quirks]);
+    if (state.PC > mem_size - sizeof(uint16_t) || state.I >= mem_size || state.planes > 0xf || state.planes_used > 0xf)
+        return false;
+
+    return chip_restore(chip, &state);
+}
+
+
+#define REWIND_FRAMES (60 * 60)  // 1 minute at 60 Hz
+#define REWIND_BYTES  (1 << 20)
+
+#define REWIND_WORDS     (sizeof(chip_state_t) / sizeof(uint64_t))
+#define REWIND_DELTA_MAX (sizeof(chip_state_t) + REWIND_WORDS * 2 * sizeof(uint16_t)) // every other word changed
+
+_Static_assert(REWIND_WORDS <= UINT16_MAX, "the runs of a delta are counted in uint16_t");
+
+// the delta of a frame is in data[off, off + len)
+typedef struct {
+    uint32_t off, len;
+} rewind_entry_t;
+
+typedef struct {
+
+    alignas(64) chip_state_t last; // the newest frame, whole
+    bool has_last;
+
+    rewind_entry_t *entries; // ring, entries[head] is the oldest delta
+    uint32_t entries_cap, head, len;
+
+    uint8_t *data; // ring of bytes, the deltas are never split at the end
+    uint32_t data_cap, tail;
+
+    uint8_t scratch[REWIND_DELTA_MAX];
+
+} rewind_t;
+
+
+/*
+ the xor of last and cur as a list of runs: uint16_t zero words to skip, uint16_t changed words, the changed words.
+ Then last = cur. The trailing unchanged words aren't stored, an idle frame is a single empty run:
+ never 0 bytes, rewind_alloc() relies on every delta taking some room in the ring
+*/
+static uint32_t rewind_encode(uint8_t *restrict dst, uint64_t *restrict last, const uint64_t *restrict cur) {
+
+    uint8_t *p = dst;
+
+    for (uint32_t w = 0; w < REWIND_WORDS; ) {
+
+        const uint32_t skip_from = w;
+        while (w < REWIND_WORDS && last[w] == cur[w]) ++w;
+        if (w == REWIND_WORDS) break;
+
+        const uint32_t lit_from = w;
+        while (w < REWIND_WORDS && last[w] != cur[w]) ++w;
+
+        const uint16_t run[2] = { lit_from - skip_from, w - lit_from };
+        memcpy(p, run, sizeof(run));
+        p += sizeof(run);
+
+        for (uint32_t i = lit_from; i < w; ++i) {
+            const uint64_t x = last[i] ^ cur[i];
+            memcpy(p, &x, sizeof(x));
+            p += sizeof(x);
+            last[i] = cur[i];
+        }
+    }
+
+    if (p == dst) {
+        const uint16_t run[2] = { 0, 0 };
+        memcpy(p, run, sizeof(run));
+        p += sizeof(run);
+    }
+
+    return p - dst;
+}
+
+static void rewind_apply(uint64_t *restrict state, const uint8_t *restrict delta, uint32_t len) {
+
+    const uint8_t *const end = delta + len;
+    for (uint32_t w = 0; delta < end; ) {
+
+        uint16_t run[2];
+        memcpy(run, delta, sizeof(run));
+        delta += sizeof(run);
+
+        w += run[0];
+        assert(w + run[1] <= REWIND_WORDS);
+
+        for (uint16_t i = 0; i < run[1]; ++i, ++w, delta += sizeof(uint64_t)) {
+            uint64_t x;
+            memcpy(&x, delta, sizeof(x));
+            state[w] ^= x;
+        }
+    }
+}
+
+static void rewind_drop_oldest(rewind_t *self) {
+    assert(self->len);
+    self->head = (self->head + 1) % self->entries_cap;
+    self->len--;
+}
+
+static FORCED(inline) rewind_entry_t * rewind_entry(const rewind_t *self, uint32_t i) {
+    return self->entries + (self->head + i) % self->entries_cap;
+}
+
+// room for len bytes at the tail, the oldest deltas in the way are dropped; false if len is more than the whole ring
+static bool rewind_alloc(rewind_t *self, uint32_t len, uint32_t *off) {
+
+    if (len > self->data_cap)
+        return false;
+
+    if (self->tail + len > self->data_cap) {
+        // the deltas after the tail are older than the ones from 0, and the end is wasted anyway
+        while (self->len && rewind_entry(self, 0)->off >= self->tail)
+            rewind_drop_oldest(self);
+        self->tail = 0;
+    }
+
+    // the oldest delta right after the tail overlaps
+    while (self->len) {
+        const rewind_entry_t *oldest = rewind_entry(self, 0);
+        if (oldest->off >= self->tail + len || oldest->off + oldest->len <= self->tail)
+            break;
+        rewind_drop_oldest(self);
+    }
+
+    *off = self->tail;
+    self->tail += len;
+    return true;
+}
+
+// up to frames frames in bytes of deltas (REWIND_FRAMES, REWIND_BYTES), NULL on failure
+rewind_t * rewind_new(uint32_t frames, uint32_t bytes) {
+
+    assert(frames && bytes);
+
+    rewind_t *self;
+    if (!(self = aligned_alloc(64, (sizeof(rewind_t) + 63) / 64 * 64)))
+        return NULL;
+
+    memset(self, 0x00, offsetof(rewind_t, scratch));
+    self->entries_cap = frames;
+    self->data_cap    = bytes;
+
+    if (!(self->entries = malloc(sizeof(rewind_entry_t) * frames)) || !(self->data = malloc(bytes))) {
+        free(self->entries);
+        free(self);
+        return NULL;
+    }
+
+    return self;
+}
+
+void rewind_free(rewind_t *self) {
+    if (!self) return;
+    free(self->entries);
+    free(self->data);
+    free(self);
+}
+
+// forget every frame, es. after a reset or a load state
+void rewind_clear(rewind_t *self) {
+    self->has_last = false;
+    self->head = self->len = self->tail = 0;
+}
+
+// how many frames back rewind_back() can go
+uint32_t rewind_frames(const rewind_t *self) {
+    return self->len;
+}
+
+// once per frame
+void rewind_push(rewind_t *self, const chip8_t *chip) {
+
+    chip_state_t cur;
+    chip_snapshot(chip, &cur);
+
+    if (!self->has_last) {
+        self->last     = cur;
+        self->has_last = true;
+        return;
+    }
+
+    const uint32_t len = rewind_encode(self->scratch, (uint64_t *)&self->last, (const uint64_t *)&cur);
+
+    uint32_t off;
+    if (!rewind_alloc(self, len, &off)) {
+        // a frame bigger than the whole ring, the history before it is lost
+        self->head = self->len = self->tail = 0;
+        return;
+    }
+
+    if (self->len == self->entries_cap)
+        rewind_drop_oldest(self);
+
+    memcpy(self->data + off, self->scratch, len);
+    *rewind_entry(self, self->len++) = (rewind_entry_t){ .off = off, .len = len };
+}
+
+// the state of back frames ago (0 the newest), without changing the history; false if it's not there anymore
+bool rewind_peek(const rewind_t *self, uint32_t back, chip_state_t *state) {
+
+    if (!self->has_last || back > self->len)
+        return false;
+
+    *state = self->last;
+    for (uint32_t i = self->len; i > self->len - back; --i) {
+        const rewind_entry_t *e = rewind_entry(self, i - 1);
+        rewind_apply((uint64_t *)state, self->data + e->off, e->len);
+    }
+
+    return true;
+}
+
+// restore the chip back frames ago and forget the frames after it, the next rewind_push() continues from there
+bool rewind_back(rewind_t *self, chip8_t *chip, uint32_t back) {
+
+    if (!self->has_last || back > self->len)
+        return false;
+
+    for (; back; --back) {
+        const rewind_entry_t *e = rewind_entry(self, --self->len);
+        rewind_apply((uint64_t *)&self->last, self->data + e->off, e->len);
+    }
+
+    if (self->len) {
+        const rewind_entry_t *newest = rewind_entry(self, self->len - 1);
+        self->tail = newest->off + newest->len;
+    } else {
+        self->head = self->tail = 0;
+    }
+
+    chip_restore(chip, &self->last);
+    return true;
+}
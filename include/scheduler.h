@@ -0,0 +1,80 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+ Fixed rate frames, independent of how long the OS takes to wake us up or the renderer takes to present.
+
+ The frontend runs ipf instructions of a frame in a tight loop, ticks the timers once, polls the events once
+ and then sched_wait() sleeps till the absolute deadline of the next frame (clock_nanosleep() TIMER_ABSTIME):
+ deadlines are multiples of the period from the start, so the sleep jitter never accumulates.
+
+ When a frame ends after the next deadline (slow machine, window dragged, debugger...) sched_wait()
+ doesn't sleep and returns how many frames are due, they're emulated back to back without presenting
+ in between. More than max_catchup due frames are dropped and the clock restarts from now,
+ otherwise after a long stall the emulation would run in fast forward for a while.
+*/
+
+#define SCHED_HZ          60
+#define SCHED_IPF         30 // instructions per frame, same pace of HEADLESS_IPF
+#define SCHED_MAX_CATCHUP 4  // frames
+
+typedef struct {
+
+    int64_t deadline; // ns, CLOCK_MONOTONIC: when the next frame is due
+    int64_t period;   // ns
+
+    uint32_t ipf;
+    uint32_t max_catchup;
+
+    // stats
+    uint64_t late;    // sched_wait() calls which found the deadline already expired
+    uint64_t dropped; // frames never emulated
+
+} sched_t;
+
+
+static inline int64_t sched_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+void sched_init(sched_t *self, uint32_t ipf, uint32_t hz, uint32_t max_catchup) {
+    *self = (sched_t){
+        .deadline    = sched_now(),
+        .period      = 1000000000 / hz,
+        .ipf         = ipf,
+        .max_catchup = max_catchup ? max_catchup : 1,
+    };
+}
+
+// the current frame is over: sleep till the next one is due, return how many frames must be emulated now (at least 1)
+uint32_t sched_wait(sched_t *self) {
+
+    self->deadline += self->period;
+    const int64_t now = sched_now();
+
+    if (now < self->deadline) {
+
+        const struct timespec ts = { .tv_sec = self->deadline / 1000000000, .tv_nsec = self->deadline % 1000000000 };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        return 1;
+    }
+
+    // behind: the one due plus every whole period elapsed since
+    uint64_t due = 1 + (now - self->deadline) / self->period;
+    self->late++;
+
+    if (due > self->max_catchup) {
+        self->dropped += due - self->max_catchup;
+        self->deadline = now;
+        due = self->max_catchup;
+    } else {
+        self->deadline += (due - 1) * self->period;
+    }
+
+    return due;
+}
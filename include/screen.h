@@ -1,5 +1,9 @@
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <immintrin.h>
 
 /*
 
@@ -21,8 +25,174 @@ How many rows (bytes) encompass a sprite is specified through the CHIP-8 instruc
 or sprite data, a bit set to one corresponds to a white pixel. Contrastingly, a bit set to zero corresponds to a transparent pixel.
 */
 
-#define SCREEN_WIDTH  64
-#define SCREEN_HEIGHT 32
+/*
+ SUPER-CHIP: 128x64 in hi-res (00FF), the CHIP-8 64x32 in lo-res (00FE, the default). The framebuffer is always the
+ hi-res one, in lo-res only its top left quarter is used (a lo-res pixel is a pixel, the frontend scales it)
+ and everything outside it stays 0: the lo-res code is the CHIP-8 one on word 0 of the first 32 rows.
+*/
+#define SCREEN_WIDTH  128
+#define SCREEN_HEIGHT 64
+#define SCREEN_LORES_WIDTH  64
+#define SCREEN_LORES_HEIGHT 32
+
+// the framebuffer is bit-packed: SCREEN_WORDS uint64_t per row, the msb of word 0 is the leftmost pixel
+#define SCREEN_WORDS (SCREEN_WIDTH / 64)
+_Static_assert(SCREEN_WIDTH % 64 == 0 && SCREEN_LORES_WIDTH == 64, "a screen row must be a whole number of uint64_t, a lo-res row one");
+
+/*
+ XO-CHIP: up to SCREEN_PLANES framebuffers like the one above, one bit of the color of a pixel each (plane p -> bit p),
+ iFN01 selects which ones the drawing, clearing and scrolling instructions work on. Each plane is still bit-packed,
+ the instructions run on every selected plane with the word-wide code of a single one.
+*/
+#define SCREEN_PLANES 4
+
+// a bit for each row of the screen, see chip8_t::screen_dirty
+_Static_assert(SCREEN_HEIGHT <= 64, "a dirty bit for each screen row");
+#define SCREEN_ROWS(_HEIGHT_) ((_HEIGHT_) == 64 ? ~(uint64_t)0 : ((uint64_t)1 << (_HEIGHT_)) - 1)
+#define SCREEN_ROWS_ALL SCREEN_ROWS(SCREEN_HEIGHT)
+
+// pixel (r, c) is on?
+#define SCREEN_PIXEL(_SCREEN_,_ROW_,_COL_) (((_SCREEN_)[_ROW_][(_COL_) / 64] >> (63 - (_COL_) % 64)) & 1)
+
+#define SCREEN_ARGB_OFF 0xff000000 // opaque black
+#define SCREEN_ARGB_ON  0xffffffff // white
+
+// the color of the bits of a pixel in the planes, 0 and 1 are the ones of a single plane (the Octo defaults for the next two)
+static const uint32_t screen_palette[1 << SCREEN_PLANES] = {
+    SCREEN_ARGB_OFF, SCREEN_ARGB_ON, 0xffffcc00, 0xffff6600,
+    0xff662200,      0xff996600,     0xff00aa55, 0xff0066cc,
+    0xffaa00aa,      0xff55ffff,     0xffff5555, 0xff5555ff,
+    0xff888888,      0xffcccccc,     0xff444444, 0xffffffaa,
+};
+
+// expand a word of a row of the framebuffer to 64 ARGB8888 pixels
+static inline void screen_row_to_argb8888(uint32_t *restrict dst, uint64_t row) {
+
+#if defined(__AVX2__)
+
+    // 8 pixels for each byte of the row, lane i keeps the bit 7-i
+    const __m256i mask  = _mm256_set_epi32(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+    const __m256i alpha = _mm256_set1_epi32(SCREEN_ARGB_OFF);
+
+    for (uint8_t i = 0; i < 64 / 8; ++i) {
+        const __m256i byte = _mm256_set1_epi32((row >> (64 - 8 - i * 8)) & 0xff);
+        const __m256i on   = _mm256_cmpeq_epi32(_mm256_and_si256(byte, mask), mask);
+        _mm256_storeu_si256((__m256i *)(dst + i * 8), _mm256_or_si256(on, alpha));
+    }
+
+#elif defined(__SSE2__)
+
+    const __m128i mask_hi = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+    const __m128i mask_lo = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+    const __m128i alpha   = _mm_set1_epi32(SCREEN_ARGB_OFF);
+
+    for (uint8_t i = 0; i < 64 / 8; ++i) {
+        const __m128i byte = _mm_set1_epi32((row >> (64 - 8 - i * 8)) & 0xff);
+        const __m128i hi   = _mm_cmpeq_epi32(_mm_and_si128(byte, mask_hi), mask_hi);
+        const __m128i lo   = _mm_cmpeq_epi32(_mm_and_si128(byte, mask_lo), mask_lo);
+        _mm_storeu_si128((__m128i *)(dst + i * 8 + 0), _mm_or_si128(hi, alpha));
+        _mm_storeu_si128((__m128i *)(dst + i * 8 + 4), _mm_or_si128(lo, alpha));
+    }
+
+#else
+
+    for (uint8_t c = 0; c < 64; ++c)
+        dst[c] = SCREEN_ARGB_OFF | -(uint32_t)((row >> (63 - c)) & 1);
+
+#endif
+}
+
+
+// the same for the word of a row in every plane (XO-CHIP), pixel by pixel through screen_palette[]: only when more than one plane was used
+static inline void screen_planes_to_argb8888(uint32_t *restrict dst, const uint64_t word[SCREEN_PLANES]) {
+    for (uint8_t c = 0; c < 64; ++c) {
+        uint8_t color = 0;
+        for (uint8_t p = 0; p < SCREEN_PLANES; ++p)
+            color |= ((word[p] >> (63 - c)) & 1) << p;
+        dst[c] = screen_palette[color];
+    }
+}
+
+
+/*
+ Scroll the first rows of the screen n pixels right (n > 0, 00FB) or left (n < 0, 00FC), what goes out is lost.
+ Two whole rows per AVX2 register: every word shifts by n, then the pixels which cross from a word to the next one of
+ the same row (hi-res only, in lo-res word 1 is always 0 and it must stay so) are moved a lane over and or'ed in.
+*/
+static inline void screen_scroll_h(uint64_t (*restrict screen)[SCREEN_WORDS], uint8_t rows, int8_t n, bool hires) {
+
+    _Static_assert(SCREEN_WORDS == 2, "a row is 128 bit: a lane of an AVX2 register, an SSE2 register");
+
+    const uint8_t sh = n < 0 ? -n : n;
+    if (!sh) return;
+    assert(sh < 64 && rows <= SCREEN_HEIGHT);
+
+#if defined(__AVX2__)
+
+    const __m128i cnt  = _mm_cvtsi32_si128(sh);
+    const __m128i back = _mm_cvtsi32_si128(64 - sh);
+    const __m256i wide = _mm256_set1_epi64x(-(int64_t)hires);
+
+    assert(rows % 2 == 0);
+    for (uint8_t r = 0; r < rows; r += 2) {
+        __m256i *const p = (__m256i *)screen[r]; // 32 byte aligned, see chip8_t::screen
+        const __m256i v = _mm256_load_si256(p);
+        const __m256i row   = n > 0 ? _mm256_srl_epi64(v, cnt) : _mm256_sll_epi64(v, cnt);
+        const __m256i carry = n > 0
+            ? _mm256_slli_si256(_mm256_sll_epi64(v, back), 8)  // word 0 -> word 1
+            : _mm256_srli_si256(_mm256_srl_epi64(v, back), 8); // word 1 -> word 0
+        _mm256_store_si256(p, _mm256_or_si256(row, _mm256_and_si256(carry, wide)));
+    }
+
+#elif defined(__SSE2__)
+
+    const __m128i cnt  = _mm_cvtsi32_si128(sh);
+    const __m128i back = _mm_cvtsi32_si128(64 - sh);
+    const __m128i wide = _mm_set1_epi64x(-(int64_t)hires);
+
+    for (uint8_t r = 0; r < rows; ++r) {
+        __m128i *const p = (__m128i *)screen[r];
+        const __m128i v = _mm_load_si128(p);
+        const __m128i row   = n > 0 ? _mm_srl_epi64(v, cnt) : _mm_sll_epi64(v, cnt);
+        const __m128i carry = n > 0
+            ? _mm_slli_si128(_mm_sll_epi64(v, back), 8)
+            : _mm_srli_si128(_mm_srl_epi64(v, back), 8);
+        _mm_store_si128(p, _mm_or_si128(row, _mm_and_si128(carry, wide)));
+    }
+
+#else
+
+    const uint64_t wide = -(uint64_t)hires;
+
+    for (uint8_t r = 0; r < rows; ++r) {
+        uint64_t *const w = screen[r];
+        if (n > 0) {
+            w[1] = w[1] >> sh | (w[0] << (64 - sh) & wide);
+            w[0] = w[0] >> sh;
+        } else {
+            w[0] = w[0] << sh | (w[1] >> (64 - sh) & wide);
+            w[1] = w[1] << sh;
+        }
+    }
+
+#endif
+}
+
+// scroll the first rows of the screen n rows down (n > 0, 00CN) or up (n < 0, 00DN), the rows which come in are blank
+static inline void screen_scroll_v(uint64_t (*restrict screen)[SCREEN_WORDS], uint8_t rows, int8_t n) {
+
+    const uint8_t sh = n < 0 ? -n : n;
+    if (sh >= rows) {
+        memset(screen, 0x00, rows * sizeof(screen[0]));
+        return;
+    }
 
-// r * width + c
-#define SC(_ROW_,_COL_) (_ROW_ * SCREEN_WIDTH + _COL_)
+    // whole rows, memmove() is already as wide as the machine allows
+    if (n > 0) {
+        memmove(screen + sh, screen, (rows - sh) * sizeof(screen[0]));
+        memset(screen, 0x00, sh * sizeof(screen[0]));
+    } else {
+        memmove(screen, screen + sh, (rows - sh) * sizeof(screen[0]));
+        memset(screen + rows - sh, 0x00, sh * sizeof(screen[0]));
+    }
+}
@@ -6,33 +6,16 @@
 #include <SDL3/SDL_pixels.h>
 #include <SDL3/SDL_render.h>
 
-// An 8 bit monochrome palette, this is required when the surface is 8 bit too (SDL_PIXELFORMAT_INDEX8)
-static SDL_Palette * sdl_palette_monochrome_new() {
-
-    SDL_Palette *palette = SDL_CreatePalette(256);
-    SDL_Color colors[256];
-
-    memset(colors, 0x00, sizeof(colors)); // every other color than white is black
-    memset(colors + 255, 0xff, sizeof(colors[0])); // this is white
-
-    SDL_SetPaletteColors(palette, colors, 0, 256);
-    return palette;
-}
-
-static void sdl_palette_monochrome_free(SDL_Palette *palette) {
-    SDL_DestroyPalette(palette);
-}
-
+#include <screen.h>
+#include <bit_utility.h>
 
 typedef struct {
     SDL_Window   *window;
     SDL_Renderer *renderer;
-    SDL_Surface  *surface; // 8 bit surface
-    SDL_Palette  *palette; // a custom palette required to use 8 bit depth
+    SDL_Texture  *texture; // streaming ARGB8888, the framebuffer is expanded straight into it
 
-    SDL_Texture  *texture;
-
-    uint16_t width, height;
+    uint16_t width, height;   // of the texture: the hi-res screen
+    uint16_t view_w, view_h;  // the part of it shown, the lo-res screen is its top left corner (screen.h)
     uint8_t scale;
 } sdl_t;
 
@@ -43,8 +26,8 @@ sdl_t * sdl_new(const char *title, uint16_t width, uint16_t height, uint8_t scal
     sdl_t *self = calloc(1, sizeof(sdl_t));
     assert(self);
 
-    self->width  = width;
-    self->height = height;
+    self->width  = self->view_w = width;
+    self->height = self->view_h = height;
     self->scale  = scale;
 
     self->window = SDL_CreateWindow(
@@ -69,32 +52,6 @@ sdl_t * sdl_new(const char *title, uint16_t width, uint16_t height, uint8_t scal
     SDL_SetRenderScale(self->renderer, self->scale, self->scale);
     //SDL_SetRenderVSync(self->renderer, SDL_RENDERER_VSYNC_ADAPTIVE); // sync with display HZ
 
-    self->surface = SDL_CreateSurface(
-        self->width,
-        self->height,
-        SDL_PIXELFORMAT_INDEX8
-    );
-
-    if (!self->surface) {
-        SDL_DestroyRenderer(self->renderer);
-        SDL_DestroyWindow(self->window);
-        free(self);
-        return NULL;
-    }
-
-
-    if (!(self->palette = sdl_palette_monochrome_new())) {
-        SDL_DestroySurface(self->surface);
-        SDL_DestroyRenderer(self->renderer);
-        SDL_DestroyWindow(self->window);
-        free(self);
-        return NULL;
-    }
-
-    // (int) Returns 0 on success or a negative error code on failure; call SDL_GetError() for more information.
-    SDL_SetSurfacePalette(self->surface, self->palette);
-
-    // a dummy texture
     self->texture = SDL_CreateTexture(
         self->renderer,
         SDL_PIXELFORMAT_ARGB8888,
@@ -103,8 +60,6 @@ sdl_t * sdl_new(const char *title, uint16_t width, uint16_t height, uint8_t scal
     );
 
     if (!self->texture) {
-        sdl_palette_monochrome_free(self->palette);
-        SDL_DestroySurface(self->surface);
         SDL_DestroyRenderer(self->renderer);
         SDL_DestroyWindow(self->window);
         free(self);
@@ -115,35 +70,66 @@ sdl_t * sdl_new(const char *title, uint16_t width, uint16_t height, uint8_t scal
     return self;
 }
 
-// chip_screen must be an aligned 32 pointer pointing to (width*height) bytes
-void sdl_sync_fb(sdl_t *self, void *chip_screen) {
+/*
+ planes are the bit-packed framebuffers: height rows of SCREEN_WORDS uint64_t each (see screen.h), planes_used says which
+ of them were ever drawn (chip8_t::planes_used): plane 0 alone is black and white, more go through screen_palette[].
+ Only the rows between the first and the last set in dirty_rows are uploaded.
+ A change of resolution changes only the part of the texture shown, nothing is created again.
+ planes isn't const: C11 doesn't turn a pointer to an array into a pointer to a const array by itself.
+*/
+void sdl_sync_fb(sdl_t *self, uint64_t (*planes)[SCREEN_HEIGHT][SCREEN_WORDS], uint8_t planes_used, uint64_t dirty_rows, bool hires) {
+
+    assert(self->width == sizeof(planes[0][0]) * 8);
 
-    SDL_LockSurface(self->surface); // Copia il framebuffer dentro la surface
-    memcpy(__builtin_assume_aligned(self->surface->pixels, 32), chip_screen, self->width * self->height);
-    SDL_UnlockSurface(self->surface);
+    self->view_w = hires ? self->width  : SCREEN_LORES_WIDTH;
+    self->view_h = hires ? self->height : SCREEN_LORES_HEIGHT;
 
-    /*
-    // Scala il framebuffer ospitato dalla surface
-    SDL_Texture *texture = SDL_CreateTextureFromSurface(self->renderer, self->surface);
-    SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
-    */
+    dirty_rows &= SCREEN_ROWS(self->view_h);
+    if (!dirty_rows)
+        return;
+
+    const uint16_t first = __builtin_ctzll(dirty_rows);
+    const uint16_t last  = 63 - __builtin_clzll(dirty_rows);
+    assert(last < self->view_h);
+
+    const SDL_Rect rect = { .x = 0, .y = first, .w = self->view_w, .h = last - first + 1 };
+
+    void *pixels;
+    int pitch;
+
+    // no intermediate surface nor conversion, write the texture memory directly
+    if (!SDL_LockTexture(self->texture, &rect, &pixels, &pitch))
+        return;
+
+    for (uint16_t r = first; r <= last; ++r) {
+        for (uint16_t w = 0; w < self->view_w / 64; ++w) {
+
+            uint32_t *const dst = (uint32_t *)((uint8_t *)pixels + (r - first) * pitch) + w * 64;
+            if (LIKELY(planes_used == 1)) {
+                screen_row_to_argb8888(dst, planes[0][r][w]);
+                continue;
+            }
+
+            uint64_t word[SCREEN_PLANES];
+            for (uint8_t p = 0; p < SCREEN_PLANES; ++p)
+                word[p] = planes_used >> p & 1 ? planes[p][r][w] : 0;
+            screen_planes_to_argb8888(dst, word);
+        }
+    }
 
-    SDL_Surface *surf32 = SDL_ConvertSurface(self->surface, SDL_PIXELFORMAT_ARGB8888);
-    SDL_UpdateTexture(self->texture, NULL, surf32->pixels, surf32->pitch);
-    SDL_DestroySurface(surf32);
+    SDL_UnlockTexture(self->texture);
 }
 
 
 void sdl_render(sdl_t *self) {
+    const SDL_FRect view = { .x = 0, .y = 0, .w = self->view_w, .h = self->view_h };
     SDL_RenderClear(self->renderer);
-    SDL_RenderTexture(self->renderer, self->texture, NULL, NULL);
+    SDL_RenderTexture(self->renderer, self->texture, &view, NULL);
     SDL_RenderPresent(self->renderer);
 }
 
 
 void sdl_free(sdl_t *self) {
-    SDL_DestroySurface(self->surface);
-    sdl_palette_monochrome_free(self->palette);
     SDL_DestroyTexture(self->texture);
     SDL_DestroyRenderer(self->renderer);
     SDL_DestroyWindow(self->window);
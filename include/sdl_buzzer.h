@@ -2,20 +2,101 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_audio.h>
 
+#include <stdint.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+
+/*
+ The emulator buzzer to make beep(s).
+
+ SDL asks for the audio from its own thread (sdl_buzzer_callback()) exactly when the device needs it,
+ nothing is queued ahead so a beep starts and stops within one device buffer.
+ The tone is a phase accumulator walking a wavetable computed once in sdl_buzzer_new(): no trig in the callback.
+
+ The emulation thread only publishes sound_timer once per frame (sdl_buzzer_gate(), one atomic store):
+ the callback turns it into samples (1/60 s per unit) and counts them down itself, so the beep lasts what
+ the timer says to the sample even when the main loop is late, and it stops on its own if the main loop stalls.
+
+ XO-CHIP roms can replace the tone with their own 128 one bit samples played in loop (iF002, iFX3A): sdl_buzzer_pattern()
+ stores them before the gate, the same release store publishes both.
+*/
+
+#define BUZZER_FREQ      48000 // samples per second, mono
+#define BUZZER_TONE      220   // Hz
+#define BUZZER_VOLUME    0.25f
+#define BUZZER_TABLE_LEN 256   // the top 8 bits of the phase
+#define BUZZER_RAMP      64    // samples of fade in / out, no clicks at the edges of the gate
+#define BUZZER_CHUNK     256   // samples generated per SDL_PutAudioStreamData()
 
-// the emulator buzzer to make beep(s)
 typedef struct {
     SDL_AudioSpec spec;
     SDL_AudioStream *stream;
 
+    // written by sdl_buzzer_gate(): generation << 32 | samples of tone from now
+    _Atomic uint64_t gate;
+
+    // written by sdl_buzzer_pattern(), read with the gate: the pattern msb first and its phase increment, 0 -> the tone
+    _Atomic uint64_t pattern[2];
+    _Atomic uint32_t pattern_step;
+
+    // owned by the callback
     struct {
-        int current_sine_sample; // 0
-        float samples[512 / 4];
-        int minimum_audio; // freq float samples per second. Half of that.
+        uint64_t seen;      // last generation read
+        uint32_t left;      // samples of tone still to play
+        uint32_t phase;     // 0 .. 2^32 is a period
+        uint32_t step;      // phase increment per sample
+        uint32_t ramp;      // 0 .. BUZZER_RAMP, the gain follows the gate in BUZZER_RAMP samples
+        uint64_t wave[2];   // the pattern, 0 .. 2^32 of wave_phase walks its 128 bits
+        uint32_t wave_phase;
+        uint32_t wave_step; // 0 -> the tone of the table
     };
+
+    float table[BUZZER_TABLE_LEN];
 } sdl_buzzer_t;
 
+
+static void SDLCALL sdl_buzzer_callback(void *userdata, SDL_AudioStream *stream, int additional_amount, int total_amount) {
+
+    (void)total_amount;
+    sdl_buzzer_t *self = userdata;
+
+    const uint64_t gate = atomic_load_explicit(&self->gate, memory_order_acquire);
+    if (gate >> 32 != self->seen) {
+        self->seen      = gate >> 32;
+        self->left      = (uint32_t)gate;
+        self->wave[0]   = atomic_load_explicit(&self->pattern[0], memory_order_relaxed);
+        self->wave[1]   = atomic_load_explicit(&self->pattern[1], memory_order_relaxed);
+        self->wave_step = atomic_load_explicit(&self->pattern_step, memory_order_relaxed);
+    }
+
+    float chunk[BUZZER_CHUNK];
+    for (int samples = additional_amount / (int)sizeof(float); samples > 0; samples -= BUZZER_CHUNK) {
+
+        const int len = samples < BUZZER_CHUNK ? samples : BUZZER_CHUNK;
+        for (int i = 0; i < len; ++i) {
+
+            if (self->left) {
+                self->left--;
+                self->ramp += self->ramp < BUZZER_RAMP;
+            } else {
+                self->ramp -= self->ramp > 0;
+            }
+
+            float sample = self->table[self->phase >> 24];
+            if (self->wave_step) {
+                const uint32_t bit = self->wave_phase >> 25; // 0 .. 127
+                sample = (self->wave[bit >> 6] >> (63 - (bit & 63))) & 1 ? BUZZER_VOLUME : -BUZZER_VOLUME;
+                self->wave_phase += self->wave_step;
+            }
+
+            chunk[i] = self->ramp * (1.f / BUZZER_RAMP) * sample;
+            self->phase += self->step;
+        }
+
+        SDL_PutAudioStreamData(stream, chunk, len * sizeof(float));
+    }
+}
+
 sdl_buzzer_t * sdl_buzzer_new() {
 
     sdl_buzzer_t *self;
@@ -23,12 +104,19 @@ sdl_buzzer_t * sdl_buzzer_new() {
         return NULL;
 
     self->spec.format   = SDL_AUDIO_F32;
-    self->spec.channels = 2;
-    self->spec.freq     = 8000 / 4;
+    self->spec.channels = 1;
+    self->spec.freq     = BUZZER_FREQ;
+
+    self->step = (uint32_t)(((uint64_t)BUZZER_TONE << 32) / BUZZER_FREQ);
+    atomic_init(&self->gate, 0);
+    atomic_init(&self->pattern[0], 0);
+    atomic_init(&self->pattern[1], 0);
+    atomic_init(&self->pattern_step, 0);
 
-    self->minimum_audio = (self->spec.freq * sizeof(float)) / 2;
+    for (unsigned i = 0; i < BUZZER_TABLE_LEN; ++i)
+        self->table[i] = BUZZER_VOLUME * SDL_sinf(2 * SDL_PI_F * i / BUZZER_TABLE_LEN);
 
-    if (!(self->stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &self->spec, NULL, NULL))) {
+    if (!(self->stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &self->spec, sdl_buzzer_callback, self))) {
         free(self);
         return NULL;
     }
@@ -37,36 +125,31 @@ sdl_buzzer_t * sdl_buzzer_new() {
     return self;
 }
 
-// i copied this sample: https://github.com/libsdl-org/SDL/blob/main/examples/audio/02-simple-playback-callback/simple-playback-callback.c
-void sdl_buzzer_beep(sdl_buzzer_t *self) {
-
-    /* see if we need to feed the audio stream more data yet.
-       We're being lazy here, but if there's less than half a second queued, generate more.
-       A sine wave is unchanging audio--easy to stream--but for video games, you'll want
-       to generate significantly _less_ audio ahead of time! */
-    if (SDL_GetAudioStreamQueued(self->stream) < self->minimum_audio) {
+// once per frame from the emulation thread, after chip_tick(): the tone goes on for sound_timer 60 Hz ticks from now
+void sdl_buzzer_gate(sdl_buzzer_t *self, uint8_t sound_timer) {
 
-        /* this will feed 512 / 4 samples each frame until we get to our maximum. */
+    const uint64_t generation = (atomic_load_explicit(&self->gate, memory_order_relaxed) >> 32) + 1;
+    const uint32_t samples    = (uint32_t)sound_timer * BUZZER_FREQ / 60;
 
-        /* generate a 220Hz pure tone */
-        for (unsigned i = 0; i < SDL_arraysize(self->samples); i++) {
-            static const int freq = 220;
-            const float phase = self->current_sine_sample * freq / (float)self->spec.freq;
-            self->samples[i] = SDL_sinf(phase * 2 * SDL_PI_F);
-            self->current_sine_sample++;
-        }
+    atomic_store_explicit(&self->gate, generation << 32 | samples, memory_order_release);
+}
 
-        /* wrapping around to avoid floating-point errors */
-        self->current_sine_sample %= self->spec.freq;
+// once per frame before sdl_buzzer_gate() for a rom with an XO-CHIP audio pattern (chip8_t::audio): 4000 * 2^((pitch - 64) / 48) bits per second
+void sdl_buzzer_pattern(sdl_buzzer_t *self, const uint8_t pattern[16], uint8_t pitch) {
 
-        /* feed the new data to the stream. It will queue at the end, and trickle out as the hardware needs more data. */
-        SDL_PutAudioStreamData(self->stream, self->samples, sizeof(self->samples));
-    }
+    uint64_t wave[2] = {0};
+    for (uint8_t i = 0; i < 16; ++i)
+        wave[i / 8] = wave[i / 8] << 8 | pattern[i];
 
+    const float rate = 4000.f * SDL_powf(2.f, (pitch - 64) / 48.f);
 
+    atomic_store_explicit(&self->pattern[0], wave[0], memory_order_relaxed);
+    atomic_store_explicit(&self->pattern[1], wave[1], memory_order_relaxed);
+    atomic_store_explicit(&self->pattern_step, (uint32_t)(rate * (1u << 25) / BUZZER_FREQ), memory_order_relaxed);
 }
 
 void sdl_buzzer_free(sdl_buzzer_t *self) {
-    SDL_DestroyAudioStream(self->stream);
+    if (!self) return;
+    SDL_DestroyAudioStream(self->stream); // stops the callback
     free(self);
 }
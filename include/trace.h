@@ -0,0 +1,250 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <endian.h>
+#include <time.h>
+
+#include <bit_utility.h>
+
+/*
+ Binary trace of the executed instructions, only with -DCHIP_TRACE (cmake -DCHIP8_TRACE=ON): otherwise chip8.h doesn't
+ even include this file, same as profile.h.
+
+ With a chip_trace_t attached (chip->trace) every instruction of chip_exec() / chip_step() / chip_run() and every key
+ event becomes a record of 6 to TRACE_REC_MAX bytes: what changed since the record before, ~9 bytes for most instructions.
+ The emulation thread only encodes it into a lock-free single producer / single consumer byte ring, a background
+ thread drains the ring to the file: no lock, no syscall and no formatting in the hot path.
+ When the writer can't keep up the producer waits if the trace is lossless (chip8_headless, it has no real time to
+ keep), otherwise the records are dropped and the next one is marked TRACE_GAP and has all the registers.
+
+ The file is a trace_file_t followed by the records, everything little endian. A record:
+ - flags (TRACE_*)
+ - the cycles since the record before (chip->cycles before the instruction), as a leb128 varint
+ - pc and opcode, uint16_t each (for a TRACE_KEY the key and KEY_UP / KEY_DOWN)
+ - with TRACE_V a uint16_t mask of the V changed (bit r -> Vr), followed by their values from V0 up
+ - with TRACE_I the new I, uint16_t
+ src/trace_decode.c renders it as text with the mnemonics of dbg.h
+*/
+
+#define TRACE_RING    (1u << 24)  // bytes (16 MB, ~1.8M records), a power of 2
+#define TRACE_SLEEP   1000000     // ns, the writer naps when the ring is empty (the producer too when lossless and it's full)
+#define TRACE_REC_MAX 36          // bytes: flags, a 10 bytes varint, pc, opcode, mask, 16 V and I
+#define TRACE_MAGIC   "CH8T"
+#define TRACE_VERSION 2
+
+enum {
+    TRACE_GAP  = 1 << 0, // records were dropped before this one, the ring was full (TRACE_V and TRACE_I with everything)
+    TRACE_KEY  = 1 << 1, // not an instruction: pc is the key, opcode is KEY_UP / KEY_DOWN
+    TRACE_WAIT = 1 << 2, // the instruction left the chip waiting a key (iFX0A)
+    TRACE_V    = 1 << 3, // some V changed, the mask and their values follow
+    TRACE_I    = 1 << 4, // I changed, the new one follows
+};
+
+typedef struct {
+    char magic[4];    // TRACE_MAGIC
+    uint32_t version; // TRACE_VERSION
+    uint64_t cycles;  // chip->cycles when the trace started, what the cycles of the first record are added to
+    uint8_t V[16];    // the registers when the trace started, what the first record changes
+    uint16_t I;
+    uint8_t pad[6];
+} trace_file_t;
+
+_Static_assert(sizeof(trace_file_t) == 40, "padding in trace_file_t");
+
+typedef struct {
+
+    // the producer (emulation thread)
+    alignas(64) _Atomic uint64_t head;
+    uint64_t tail_cache; // last tail seen, reloaded only when the ring looks full
+    uint64_t dropped;
+    uint64_t cycle;      // of the last record in the ring
+    uint8_t V[16];       // after the last record in the ring, what the next one is compared with
+    uint16_t I;
+    bool gap;
+    bool lossless;       // wait the writer instead of dropping
+
+    // the consumer (writer thread)
+    alignas(64) _Atomic uint64_t tail;
+    _Atomic bool stop;
+    bool failed; // a fwrite() error, read after the join
+
+    alignas(64) uint8_t *ring;
+    FILE *file;
+    pthread_t writer;
+
+} chip_trace_t;
+
+
+static void * trace_writer(void *arg) {
+
+    chip_trace_t *const self = arg;
+    uint64_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+    for (;;) {
+
+        // read stop first: after it is seen, one more pass gets the last records
+        const bool stop = atomic_load_explicit(&self->stop, memory_order_acquire);
+        const uint64_t head = atomic_load_explicit(&self->head, memory_order_acquire);
+
+        while (tail != head) {
+            // till the end of the ring or the head, whichever comes first
+            const uint64_t from = tail & (TRACE_RING - 1);
+            const uint64_t len  = head - tail < TRACE_RING - from ? head - tail : TRACE_RING - from;
+
+            // after an error the ring is still drained, a lossless producer would wait forever otherwise
+            if (!self->failed && fwrite(self->ring + from, 1, len, self->file) != len)
+                self->failed = true;
+
+            tail += len;
+            atomic_store_explicit(&self->tail, tail, memory_order_release);
+        }
+
+        if (stop) break;
+        nanosleep(&(struct timespec){ .tv_nsec = TRACE_SLEEP }, NULL);
+    }
+
+    return NULL;
+}
+
+/*
+ start tracing into path (truncated) from the state of now: chip->cycles, chip->V, chip->I.
+ lossless: the emulation waits the writer instead of dropping records, never in a real time frontend
+*/
+chip_trace_t * chip_trace_new(const char *path, uint64_t cycles, const uint8_t *V, uint16_t I, bool lossless) {
+
+    chip_trace_t *self;
+    if (!(self = calloc(1, sizeof(chip_trace_t))))
+        return NULL;
+
+    if (!(self->ring = malloc(TRACE_RING)) || !(self->file = fopen(path, "wb")))
+        goto fail;
+
+    trace_file_t header = { .magic = TRACE_MAGIC, .version = htole32(TRACE_VERSION), .cycles = htole64(cycles), .I = htole16(I) };
+    memcpy(header.V, V, sizeof(header.V));
+    if (fwrite(&header, sizeof(header), 1, self->file) != 1)
+        goto fail;
+
+    self->cycle    = cycles;
+    self->I        = I;
+    self->lossless = lossless;
+    memcpy(self->V, V, sizeof(self->V));
+
+    atomic_init(&self->head, 0);
+    atomic_init(&self->tail, 0);
+    atomic_init(&self->stop, false);
+
+    if (pthread_create(&self->writer, NULL, trace_writer, self))
+        goto fail;
+
+    return self;
+
+fail:
+    if (self->file) fclose(self->file);
+    free(self->ring);
+    free(self);
+    return NULL;
+}
+
+// waits the writer to drain everything, false if the file is incomplete (write error). The dropped records are in self->dropped
+bool chip_trace_free(chip_trace_t *self) {
+
+    if (!self) return true;
+
+    atomic_store_explicit(&self->stop, true, memory_order_release);
+    pthread_join(self->writer, NULL);
+
+    const bool ok = !self->failed && !fclose(self->file);
+    free(self->ring);
+    free(self);
+    return ok;
+}
+
+static FORCED(inline) uint8_t * trace_put16(uint8_t *dst, uint16_t v) {
+    dst[0] = v;
+    dst[1] = v >> 8;
+    return dst + 2;
+}
+
+// encodes the record into the ring: the V and I it has are compared with the ones of the record before
+static FORCED(inline) void trace_push(chip_trace_t *self, uint8_t flags, uint64_t cycle, uint16_t pc, uint16_t opcode, const uint8_t *V, uint16_t I) {
+
+    const uint64_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+
+    // the worst case has to fit, not the size of this one
+    while (UNLIKELY(head + TRACE_REC_MAX - self->tail_cache > TRACE_RING)) {
+        self->tail_cache = atomic_load_explicit(&self->tail, memory_order_acquire);
+        if (head + TRACE_REC_MAX - self->tail_cache <= TRACE_RING)
+            break;
+
+        if (!self->lossless) {
+            self->dropped++;
+            self->gap = true;
+            return;
+        }
+
+        nanosleep(&(struct timespec){ .tv_nsec = TRACE_SLEEP }, NULL);
+    }
+
+    // after a gap the decoder has lost track of the registers: all of them
+    uint16_t mask = 0xffff;
+    if (LIKELY(!self->gap)) {
+        mask = 0;
+        for (uint8_t r = 0; r < 16; ++r)
+            mask |= (V[r] != self->V[r]) << r;
+    }
+
+    if (UNLIKELY(self->gap)) flags |= TRACE_GAP | TRACE_I;
+    if (mask)                flags |= TRACE_V;
+    if (I != self->I)        flags |= TRACE_I;
+
+    uint8_t rec[TRACE_REC_MAX], *p = rec;
+    *p++ = flags;
+
+    uint64_t delta = cycle - self->cycle;
+    do {
+        *p++ = (delta & 0x7f) | (delta > 0x7f) << 7;
+        delta >>= 7;
+    } while (delta);
+
+    p = trace_put16(p, pc);
+    p = trace_put16(p, opcode);
+
+    if (flags & TRACE_V) {
+        p = trace_put16(p, mask);
+        for (uint8_t r = 0; r < 16; ++r)
+            if (mask >> r & 1) *p++ = V[r];
+    }
+
+    if (flags & TRACE_I)
+        p = trace_put16(p, I);
+
+    // the record, in two pieces when it wraps around the end of the ring
+    const size_t len = p - rec, at = head & (TRACE_RING - 1);
+    if (LIKELY(at + len <= TRACE_RING))
+        memcpy(self->ring + at, rec, len);
+    else {
+        memcpy(self->ring + at, rec, TRACE_RING - at);
+        memcpy(self->ring, rec + (TRACE_RING - at), len - (TRACE_RING - at));
+    }
+
+    self->cycle = cycle;
+    self->I     = I;
+    self->gap   = false;
+    memcpy(self->V, V, sizeof(self->V));
+    atomic_store_explicit(&self->head, head + len, memory_order_release);
+}
+
+// after an instruction: V and I are the ones of the chip now
+void chip_trace_exec(chip_trace_t *self, uint64_t cycle, uint16_t pc, uint16_t opcode, const uint8_t *V, uint16_t I, bool awaiting) {
+    trace_push(self, awaiting ? TRACE_WAIT : 0, cycle, pc, opcode, V, I);
+}
+
+void chip_trace_key(chip_trace_t *self, uint64_t cycle, uint8_t key, uint8_t state, const uint8_t *V, uint16_t I) {
+    trace_push(self, TRACE_KEY, cycle, key, state, V, I);
+}
@@ -0,0 +1,399 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define stack_t signal_stack_t // the one of signal.h (sigaltstack()), not the chip stack of stack.h
+#include <signal.h>
+#undef stack_t
+
+#include <endian.h>
+#include <time.h>
+
+#include <chip8.h>
+#include <screen.h>
+#include <bit_utility.h>
+
+/*
+ Video export: every frame of the chip, 60 per second, into a file or a pipe to an encoder.
+
+ The emulation thread only copies the planes drawn (chip8_t::planes_used, 1 bpp, 1 KB each) into a lock-free single
+ producer / single consumer ring, the same one of trace.h. A background thread turns them into the format and writes
+ them out VIDEO_BATCH bytes at a time. When the ring is full the frame is dropped (never a wait, unless the video
+ is lossless: chip8_headless has no real time to keep) and the writer repeats the previous one in its place,
+ the video keeps its 60 frames per second.
+
+ The formats are always 128x64, a lo-res pixel is 2x2:
+ - y4m: YUV4MPEG2 gray (Cmono) with the luma of screen_palette[], what ffmpeg and most encoders read from a pipe
+ - raw: the same bytes without the headers, es. ffmpeg -f rawvideo -pix_fmt gray -s 128x64 -r 60 -i out.raw
+ - rle: a video_file_t followed by a record per frame: flags (hires | planes_used << 1), the size of the rest (uint16_t,
+   little endian) and the xor with the frame before of its planes as 1 bpp rows (SCREEN_PLANES x 64 rows x 16 bytes, msb
+   the leftmost pixel) run length encoded: a byte n < 128 is followed by n + 1 literal bytes, n >= 128 stands for
+   n - 127 zero bytes. An unchanged frame takes 35 bytes, chip8_video_decode turns the file into y4m
+*/
+
+#define VIDEO_RING    256         // frames (~1 MB, 4 seconds), a power of 2
+#define VIDEO_BATCH   (1u << 20)  // bytes, the writes of the writer
+#define VIDEO_SLEEP   2000000     // ns, the writer naps when the ring is empty (the producer too when lossless and it's full)
+#define VIDEO_FPS     60
+#define VIDEO_MAGIC   "CH8V"
+#define VIDEO_VERSION 1
+
+#define VIDEO_PIXELS  (SCREEN_WIDTH * SCREEN_HEIGHT)                       // bytes of a gray frame
+#define VIDEO_BITMAP  (SCREEN_PLANES * SCREEN_HEIGHT * SCREEN_WORDS * 8)   // bytes of the planes as 1 bpp rows
+#define VIDEO_RLE_MAX (VIDEO_BITMAP + VIDEO_BITMAP / 128 + 1)              // the longest encoding of a frame
+#define VIDEO_Y4M     "YUV4MPEG2 W128 H64 F60:1 Ip A1:1 Cmono\n"
+
+_Static_assert(SCREEN_WIDTH == 128 && SCREEN_HEIGHT == 64 && VIDEO_FPS == 60, "update VIDEO_Y4M");
+_Static_assert(VIDEO_RLE_MAX <= UINT16_MAX, "the size of a rle frame is an uint16_t");
+
+typedef enum {
+    VIDEO_FORMAT_Y4M,
+    VIDEO_FORMAT_RAW,
+    VIDEO_FORMAT_RLE,
+} video_format_t;
+
+typedef struct {
+    char magic[4];    // VIDEO_MAGIC
+    uint32_t version; // VIDEO_VERSION, this and the rest little endian
+    uint16_t width;   // SCREEN_WIDTH
+    uint16_t height;  // SCREEN_HEIGHT
+    uint16_t fps;     // VIDEO_FPS
+    uint8_t planes;   // SCREEN_PLANES
+    uint8_t pad;
+} video_file_t;
+
+_Static_assert(sizeof(video_file_t) == 16, "padding in video_file_t");
+
+typedef struct {
+    uint64_t plane[SCREEN_PLANES][SCREEN_HEIGHT][SCREEN_WORDS]; // only the ones in planes_used are meaningful
+    uint32_t frame;      // from the start of the video: the frames between this one and the one before were dropped
+    uint8_t planes_used;
+    bool hires;
+} video_frame_t;
+
+typedef struct {
+
+    // the producer (emulation thread)
+    alignas(64) _Atomic uint64_t head;
+    uint64_t tail_cache; // last tail seen, reloaded only when the ring looks full
+    uint64_t dropped;
+    uint32_t frame;      // the next one
+    bool lossless;
+
+    // the consumer (writer thread)
+    alignas(64) _Atomic uint64_t tail;
+    _Atomic bool stop;
+    bool failed;         // a write error, read after the join
+    uint32_t written;    // frames written, the repeated ones included
+    size_t batch_len;
+    uint8_t *batch;
+    video_frame_t last;  // repeated in place of the dropped frames
+    uint8_t bits[VIDEO_BITMAP]; // rle: the last frame as 1 bpp rows, what the next one is xor'ed with
+
+    alignas(64) video_frame_t *ring;
+    video_format_t format;
+    FILE *file;
+    bool pipe;
+    pthread_t writer;
+
+} video_t;
+
+
+// the screen of a frame as gray bytes, 128x64 also in lo-res
+void video_frame_gray(uint8_t *restrict dst, const video_frame_t *frame) {
+
+    uint8_t luma[1 << SCREEN_PLANES];
+    for (uint8_t i = 0; i < sizeof(luma); ++i) {
+        const uint32_t argb = screen_palette[i];
+        luma[i] = (77 * (argb >> 16 & 0xff) + 150 * (argb >> 8 & 0xff) + 29 * (argb & 0xff)) >> 8; // bt.601
+    }
+
+    const uint8_t shift = !frame->hires; // a lo-res pixel is 2x2
+    for (uint8_t r = 0; r < SCREEN_HEIGHT; ++r) {
+        for (uint8_t c = 0; c < SCREEN_WIDTH; ++c) {
+
+            uint8_t color = 0;
+            for (uint8_t p = 0; p < SCREEN_PLANES; ++p)
+                if (frame->planes_used >> p & 1)
+                    color |= SCREEN_PIXEL(frame->plane[p], r >> shift, c >> shift) << p;
+
+            *dst++ = luma[color];
+        }
+    }
+}
+
+// the planes of a frame as 1 bpp rows, the ones not used are 0
+static void video_frame_bits(uint8_t *dst, const video_frame_t *frame) {
+
+    for (uint8_t p = 0; p < SCREEN_PLANES; ++p) {
+        if (!(frame->planes_used >> p & 1)) {
+            memset(dst, 0x00, sizeof(frame->plane[p]));
+            dst += sizeof(frame->plane[p]);
+            continue;
+        }
+
+        for (uint8_t r = 0; r < SCREEN_HEIGHT; ++r) {
+            for (uint8_t w = 0; w < SCREEN_WORDS; ++w, dst += 8) {
+                const uint64_t be = htobe64(frame->plane[p][r][w]);
+                memcpy(dst, &be, 8);
+            }
+        }
+    }
+}
+
+static void video_bits_frame(video_frame_t *frame, const uint8_t *src) {
+
+    for (uint8_t p = 0; p < SCREEN_PLANES; ++p) {
+        for (uint8_t r = 0; r < SCREEN_HEIGHT; ++r) {
+            for (uint8_t w = 0; w < SCREEN_WORDS; ++w, src += 8) {
+                uint64_t be;
+                memcpy(&be, src, 8);
+                frame->plane[p][r][w] = be64toh(be);
+            }
+        }
+    }
+}
+
+// return the size of the encoding, at most VIDEO_RLE_MAX for VIDEO_BITMAP bytes
+static size_t video_rle(uint8_t *restrict dst, const uint8_t *restrict src, size_t len) {
+
+    size_t n = 0;
+    for (size_t i = 0; i < len; ) {
+
+        size_t run = 0;
+        while (i + run < len && run < 128 && !src[i + run])
+            ++run;
+
+        if (run > 1 || (run && i + run == len)) {
+            dst[n++] = 127 + run;
+            i += run;
+            continue;
+        }
+
+        // literals till two zeros in a row: a lone zero costs less inside them
+        size_t lit = 0;
+        while (i + lit < len && lit < 128 && (src[i + lit] || (i + lit + 1 < len && src[i + lit + 1])))
+            ++lit;
+
+        dst[n++] = lit - 1;
+        memcpy(dst + n, src + i, lit);
+        n += lit;
+        i += lit;
+    }
+
+    return n;
+}
+
+// false if src isn't the encoding of exactly len bytes
+static bool video_unrle(uint8_t *restrict dst, size_t len, const uint8_t *restrict src, size_t size) {
+
+    size_t n = 0;
+    for (size_t i = 0; i < size; ) {
+
+        const uint8_t ctl = src[i++];
+        const size_t run = ctl < 128 ? ctl + 1u : ctl - 127u;
+
+        if (n + run > len || (ctl < 128 && i + run > size))
+            return false;
+
+        if (ctl < 128) memcpy(dst + n, src + i, run), i += run;
+        else memset(dst + n, 0x00, run);
+        n += run;
+    }
+
+    return n == len;
+}
+
+static void video_flush(video_t *self) {
+
+    // after an error the frames are still drained, a lossless producer would wait forever otherwise
+    if (!self->failed && fwrite(self->batch, 1, self->batch_len, self->file) != self->batch_len)
+        self->failed = true;
+
+    self->batch_len = 0;
+}
+
+// the next len bytes of the batch, the batch is written out first if they don't fit
+static uint8_t * video_reserve(video_t *self, size_t len) {
+
+    assert(len <= VIDEO_BATCH);
+    if (self->batch_len + len > VIDEO_BATCH)
+        video_flush(self);
+
+    uint8_t *const dst = self->batch + self->batch_len;
+    self->batch_len += len;
+    return dst;
+}
+
+static void video_emit(video_t *self, const video_frame_t *frame) {
+
+    if (self->format == VIDEO_FORMAT_RLE) {
+
+        uint8_t bits[VIDEO_BITMAP];
+        video_frame_bits(bits, frame);
+        for (size_t i = 0; i < sizeof(bits); ++i) {
+            const uint8_t cur = bits[i];
+            bits[i] ^= self->bits[i];
+            self->bits[i] = cur;
+        }
+
+        uint8_t *const dst = video_reserve(self, 3 + VIDEO_RLE_MAX);
+        const size_t size = video_rle(dst + 3, bits, sizeof(bits));
+        dst[0] = frame->hires | frame->planes_used << 1;
+        dst[1] = size & 0xff;
+        dst[2] = size >> 8;
+        self->batch_len -= VIDEO_RLE_MAX - size; // only what was used
+        return;
+    }
+
+    if (self->format == VIDEO_FORMAT_Y4M)
+        memcpy(video_reserve(self, 6), "FRAME\n", 6);
+
+    video_frame_gray(video_reserve(self, VIDEO_PIXELS), frame);
+}
+
+static void * video_writer(void *arg) {
+
+    video_t *const self = arg;
+    uint64_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+    for (;;) {
+
+        // read stop first: after it is seen, one more pass gets the last frames
+        const bool stop = atomic_load_explicit(&self->stop, memory_order_acquire);
+        const uint64_t head = atomic_load_explicit(&self->head, memory_order_acquire);
+
+        for (; tail != head; atomic_store_explicit(&self->tail, ++tail, memory_order_release)) {
+
+            const video_frame_t *const frame = self->ring + (tail & (VIDEO_RING - 1));
+            for (; self->written < frame->frame; ++self->written) // the dropped ones
+                video_emit(self, &self->last);
+
+            video_emit(self, frame);
+            self->written++;
+            memcpy(&self->last, frame, sizeof(self->last));
+        }
+
+        if (stop) break;
+        nanosleep(&(struct timespec){ .tv_nsec = VIDEO_SLEEP }, NULL);
+    }
+
+    video_flush(self);
+    return NULL;
+}
+
+/*
+ Start a video: spec is [y4m:|raw:|rle:]path, without a format .raw is raw, .ch8v is rle and everything else y4m.
+ A path starting with | is a command which gets the video on its stdin (popen()), es. "|ffmpeg -i - out.mp4".
+ lossless: video_push() waits the writer instead of dropping a frame, never in a real time frontend
+*/
+video_t * video_new(const char *spec, bool lossless) {
+
+    static const char *const prefix[] = { [VIDEO_FORMAT_Y4M] = "y4m:", [VIDEO_FORMAT_RAW] = "raw:", [VIDEO_FORMAT_RLE] = "rle:" };
+
+    video_t *self;
+    if (!(self = calloc(1, sizeof(video_t))))
+        return NULL;
+
+    const char *path = spec, *ext = strrchr(spec, '.');
+    self->format = ext && !strcmp(ext, ".raw") ? VIDEO_FORMAT_RAW : ext && !strcmp(ext, ".ch8v") ? VIDEO_FORMAT_RLE : VIDEO_FORMAT_Y4M;
+
+    for (uint8_t f = 0; f < sizeof(prefix) / sizeof(*prefix); ++f) {
+        if (!strncmp(spec, prefix[f], strlen(prefix[f]))) {
+            self->format = f;
+            path = spec + strlen(prefix[f]);
+        }
+    }
+
+    // a pipe closed by the encoder is a write error, not a SIGPIPE killing the emulator
+    if ((self->pipe = *path == '|'))
+        signal(SIGPIPE, SIG_IGN);
+
+    self->lossless = lossless;
+    if (!(self->ring = malloc(sizeof(video_frame_t) * VIDEO_RING)) || !(self->batch = malloc(VIDEO_BATCH)))
+        goto fail;
+
+    if (!(self->file = self->pipe ? popen(path + 1, "w") : fopen(path, "wb")))
+        goto fail;
+
+    setvbuf(self->file, NULL, _IONBF, 0); // already in batches
+
+    if (self->format == VIDEO_FORMAT_Y4M)
+        memcpy(video_reserve(self, strlen(VIDEO_Y4M)), VIDEO_Y4M, strlen(VIDEO_Y4M));
+
+    if (self->format == VIDEO_FORMAT_RLE) {
+        const video_file_t header = {
+            .magic = VIDEO_MAGIC, .version = htole32(VIDEO_VERSION), .width = htole16(SCREEN_WIDTH),
+            .height = htole16(SCREEN_HEIGHT), .fps = htole16(VIDEO_FPS), .planes = SCREEN_PLANES
+        };
+        memcpy(video_reserve(self, sizeof(header)), &header, sizeof(header));
+    }
+
+    atomic_init(&self->head, 0);
+    atomic_init(&self->tail, 0);
+    atomic_init(&self->stop, false);
+
+    if (pthread_create(&self->writer, NULL, video_writer, self))
+        goto fail;
+
+    return self;
+
+fail:
+    if (self->file) self->pipe ? pclose(self->file) : fclose(self->file);
+    free(self->batch);
+    free(self->ring);
+    free(self);
+    return NULL;
+}
+
+// waits the writer to drain everything, false if the video is incomplete (a write error, the command failed). The dropped frames are in self->dropped
+bool video_free(video_t *self) {
+
+    if (!self) return true;
+
+    atomic_store_explicit(&self->stop, true, memory_order_release);
+    pthread_join(self->writer, NULL);
+
+    const bool ok = !(self->pipe ? pclose(self->file) : fclose(self->file)) && !self->failed;
+    free(self->batch);
+    free(self->ring);
+    free(self);
+    return ok;
+}
+
+// at the end of every frame (after chip_tick()): a copy of its screen goes to the writer
+void video_push(video_t *self, const chip8_t *chip) {
+
+    const uint64_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+    const uint32_t frame = self->frame++;
+
+    while (UNLIKELY(head - self->tail_cache == VIDEO_RING)) {
+        self->tail_cache = atomic_load_explicit(&self->tail, memory_order_acquire);
+        if (head - self->tail_cache < VIDEO_RING)
+            break;
+
+        if (!self->lossless) {
+            self->dropped++;
+            return;
+        }
+
+        nanosleep(&(struct timespec){ .tv_nsec = VIDEO_SLEEP }, NULL);
+    }
+
+    video_frame_t *const slot = self->ring + (head & (VIDEO_RING - 1));
+    for (uint8_t p = 0; p < SCREEN_PLANES; ++p)
+        if (chip->planes_used >> p & 1)
+            memcpy(slot->plane[p], chip->plane[p], sizeof(slot->plane[p]));
+
+    slot->frame       = frame;
+    slot->planes_used = chip->planes_used;
+    slot->hires       = chip->hires;
+    atomic_store_explicit(&self->head, head + 1, memory_order_release);
+}
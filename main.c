@@ -1,110 +1,418 @@
 #pragma ide diagnostic ignored "EndlessLoop"
 
-#define _DEFAULT_SOURCE // required by endianness functions like be16toh()
+#define _GNU_SOURCE // required by endianness functions like be16toh() and by pthread_setaffinity_np()
 
 //#define CHIP_DEBUG
 
 #include <chip8.h>
-#include <chronos.h>
+#include <scheduler.h>
+#include <savestate.h>
+#include <idle.h>
 #include <sdl.h>
+#include <handoff.h>
+#include <movie.h>
+#include <video.h>
 
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <getopt.h>
 #include <sdl_buzzer.h>
 
 
-bool sdl_remap_key(SDL_Scancode keycode, chip8_t *chip, keystate_t status) {
+// the hex keypad key of a keyboard key, false if it isn't one of them
+bool sdl_remap_key(SDL_Scancode keycode, keycodes_t *key) {
 
     switch (keycode) {
-        case SDL_SCANCODE_KP_0: case SDL_SCANCODE_0: chip_press_key(chip, HKEY_0, status); return true;
-        case SDL_SCANCODE_KP_1: case SDL_SCANCODE_1: chip_press_key(chip, HKEY_1, status); return true;
-        case SDL_SCANCODE_KP_2: case SDL_SCANCODE_2: chip_press_key(chip, HKEY_2, status); return true;
-        case SDL_SCANCODE_KP_3: case SDL_SCANCODE_3: chip_press_key(chip, HKEY_3, status); return true;
-        case SDL_SCANCODE_KP_4: case SDL_SCANCODE_4: chip_press_key(chip, HKEY_4, status); return true;
-        case SDL_SCANCODE_KP_5: case SDL_SCANCODE_5: chip_press_key(chip, HKEY_5, status); return true;
-        case SDL_SCANCODE_KP_6: case SDL_SCANCODE_6: chip_press_key(chip, HKEY_6, status); return true;
-        case SDL_SCANCODE_KP_7: case SDL_SCANCODE_7: chip_press_key(chip, HKEY_7, status); return true;
-        case SDL_SCANCODE_KP_8: case SDL_SCANCODE_8: chip_press_key(chip, HKEY_8, status); return true;
-        case SDL_SCANCODE_KP_9: case SDL_SCANCODE_9: chip_press_key(chip, HKEY_9, status); return true;
-        case SDL_SCANCODE_A: chip_press_key(chip, HKEY_A, status); return true;
-        case SDL_SCANCODE_B: chip_press_key(chip, HKEY_B, status); return true;
-        case SDL_SCANCODE_C: chip_press_key(chip, HKEY_C, status); return true;
-        case SDL_SCANCODE_D: chip_press_key(chip, HKEY_D, status); return true;
-        case SDL_SCANCODE_E: chip_press_key(chip, HKEY_E, status); return true;
-        case SDL_SCANCODE_F: chip_press_key(chip, HKEY_F, status); return true;
+        case SDL_SCANCODE_KP_0: case SDL_SCANCODE_0: *key = HKEY_0; return true;
+        case SDL_SCANCODE_KP_1: case SDL_SCANCODE_1: *key = HKEY_1; return true;
+        case SDL_SCANCODE_KP_2: case SDL_SCANCODE_2: *key = HKEY_2; return true;
+        case SDL_SCANCODE_KP_3: case SDL_SCANCODE_3: *key = HKEY_3; return true;
+        case SDL_SCANCODE_KP_4: case SDL_SCANCODE_4: *key = HKEY_4; return true;
+        case SDL_SCANCODE_KP_5: case SDL_SCANCODE_5: *key = HKEY_5; return true;
+        case SDL_SCANCODE_KP_6: case SDL_SCANCODE_6: *key = HKEY_6; return true;
+        case SDL_SCANCODE_KP_7: case SDL_SCANCODE_7: *key = HKEY_7; return true;
+        case SDL_SCANCODE_KP_8: case SDL_SCANCODE_8: *key = HKEY_8; return true;
+        case SDL_SCANCODE_KP_9: case SDL_SCANCODE_9: *key = HKEY_9; return true;
+        case SDL_SCANCODE_A: *key = HKEY_A; return true;
+        case SDL_SCANCODE_B: *key = HKEY_B; return true;
+        case SDL_SCANCODE_C: *key = HKEY_C; return true;
+        case SDL_SCANCODE_D: *key = HKEY_D; return true;
+        case SDL_SCANCODE_E: *key = HKEY_E; return true;
+        case SDL_SCANCODE_F: *key = HKEY_F; return true;
         default: break;
     }
 
     return false;
 }
 
+// the calling thread runs only on cpu, nothing when it's negative
+static void pin_thread(int cpu, const char *name) {
+
+    if (cpu < 0) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        fprintf(stderr, "cannot pin the %s thread on cpu %d\n", name, cpu);
+}
+
+/*
+ The emulation runs on its own thread, the main thread only polls the events and presents (sdl wants both there):
+ a present blocked by the compositor or the vsync doesn't slow down the chip, the two talk through handoff.h.
+ The emulation thread owns the chip, the rewind and the buzzer gate, the render thread owns sdl.
+*/
+typedef struct {
+    chip8_t *chip;
+    handoff_t *handoff;
+    sdl_buzzer_t *buzzer;
+    rewind_t *rewind;         // NULL -> no rewind
+    movie_t *movie;           // NULL -> no movie, recording or playing the keys
+    video_t *video;           // NULL -> no video, otherwise every frame goes there (dropped, never waited, if the writer is behind)
+    const char *state_path;
+    uint32_t ipf;
+    int cpu;                  // the emulation thread is pinned on it, -1 -> not pinned
+    uint32_t frame_event;     // the sdl user event which wakes the render thread up on a new frame
+    _Atomic bool stop;
+    sched_t sched;            // read after the join
+} emu_t;
+
+// a movie is a single run from the first frame: going back in time would break it
+static bool emu_movie_busy(const movie_t *movie, const char *what) {
+
+    if (!movie || (movie->status != MOVIE_RECORDING && movie->status != MOVIE_PLAYING))
+        return false;
+
+    fprintf(stderr, "cannot %s while %s a movie\n", what, movie->status == MOVIE_RECORDING ? "recording" : "playing");
+    return true;
+}
+
+static void * emu_thread(void *arg) {
+
+    emu_t *const self = arg;
+    chip8_t *const chip = self->chip;
+    movie_t *const movie = self->movie;
+    bool rewinding = false;
+
+    pin_thread(self->cpu, "emulation");
+    sched_init(&self->sched, self->ipf, SCHED_HZ, SCHED_MAX_CATCHUP);
+    chip->screen_dirty = ~0ull; // the first frame is shown whole
+
+    for (uint32_t due = 1; !atomic_load_explicit(&self->stop, memory_order_relaxed); due = sched_wait(&self->sched)) {
+
+        // once per frame
+        for (handoff_event_t ev; handoff_pop(self->handoff, &ev); ) {
+            switch (ev.type) {
+                case HANDOFF_KEY:
+                    if (!movie) chip_press_key(chip, ev.key, ev.status);
+                    else if (movie->status != MOVIE_PLAYING) movie_press(movie, chip, ev.key, ev.status); // the replay has its own
+                    continue;
+                case HANDOFF_REWIND:
+                    rewinding = self->rewind && ev.status == KEY_DOWN && !emu_movie_busy(movie, "rewind");
+                    continue;
+                case HANDOFF_SAVE:
+                    if (!chip_save_state(chip, self->state_path)) fprintf(stderr, "cannot save the state \"%s\"\n", self->state_path);
+                    continue;
+                case HANDOFF_LOAD:
+                    if (emu_movie_busy(movie, "load a state")) continue;
+                    if (!chip_load_state(chip, self->state_path)) fprintf(stderr, "cannot load the state \"%s\"\n", self->state_path);
+                    else if (self->rewind) rewind_clear(self->rewind);
+                    continue;
+            }
+        }
+
+        // more than one frame only when catching up
+        for (; due; --due) {
+
+            // a frame back instead of forward, till the oldest one kept
+            if (rewinding) {
+                rewind_back(self->rewind, chip, rewind_frames(self->rewind) ? 1 : 0);
+                if (self->video) video_push(self->video, chip);
+                continue;
+            }
+
+            if (movie) movie_frame(movie, chip);
+
+            // iFX0A or an idle loop (idle.h): the rest of the frame is spent sleeping in sched_wait()
+            idle_run(chip, self->sched.ipf);
+
+#ifdef CHIP_DEBUG
+            char keys[BYTE_DUMP_LEN(sizeof(chip->keypad))];
+            printf("%s\n", byte_dump(keys, chip->keypad, sizeof(chip->keypad)));
+#endif
+
+            // with QUIRK_DISPLAY_WAIT (the chip8 profile) a draw already ended the frame in chip_run()
+            chip_tick(chip);
+            if (movie) {
+                const bool playing = movie->status == MOVIE_PLAYING;
+                movie_tick(movie, chip);
+                if (playing && movie->status != MOVIE_PLAYING)
+                    printf("the replay is over %s, the keys are yours\n", movie->status == MOVIE_SYNC ? "in sync" : "out of sync");
+            }
+
+            if (chip->audio.loaded) sdl_buzzer_pattern(self->buzzer, chip->audio.pattern, chip->audio.pitch); // XO-CHIP
+            sdl_buzzer_gate(self->buzzer, chip->sound_timer); // the audio thread plays it (sdl_buzzer.h)
+            if (self->rewind) rewind_push(self->rewind, chip);
+            if (self->video) video_push(self->video, chip);
+        }
+
+        // at most a frame every frame, and only when something changed. A wake up is pushed only when the
+        // render thread took the previous frame, a slow one has at most an event in its queue
+        if (chip->screen_dirty) {
+            if (handoff_publish(self->handoff, chip))
+                SDL_PushEvent(&(SDL_Event){ .user = { .type = self->frame_event } });
+            chip->screen_dirty = 0;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ The events the handoff queue had no room for (the emulation thread is behind), pushed again in order before the newer
+ ones: a lost release would leave the key down for the rom. When these are full too a press is dropped with its release
+*/
+#define PENDING_RETRY_MS 16 // the render thread polls at a frame rate while some are pending, a still screen has no wake ups
+#define PENDING_KEYS     17 // the 16 keys and the rewind, each one held once at most: the room kept for their releases
+
+typedef struct {
+    handoff_event_t event[HANDOFF_EVENTS + PENDING_KEYS];
+    uint32_t dropped; // the presses dropped (bit key, bit 16 the rewind), their releases go too
+    uint8_t len;
+} pending_t;
+
+static void pending_flush(pending_t *self, handoff_t *handoff) {
+
+    uint8_t sent = 0;
+    while (sent < self->len && handoff_push(handoff, self->event[sent]))
+        ++sent;
+
+    memmove(self->event, self->event + sent, (self->len - sent) * sizeof(handoff_event_t));
+    self->len -= sent;
+}
+
+static void pending_push(pending_t *self, handoff_t *handoff, handoff_event_t ev) {
+
+    const uint32_t bit = ev.type == HANDOFF_KEY ? 1u << ev.key : ev.type == HANDOFF_REWIND ? 1u << 16 : 0;
+    const bool release = bit && ev.status == KEY_UP;
+
+    if (release && (self->dropped & bit)) {
+        self->dropped &= ~bit;
+        return;
+    }
+
+    if (!self->len && handoff_push(handoff, ev))
+        return;
+
+    // the presses (F5 and F9 too) only while there is room, the releases always: no press gets in once it's full
+    if (!release && self->len >= HANDOFF_EVENTS) {
+        self->dropped |= bit;
+        return;
+    }
+
+    assert(self->len < HANDOFF_EVENTS + PENDING_KEYS);
+    self->event[self->len++] = ev;
+}
+
 int main(int argc, char *argv[]) {
 
-    if (argc < 2) {
-        fprintf(stderr, "usage: %s /path/your-rom.ch8\n", argv[0]);
+    const char *record_path = NULL, *replay_path = NULL, *video_spec = NULL;
+    bool usage = false;
+
+    static const struct option long_opts[] = { { "record", required_argument, NULL, 'V' }, {0} };
+
+    for (int opt; (opt = getopt_long(argc, argv, "M:m:V:", long_opts, NULL)) != -1; ) {
+        switch (opt) {
+            case 'M': record_path = optarg; break;
+            case 'm': replay_path = optarg; break;
+            case 'V': video_spec  = optarg; break;
+            default: usage = true;
+        }
+    }
+
+    // the positional arguments
+    const int args = argc - optind;
+    char **const arg = argv + optind;
+
+    if (usage || args < 1 || (record_path && replay_path)) {
+        fprintf(stderr,
+            "usage: %s [-M movie | -m movie] [-V | --record [y4m:|raw:|rle:]video] /path/your-rom.ch8 [instructions-per-frame (default %d) [quirks: default, chip8, schip or xochip [emulation-cpu,render-cpu]]]\n"
+            "  -M  record the keys into this movie, -m play it back (its seed, ipf and quirks win), see chip8_headless -m\n"
+            "  -V  every frame into this video, \"|command\" pipes it to an encoder es. \"|ffmpeg -i - out.mp4\" (see include/video.h)\n"
+            "  F5 save the state in /path/your-rom.ch8.state, F9 load it, hold backspace to rewind\n",
+            argv[0], SCHED_IPF
+        );
         return EXIT_FAILURE;
     }
 
-    printf("loading rom: \"%s\"\n", argv[1]);
+    uint32_t ipf = args > 1 ? strtoul(arg[1], NULL, 10) : SCHED_IPF;
+    if (!ipf) {
+        fprintf(stderr, "invalid instructions per frame: \"%s\"\n", arg[1]);
+        return EXIT_FAILURE;
+    }
+
+    chip_quirks_t quirks = args > 2 ? chip_quirks_parse(arg[2]) : CHIP_QUIRKS_DEFAULT;
+    if (quirks == CHIP_QUIRKS_LEN) {
+        fprintf(stderr, "unknown quirk profile: \"%s\"\n", arg[2]);
+        return EXIT_FAILURE;
+    }
+
+    // es. 2,3: the emulation on the cpu 2, the render on the cpu 3
+    int emu_cpu = -1, render_cpu = -1;
+    if (args > 3 && (sscanf(arg[3], "%d,%d", &emu_cpu, &render_cpu) != 2 || emu_cpu < 0 || render_cpu < 0)) {
+        fprintf(stderr, "invalid cpus: \"%s\"\n", arg[3]);
+        return EXIT_FAILURE;
+    }
+
+    movie_t *movie = NULL;
+    uint64_t seed = time(0);
+
+    if (replay_path) {
+        if (!(movie = movie_replay(replay_path))) {
+            fprintf(stderr, "\"%s\" is not a valid movie\n", replay_path);
+            return EXIT_FAILURE;
+        }
+        ipf    = movie->header.ipf;
+        quirks = movie->header.quirks;
+        seed   = movie->header.seed;
+    }
+
+    printf("loading rom: \"%s\"\n", arg[0]);
 
-    srand(time(0));
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
-    sdl_t *sdl = sdl_new("chip8 emulator", SCREEN_WIDTH, SCREEN_HEIGHT, 10);
+    sdl_t *sdl = sdl_new("chip8 emulator", SCREEN_WIDTH, SCREEN_HEIGHT, 5); // 640x320, the lo-res screen too
     sdl_buzzer_t *buzzer = sdl_buzzer_new();
 
-    chip8_t *chip = chip_new();
-    if (!chip_load_rom(chip, argv[1]))
+    char state_path[4096];
+    snprintf(state_path, sizeof(state_path), "%s.state", arg[0]);
+
+    handoff_t *handoff = aligned_alloc(alignof(handoff_t), sizeof(handoff_t));
+    assert(handoff);
+    handoff_init(handoff);
+
+    emu_t emu = {
+        .chip        = chip_new(),
+        .handoff     = handoff,
+        .buzzer      = buzzer,
+        .rewind      = rewind_new(REWIND_FRAMES, REWIND_BYTES),
+        .state_path  = state_path,
+        .ipf         = ipf,
+        .cpu         = emu_cpu,
+        .frame_event = SDL_RegisterEvents(1),
+    };
+
+    atomic_init(&emu.stop, false);
+    pthread_t emu_tid;
+    bool started = false;
+
+    chip8_t *chip = emu.chip;
+    if (!chip_set_quirks(chip, quirks) || !chip_load_rom(chip, arg[0]))
         goto die;
 
-    SDL_Event event;
-
-    chronos_t timer60hz;
-    chronos_start(&timer60hz);
-
-    while (1) {
-
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-				case SDL_EVENT_QUIT: goto die;
-				case SDL_EVENT_KEY_DOWN:
-                    if (event.key.repeat) continue;
-					sdl_remap_key(event.key.scancode, chip, KEY_DOWN);
-					continue;
-				case SDL_EVENT_KEY_UP:
-                    if (event.key.repeat) continue;
-					sdl_remap_key(event.key.scancode, chip, KEY_UP);
-					continue;
-			}
-        }
+    chip_seed(chip, seed);
 
-        //dbg("PC: %#04x ", chip->PC);
-        chip_exec(chip, chip_fetch(chip, chip->PC));
-        sdl_sync_fb(sdl, chip->screen);
-        sdl_render(sdl);
+    if (record_path && !(movie = movie_record(record_path))) {
+        fprintf(stderr, "cannot write the movie \"%s\"\n", record_path);
+        goto die;
+    }
 
-#ifdef CHIP_DEBUG
-        printf("%s\n", byte_dump(chip->keypad, sizeof(chip->keypad)));
-#endif
+    if (movie && !movie_start(movie, chip, ipf, seed)) {
+        if (replay_path) fprintf(stderr, "the movie \"%s\" wasn't recorded from this rom\n", replay_path);
+        else fprintf(stderr, "cannot write the movie \"%s\"\n", record_path);
+        goto die;
+    }
 
-        // TODO: fix display waiting OFF quirk
-        if (chronos_elapsed(&timer60hz) > 16.6) {
-            chip_tick(chip);
-            if (chip->sound_timer) sdl_buzzer_beep(buzzer);
-            chronos_restart(&timer60hz);
+    emu.movie = movie;
+
+    if (video_spec && !(emu.video = video_new(video_spec, false))) {
+        fprintf(stderr, "cannot write the video \"%s\"\n", video_spec);
+        goto die;
+    }
+
+    if (!emu.frame_event || pthread_create(&emu_tid, NULL, emu_thread, &emu)) {
+        fprintf(stderr, "cannot start the emulation thread\n");
+        goto die;
+    }
+
+    started = true;
+    pin_thread(render_cpu, "render");
+
+    pending_t pending = {0};
+
+    // sleeps till an event: a key, the window or a new frame (emu_thread())
+    for (SDL_Event event;; ) {
+
+        pending_flush(&pending, handoff);
+        if (!(pending.len ? SDL_WaitEventTimeout(&event, PENDING_RETRY_MS) : SDL_WaitEvent(&event))) {
+            if (pending.len) continue; // timed out, the queue is tried again
+            break;
+        }
+
+        keycodes_t key;
+
+        switch (event.type) {
+            case SDL_EVENT_QUIT: goto die;
+            case SDL_EVENT_KEY_DOWN:
+            case SDL_EVENT_KEY_UP: {
+                if (event.key.repeat) continue;
+                const keystate_t status = event.type == SDL_EVENT_KEY_DOWN ? KEY_DOWN : KEY_UP;
+                switch (event.key.scancode) {
+                    case SDL_SCANCODE_BACKSPACE: pending_push(&pending, handoff, (handoff_event_t){ .type = HANDOFF_REWIND, .status = status }); continue;
+                    case SDL_SCANCODE_F5: if (status == KEY_DOWN) pending_push(&pending, handoff, (handoff_event_t){ .type = HANDOFF_SAVE }); continue;
+                    case SDL_SCANCODE_F9: if (status == KEY_DOWN) pending_push(&pending, handoff, (handoff_event_t){ .type = HANDOFF_LOAD }); continue;
+                    default: break;
+                }
+                if (sdl_remap_key(event.key.scancode, &key))
+                    pending_push(&pending, handoff, (handoff_event_t){ .type = HANDOFF_KEY, .key = key, .status = status });
+                continue;
+            }
+            case SDL_EVENT_WINDOW_EXPOSED:
+                sdl_render(sdl); // the texture still has the last frame
+                continue;
+            default:
+                if (event.type != emu.frame_event) continue;
+                break;
         }
 
-        // SDL_DelayNS(.8f * 1.0e6); // 0.8ms
-        SDL_DelayNS(.35f * 1.0e6);
+        // the newest frame, NULL if it was already taken with an earlier wake up
+        const handoff_frame_t *frame = handoff_acquire(handoff);
+        if (!frame) continue;
+
+        sdl_sync_fb(sdl, (uint64_t (*)[SCREEN_HEIGHT][SCREEN_WORDS])frame->plane, frame->planes_used, frame->dirty, frame->hires);
+        sdl_render(sdl);
     }
 
 die:
+    if (started) {
+        atomic_store_explicit(&emu.stop, true, memory_order_relaxed);
+        pthread_join(emu_tid, NULL);
+    }
+
+    printf("late frames: %llu dropped: %llu\n", (unsigned long long)emu.sched.late, (unsigned long long)emu.sched.dropped);
+
+    if (!movie_close(movie, chip))
+        fprintf(stderr, "cannot write the movie \"%s\"\n", record_path ? record_path : replay_path);
+
+    if (emu.video && emu.video->dropped)
+        fprintf(stderr, "video: %llu frames dropped (repeated), the writer was behind\n", (unsigned long long)emu.video->dropped);
+
+    if (!video_free(emu.video))
+        fprintf(stderr, "cannot write the video \"%s\"\n", video_spec);
+
     // Close window and OpenGL context
+    rewind_free(emu.rewind);
     sdl_buzzer_free(buzzer);
     sdl_free(sdl);
     SDL_Quit();
     chip_free(chip);
+    free(handoff);
     return EXIT_SUCCESS;
 }
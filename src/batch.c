@@ -0,0 +1,260 @@
+#define _DEFAULT_SOURCE // required by endianness functions like be16toh()
+
+#include <chip8.h>
+#include <batch.h>
+#include <rompack.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [-t threads] [-i instructions-per-frame] [-q quirks] [-j | -l] [-n] [-p pack] jobs.txt\n"
+        "  -t  worker threads (default one per cpu)\n"
+        "  -i  instructions per frame, the timers tick once per frame (default %d)\n"
+        "  -q  quirk profile: default, chip8, schip or xochip (see include/quirks.h)\n"
+        "  -j  run through the jit\n"
+        "  -l  run the jobs with the same rom and cycles in lockstep, %d per vector\n"
+        "      (-j and -l only with the default quirks, the other jobs run in the interpreter)\n"
+        "  -n  don't fast forward the idle loops of the interpreter (same results, only slower)\n"
+        "  -p  the roms are names (or xxh64) in this rom pack (chip8_rompack), a rom with its own ipf or quirks ignores -i or -q\n"
+        "\n"
+        "one job per line: /path/rom.ch8 cycles [seed [frame:key:down|up,...]], '#' starts a comment.\n"
+        "one result per line on stdout, same order of the jobs:\n"
+        "  job ok cycles frames screen-hash PC I V bad rom\n"
+        "  bad    the first 0NNN or instruction which isn't one the rom executed, '-' if none\n",
+        argv0, HEADLESS_IPF, LOCKSTEP_LANES
+    );
+}
+
+typedef struct {
+    char *path;
+    batch_rom_t rom;
+} rom_entry_t;
+
+typedef struct {
+    rom_entry_t *roms;
+    size_t roms_len;
+
+    const rompack_t *pack; // optional
+    uint32_t *pack_slot;   // entry r of the pack is roms[pack_slot[r] - 1], 0 -> not loaded yet
+
+    batch_job_t *jobs;
+    uint32_t *rom_of; // jobs[i] runs roms[rom_of[i]], the rom pointers are fixed once every line is read
+    uint32_t jobs_len;
+} jobs_file_t;
+
+// every rom is read once no matter how many jobs use it, return its index or -1
+static long rom_intern(jobs_file_t *self, const char *path) {
+
+    const rompack_entry_t *packed = NULL;
+    if (self->pack) {
+        // no file at all: a lookup in the mapping and a copy
+        if (!(packed = rompack_lookup(self->pack, path)))
+            return -1;
+        if (self->pack_slot[packed - self->pack->roms])
+            return self->pack_slot[packed - self->pack->roms] - 1;
+    } else {
+        for (size_t i = 0; i < self->roms_len; ++i)
+            if (!strcmp(self->roms[i].path, path))
+                return i;
+    }
+
+    rom_entry_t *tmp;
+    if (!(tmp = realloc(self->roms, (self->roms_len + 1) * sizeof(rom_entry_t))))
+        return -1;
+
+    self->roms = tmp;
+    rom_entry_t *e = self->roms + self->roms_len;
+
+    if (packed) {
+        e->rom.size = rompack_size(packed);
+        e->rom.ipf    = le16toh(packed->ipf);
+        e->rom.quirks = packed->quirks;
+        memcpy(e->rom.data, rompack_data(self->pack, packed), e->rom.size);
+        self->pack_slot[packed - self->pack->roms] = self->roms_len + 1;
+    } else {
+        e->rom.ipf    = 0;
+        e->rom.quirks = CHIP_QUIRKS_DEFAULT;
+        if (!(e->rom.size = chip_read_rom(path, e->rom.data)))
+            return -1;
+    }
+
+    if (!(e->path = strdup(path)))
+        return -1;
+
+    return self->roms_len++;
+}
+
+static bool jobs_append(jobs_file_t *self, const batch_job_t *job, uint32_t rom) {
+
+    batch_job_t *jobs;
+    if (!(jobs = realloc(self->jobs, (self->jobs_len + 1) * sizeof(batch_job_t))))
+        return false;
+    self->jobs = jobs;
+
+    uint32_t *rom_of;
+    if (!(rom_of = realloc(self->rom_of, (self->jobs_len + 1) * sizeof(uint32_t))))
+        return false;
+    self->rom_of = rom_of;
+
+    self->jobs[self->jobs_len]     = *job;
+    self->rom_of[self->jobs_len++] = rom;
+    return true;
+}
+
+static bool jobs_read(jobs_file_t *self, const char *fpath) {
+
+    FILE *file;
+    if (!(file = fopen(fpath, "r"))) {
+        fprintf(stderr, "cannot open the jobs file \"%s\"\n", fpath);
+        return false;
+    }
+
+    bool ok = true;
+    char *line = NULL;
+    size_t line_cap = 0;
+
+    for (size_t lineno = 1; ok && getline(&line, &line_cap, file) != -1; ++lineno) {
+
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char *save;
+        const char *path = strtok_r(line, " \t\r\n", &save);
+        if (!path) continue;
+
+        const char *cycles = strtok_r(NULL, " \t\r\n", &save);
+        const char *seed   = strtok_r(NULL, " \t\r\n", &save);
+        const char *script = strtok_r(NULL, " \t\r\n", &save);
+
+        batch_job_t job = {
+            .max_cycles = cycles ? strtoull(cycles, NULL, 10) : 0,
+            .seed       = seed   ? strtoull(seed, NULL, 10)   : 0,
+        };
+
+        key_event_t *keys = NULL;
+        if (!job.max_cycles || (script && !keyscript_parse(script, &keys, &job.keys_len))) {
+            fprintf(stderr, "%s:%zu: malformed job\n", fpath, lineno);
+            ok = false;
+        } else {
+            const long rom = rom_intern(self, path);
+            if (rom < 0) fprintf(stderr, "%s:%zu: cannot load the rom \"%s\"\n", fpath, lineno, path);
+            job.keys = keys;
+            ok = rom >= 0 && jobs_append(self, &job, rom);
+        }
+
+        if (!ok) free(keys);
+    }
+
+    free(line);
+    fclose(file);
+
+    for (uint32_t i = 0; ok && i < self->jobs_len; ++i)
+        self->jobs[i].rom = &self->roms[self->rom_of[i]].rom;
+
+    return ok;
+}
+
+static void jobs_free(jobs_file_t *self) {
+
+    for (uint32_t i = 0; i < self->jobs_len; ++i)
+        free((void *)self->jobs[i].keys);
+
+    for (size_t i = 0; i < self->roms_len; ++i)
+        free(self->roms[i].path);
+
+    free(self->jobs);
+    free(self->rom_of);
+    free(self->roms);
+    free(self->pack_slot);
+}
+
+int main(int argc, char *argv[]) {
+
+    batch_opts_t opts = { .ipf = HEADLESS_IPF, .idle = true };
+    const char *pack_path = NULL;
+
+    for (int opt; (opt = getopt(argc, argv, "t:i:q:jlnp:")) != -1; ) {
+        switch (opt) {
+            case 't': opts.threads = strtoul(optarg, NULL, 10); break;
+            case 'i': opts.ipf     = strtoul(optarg, NULL, 10); break;
+            case 'j': opts.jit      = true; break;
+            case 'l': opts.lockstep = true; break;
+            case 'n': opts.idle     = false; break;
+            case 'p': pack_path     = optarg; break;
+            case 'q':
+                if ((opts.quirks = chip_quirks_parse(optarg)) == CHIP_QUIRKS_LEN) {
+                    fprintf(stderr, "unknown quirk profile: \"%s\"\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc || !opts.ipf || (opts.lockstep && opts.ipf > UINT16_MAX)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    jobs_file_t jf = {0};
+    rompack_t *pack = NULL;
+
+    if (pack_path && (!(pack = rompack_open(pack_path)) || !(jf.pack_slot = calloc(pack->roms_len + 1, sizeof(uint32_t))))) {
+        fprintf(stderr, "\"%s\" is not a valid rom pack\n", pack_path);
+        rompack_close(pack);
+        return EXIT_FAILURE;
+    }
+
+    jf.pack = pack;
+    const bool read = jobs_read(&jf, argv[optind]);
+    rompack_close(pack); // every rom is copied
+    jf.pack = NULL;
+
+    if (!read) {
+        jobs_free(&jf);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec beg, end;
+    clock_gettime(CLOCK_MONOTONIC, &beg);
+
+    if (!batch_run(jf.jobs, jf.jobs_len, &opts)) {
+        fprintf(stderr, "cannot setup the thread pool\n");
+        jobs_free(&jf);
+        return EXIT_FAILURE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds = (end.tv_sec - beg.tv_sec) + (end.tv_nsec - beg.tv_nsec) / 1.0e9;
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < jf.jobs_len; ++i) {
+        const batch_job_t *job = jf.jobs + i;
+        char V[BYTE_DUMP_LEN(sizeof(job->V))], bad[8] = "-";
+
+        if (job->bad) snprintf(bad, sizeof(bad), "%04x", job->bad_opcode);
+
+        total += job->result.cycles;
+        printf("%u %d %llu %u %016llx %#05x %#05x %s%s %s\n",
+            i, job->ok,
+            (unsigned long long)job->result.cycles, job->result.frames,
+            (unsigned long long)job->screen_hash, job->PC, job->I,
+            byte_dump(V, job->V, sizeof(job->V)), bad, jf.roms[jf.rom_of[i]].path
+        );
+    }
+
+    fprintf(stderr, "jobs: %u instructions: %llu seconds: %.3f ips: %.0f\n",
+        jf.jobs_len, (unsigned long long)total, seconds, seconds > 0 ? total / seconds : 0.
+    );
+
+    jobs_free(&jf);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,565 @@
+#define _DEFAULT_SOURCE // required by endianness functions like be16toh()
+
+#include <chip8.h>
+#include <batch.h>
+#include <bench_roms.h>
+
+#ifdef CHIP8_BENCH_SDL
+#include <sdl.h>
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+/*
+ Four groups of numbers, one json on stdout:
+
+  opcodes     - every handler of chip8.h called in a loop on the same vm (chip_decode() picks the handler)
+  dispatch    - the cost of getting there: chip_decode(), chip_exec() (decode every time), chip_step() (icache),
+                chip_run() (threaded)
+  framebuffer - the bit-packed screen to ARGB8888, plus sdl_sync_fb() when built with SDL (offscreen/dummy driver)
+  roms        - whole roms (bench_roms.h + the ones on the command line) through the interpreter (with and without idle.h),
+                the jit and lockstep
+
+ Every time is the best of -r repetitions, ns_per_op is per instruction (per frame in framebuffer).
+*/
+
+#define BENCH_ITERS   (1 << 20) // per handler, per repetition
+#define BENCH_REPEAT  5
+#define BENCH_CYCLES  500000    // per rom instance, LOCKSTEP_LANES instances per engine
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [-q] [-r repeat] [-c cycles] [rom.ch8 ...]\n"
+        "  -q  quick run, 1/16 of the iterations (es. CI smoke test)\n"
+        "  -r  repetitions of every measure, the best one is reported (default %d)\n"
+        "  -c  instructions per rom instance, %d instances per engine (default %d)\n"
+        "\n"
+        "the roms on the command line are benchmarked after the bundled ones\n",
+        argv0, BENCH_REPEAT, LOCKSTEP_LANES, BENCH_CYCLES
+    );
+}
+
+typedef struct {
+    uint32_t iters;
+    uint32_t repeat;
+    uint64_t cycles;
+} bench_opts_t;
+
+static int64_t bench_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// items of a json array, the comma goes before every item but the first
+static void json_item(bool *first) {
+    printf(*first ? "\n" : ",\n");
+    *first = false;
+}
+
+static volatile uintptr_t bench_sink; // keeps alive results nobody reads
+
+static void bench_chip_reset(chip8_t *chip) {
+
+    chip_init(chip);
+    chip_seed(chip, 1);
+
+    for (uint8_t r = 0; r < REG_LEN; ++r)
+        chip->V[r] = r * 17;
+
+    chip->V[REG_V3] = 60; // x of the sprites crossing the borders
+    chip->V[REG_V4] = 28; // y
+
+    for (uint16_t a = 0x300; a < 0x320; ++a)
+        chip->memory[a] = a & 1 ? 0xA5 : 0x5A;
+
+    chip->I = 0x300;
+}
+
+/*
+ noclone: the handler must stay a runtime pointer, otherwise gcc specializes a copy of the loop
+ for every call site and inlines the handler (that's not what happens in chip_exec()).
+ I is restored every iteration: iFX55, iFX65, iFX1E move it
+*/
+static __attribute__((noinline, noclone)) int64_t bench_handler(chip8_t *chip, chip_handler_t exec, instr_t instr, uint32_t iters) {
+
+    const uint16_t I = chip->I;
+    const int64_t beg = bench_now();
+
+    for (uint32_t i = 0; i < iters; ++i) {
+        chip->I = I;
+        exec(chip, instr);
+    }
+
+    return bench_now() - beg;
+}
+
+static void bench_nop(chip8_t *chip, instr_t instr) {
+    (void)chip, (void)instr;
+}
+
+typedef struct {
+    const char *name;
+    uint16_t opcode;
+} bench_op_t;
+
+// 0NNN and unknown opcodes print something, they're left out. The /hires ones run on the SUPER-CHIP 128x64 screen,
+// the /xo ones with the XO-CHIP quirks and two planes selected
+static const bench_op_t bench_ops[] = {
+    { "i00E0",        0x00E0 },
+    { "i00EE",        0x00EE },
+    { "i1NNN",        0x1300 },
+    { "i2NNN",        0x2300 },
+    { "i3XNN",        0x3111 },
+    { "i4XNN",        0x4111 },
+    { "i5XY0",        0x5120 },
+    { "i6XNN",        0x6112 },
+    { "i7XNN",        0x7112 },
+    { "i8XY0",        0x8120 },
+    { "i8XY1",        0x8121 },
+    { "i8XY2",        0x8122 },
+    { "i8XY3",        0x8123 },
+    { "i8XY4",        0x8124 },
+    { "i8XY5",        0x8125 },
+    { "i8XY6",        0x8126 },
+    { "i8XY7",        0x8127 },
+    { "i8XYE",        0x812E },
+    { "i9XY0",        0x9120 },
+    { "iANNN",        0xA300 },
+    { "iBNNN",        0xB300 },
+    { "iCXNN",        0xC1FF },
+    { "iDXYN",        0xD125 }, // a font glyph
+    { "iDXYN/15",     0xD12F }, // tallest sprite
+    { "iDXYN/border", 0xD34F }, // clipped on the right and the bottom
+    { "iEX9E",        0xE19E },
+    { "iEXA1",        0xE1A1 },
+    { "iFX07",        0xF107 },
+    { "iFX0A",        0xF10A },
+    { "iFX15",        0xF115 },
+    { "iFX18",        0xF118 },
+    { "iFX1E",        0xF11E },
+    { "iFX29",        0xF129 },
+    { "iFX33",        0xF133 },
+    { "iFX55",        0xFF55 }, // every register
+    { "iFX65",        0xFF65 },
+    { "i00CN",        0x00C4 },
+    { "i00CN/hires",  0x00C4 }, // the whole 1 KB framebuffer moves
+    { "i00FB",        0x00FB },
+    { "i00FB/hires",  0x00FB },
+    { "i00FC/hires",  0x00FC },
+    { "i00FF",        0x00FF }, // hi-res, the screen is cleared
+    { "iDXY0",        0xD120 },
+    { "iDXY0/hires",  0xD3A0 }, // across the two words of the rows
+    { "iFX30",        0xF130 },
+    { "iFX75",        0xF775 },
+    { "iFX85",        0xF785 },
+    { "i00DN",        0x00D4 },
+    { "i00DN/xo/hires", 0x00D4 }, // both planes move
+    { "i5XY2/xo",     0x51E2 },
+    { "i5XY3/xo",     0x51E3 },
+    { "iF000/xo",     0xF000 },
+    { "iFN01/xo",     0xF301 },
+    { "iF002",        0xF002 },
+    { "iFX3A",        0xF13A },
+    { "iDXYN/xo",     0xD125 },
+    { "iDXY0/xo/hires", 0xD3A0 }, // 2 planes of 16x16 across the two words of the rows
+};
+
+static void bench_opcodes(chip8_t *chip, const bench_opts_t *opts) {
+
+    bool first = true;
+    printf("  \"opcodes\": [");
+
+    for (size_t o = 0; o <= sizeof(bench_ops) / sizeof(bench_ops[0]); ++o) {
+
+        // the last one is the loop itself: subtract it to get the handler alone
+        const bool nop = o == sizeof(bench_ops) / sizeof(bench_ops[0]);
+        const instr_t instr = { .data = nop ? 0x0000 : bench_ops[o].opcode };
+        const bool xo = !nop && strstr(bench_ops[o].name, "/xo");
+        const chip_handler_t exec = nop ? bench_nop : chip_decode_quirks(instr, xo ? CHIP_QUIRKS_XOCHIP : CHIP_QUIRKS_DEFAULT).exec;
+
+        int64_t best = INT64_MAX;
+        for (uint32_t r = 0; r < opts->repeat; ++r) {
+            bench_chip_reset(chip);
+            chip->hires = !nop && strstr(bench_ops[o].name, "/hires");
+            if (xo) {
+                chip_set_quirks(chip, CHIP_QUIRKS_XOCHIP);
+                chip->planes = chip->planes_used = 3;
+            }
+            const int64_t ns = bench_handler(chip, exec, instr, opts->iters);
+            if (ns < best) best = ns;
+        }
+
+        const double ns_per_op = (double)best / opts->iters;
+        json_item(&first);
+        printf("    { \"name\": \"%s\", \"opcode\": \"%04X\", \"ns_per_op\": %.3f, \"ips\": %.0f }",
+            nop ? "loop" : bench_ops[o].name, instr.data, ns_per_op, 1.0e9 / ns_per_op
+        );
+    }
+
+    printf("\n  ],\n");
+}
+
+// straight line code without jumps nor memory writes (only some skip), chip_exec() and chip_step() run the same instructions
+static const uint16_t bench_dispatch_code[] = {
+    0x6012, 0x7101, 0x8014, 0x8125, 0x8206, 0xA300, 0x3000, 0x4000,
+    0x8301, 0x8432, 0x8543, 0x860E, 0xF029, 0xF11E, 0x9120, 0x5230,
+    0x6755, 0x7801, 0x8784, 0x8987, 0xC90F, 0xF807, 0xE19E, 0xE2A1,
+    0xAA00, 0x8A03, 0x8B14, 0x8C25, 0x8DE6, 0x8E07, 0x8F0E, 0x7F01,
+};
+
+#define BENCH_DISPATCH_LEN (sizeof(bench_dispatch_code) / sizeof(bench_dispatch_code[0]))
+
+static __attribute__((noinline)) int64_t bench_decode(const instr_t *code, uint32_t iters) {
+
+    uintptr_t acc = 0;
+    const int64_t beg = bench_now();
+
+    for (uint32_t i = 0; i < iters; ++i)
+        acc ^= (uintptr_t)chip_decode(code[i % BENCH_DISPATCH_LEN]).exec;
+
+    const int64_t ns = bench_now() - beg;
+    bench_sink = acc;
+    return ns;
+}
+
+static __attribute__((noinline)) int64_t bench_exec(chip8_t *chip, const instr_t *code, uint32_t iters) {
+
+    const int64_t beg = bench_now();
+
+    for (uint32_t i = 0; i < iters; ++i)
+        chip_exec(chip, code[i % BENCH_DISPATCH_LEN]);
+
+    return bench_now() - beg;
+}
+
+static __attribute__((noinline)) int64_t bench_step(chip8_t *chip, uint32_t iters) {
+
+    const int64_t beg = bench_now();
+
+    // the skips may jump over the end of the code
+    for (uint32_t i = 0; i < iters; ++i) {
+        if (UNLIKELY(chip->PC >= 0x200 + sizeof(bench_dispatch_code))) chip->PC = 0x200;
+        chip_step(chip);
+    }
+
+    return bench_now() - beg;
+}
+
+// the code ends with a 1200 back to the beginning, chip_run() goes on through it like it does in the roms (no idle_run())
+static __attribute__((noinline)) int64_t bench_run(chip8_t *chip, uint32_t iters) {
+
+    const int64_t beg = bench_now();
+
+    for (uint32_t i = 0; i < iters; )
+        i += chip_run(chip, iters - i, NULL);
+
+    return bench_now() - beg;
+}
+
+static void bench_dispatch(chip8_t *chip, const bench_opts_t *opts) {
+
+    instr_t code[BENCH_DISPATCH_LEN];
+    uint8_t rom[sizeof(bench_dispatch_code) + sizeof(instr_t)];
+
+    for (size_t i = 0; i < BENCH_DISPATCH_LEN; ++i) {
+        code[i].data   = bench_dispatch_code[i];
+        rom[i * 2]     = bench_dispatch_code[i] >> 8;
+        rom[i * 2 + 1] = bench_dispatch_code[i] & 0xff;
+    }
+
+    rom[sizeof(rom) - 2] = 0x12; // 1200
+    rom[sizeof(rom) - 1] = 0x00;
+
+    const char *names[] = { "chip_decode", "chip_exec", "chip_step", "chip_run" };
+    int64_t best[4] = { INT64_MAX, INT64_MAX, INT64_MAX, INT64_MAX };
+
+    for (uint32_t r = 0; r < opts->repeat; ++r) {
+
+        int64_t ns = bench_decode(code, opts->iters);
+        if (ns < best[0]) best[0] = ns;
+
+        bench_chip_reset(chip);
+        ns = bench_exec(chip, code, opts->iters);
+        if (ns < best[1]) best[1] = ns;
+
+        bench_chip_reset(chip);
+        chip_load_rom_mem(chip, rom, sizeof(rom));
+        ns = bench_step(chip, opts->iters);
+        if (ns < best[2]) best[2] = ns;
+
+        bench_chip_reset(chip);
+        chip_load_rom_mem(chip, rom, sizeof(rom));
+        ns = bench_run(chip, opts->iters);
+        if (ns < best[3]) best[3] = ns;
+    }
+
+    bool first = true;
+    printf("  \"dispatch\": [");
+
+    for (int i = 0; i < 4; ++i) {
+        const double ns_per_op = (double)best[i] / opts->iters;
+        json_item(&first);
+        printf("    { \"name\": \"%s\", \"ns_per_op\": %.3f, \"ips\": %.0f }", names[i], ns_per_op, 1.0e9 / ns_per_op);
+    }
+
+    printf("\n  ],\n");
+}
+
+static void bench_fb_item(bool *first, const char *name, int64_t best, uint32_t frames) {
+    const double ns_per_frame = (double)best / frames;
+    json_item(first);
+    printf("    { \"name\": \"%s\", \"ns_per_op\": %.3f, \"fps\": %.0f }", name, ns_per_frame, 1.0e9 / ns_per_frame);
+}
+
+#ifdef CHIP8_BENCH_SDL
+
+// the texture upload of sdl_sync_fb() (every row / a single row) and the present of sdl_render(), no window shown
+static void bench_sdl(uint64_t (*planes)[SCREEN_HEIGHT][SCREEN_WORDS], const bench_opts_t *opts, bool *first) {
+
+    SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen,dummy");
+
+    if (!SDL_Init(SDL_INIT_VIDEO)) {
+        fprintf(stderr, "sdl_sync_fb skipped: %s\n", SDL_GetError());
+        return;
+    }
+
+    sdl_t *sdl;
+    if (!(sdl = sdl_new("chip8_bench", SCREEN_WIDTH, SCREEN_HEIGHT, 5))) {
+        fprintf(stderr, "sdl_sync_fb skipped: %s\n", SDL_GetError());
+        SDL_Quit();
+        return;
+    }
+
+    const uint32_t frames = opts->iters / 64 ? opts->iters / 64 : 1;
+    const uint64_t dirty[2] = { SCREEN_ROWS_ALL, 1ull << (SCREEN_HEIGHT / 2) };
+    int64_t best[3] = { INT64_MAX, INT64_MAX, INT64_MAX };
+
+    for (uint32_t r = 0; r < opts->repeat; ++r) {
+
+        for (int d = 0; d < 2; ++d) {
+            const int64_t beg = bench_now();
+            for (uint32_t f = 0; f < frames; ++f)
+                sdl_sync_fb(sdl, planes, 1, dirty[d], true);
+            const int64_t ns = bench_now() - beg;
+            if (ns < best[d]) best[d] = ns;
+        }
+
+        const int64_t beg = bench_now();
+        for (uint32_t f = 0; f < frames; ++f) {
+            sdl_sync_fb(sdl, planes, 1, dirty[0], true);
+            sdl_render(sdl);
+        }
+
+        const int64_t ns = bench_now() - beg;
+        if (ns < best[2]) best[2] = ns;
+    }
+
+    bench_fb_item(first, "sdl_sync_fb", best[0], frames);
+    bench_fb_item(first, "sdl_sync_fb/1row", best[1], frames);
+    bench_fb_item(first, "sdl_sync_fb+sdl_render", best[2], frames);
+
+    sdl_free(sdl);
+    free(sdl);
+    SDL_Quit();
+}
+
+#endif
+
+static void bench_framebuffer(const bench_opts_t *opts) {
+
+    alignas(32) uint64_t planes[SCREEN_PLANES][SCREEN_HEIGHT][SCREEN_WORDS];
+    uint64_t seed = 1;
+    for (uint8_t p = 0; p < SCREEN_PLANES; ++p)
+        for (uint16_t r = 0; r < SCREEN_HEIGHT; ++r)
+            for (uint8_t w = 0; w < SCREEN_WORDS; ++w)
+                planes[p][r][w] = splitmix64(&seed);
+
+    // what sdl_sync_fb() does into the locked texture, without sdl
+    uint32_t *pixels = aligned_alloc(64, sizeof(uint32_t) * SCREEN_WIDTH * SCREEN_HEIGHT);
+    assert(pixels);
+
+    const uint32_t frames = opts->iters / 64 ? opts->iters / 64 : 1;
+    int64_t best[2] = { INT64_MAX, INT64_MAX };
+
+    for (uint32_t r = 0; r < opts->repeat; ++r) {
+
+        // a single plane, then the 4 planes through the palette
+        for (int k = 0; k < 2; ++k) {
+            const int64_t beg = bench_now();
+
+            for (uint32_t f = 0; f < frames; ++f) {
+                for (uint16_t row = 0; row < SCREEN_HEIGHT; ++row) {
+                    for (uint8_t w = 0; w < SCREEN_WORDS; ++w) {
+                        uint32_t *const dst = pixels + row * SCREEN_WIDTH + w * 64;
+                        if (!k) {
+                            screen_row_to_argb8888(dst, planes[0][row][w]);
+                            continue;
+                        }
+                        uint64_t word[SCREEN_PLANES];
+                        for (uint8_t p = 0; p < SCREEN_PLANES; ++p)
+                            word[p] = planes[p][row][w];
+                        screen_planes_to_argb8888(dst, word);
+                    }
+                }
+                bench_sink = pixels[f % (SCREEN_WIDTH * SCREEN_HEIGHT)];
+            }
+
+            const int64_t ns = bench_now() - beg;
+            if (ns < best[k]) best[k] = ns;
+        }
+    }
+
+    bool first = true;
+    printf("  \"framebuffer\": [");
+    bench_fb_item(&first, "screen_row_to_argb8888", best[0], frames);
+    bench_fb_item(&first, "screen_planes_to_argb8888", best[1], frames);
+
+#ifdef CHIP8_BENCH_SDL
+    bench_sdl(planes, opts, &first);
+#endif
+
+    printf("\n  ],\n");
+    free(pixels);
+}
+
+typedef struct {
+    const char *name;
+    bool jit, lockstep, idle;
+} bench_engine_t;
+
+static const bench_engine_t bench_engines[] = {
+    { "interpreter", false, false, false },
+    { "idle",        false, false, true  }, // the interpreter fast forwarding the idle loops
+#if defined(__x86_64__)
+    { "jit",         true,  false, false },
+#endif
+    { "lockstep",    false, true,  false },
+};
+
+// LOCKSTEP_LANES instances of the rom with different seeds, one thread: the numbers are per core
+static bool bench_rom(const char *name, const batch_rom_t *rom, const bench_opts_t *opts, bool *first) {
+
+    batch_job_t jobs[LOCKSTEP_LANES];
+
+    for (size_t e = 0; e < sizeof(bench_engines) / sizeof(bench_engines[0]); ++e) {
+
+        const batch_opts_t bopts = {
+            .threads  = 1,
+            .ipf      = HEADLESS_IPF,
+            .jit      = bench_engines[e].jit,
+            .lockstep = bench_engines[e].lockstep,
+            .idle     = bench_engines[e].idle,
+        };
+
+        double best = 0;
+        uint64_t cycles = 0;
+
+        for (uint32_t r = 0; r < opts->repeat; ++r) {
+
+            for (uint32_t j = 0; j < LOCKSTEP_LANES; ++j)
+                jobs[j] = (batch_job_t){ .rom = rom, .max_cycles = opts->cycles, .seed = j + 1 };
+
+            const int64_t beg = bench_now();
+            if (!batch_run(jobs, LOCKSTEP_LANES, &bopts))
+                return false;
+
+            const double seconds = (bench_now() - beg) / 1.0e9;
+            if (!r || seconds < best) best = seconds;
+
+            cycles = 0;
+            for (uint32_t j = 0; j < LOCKSTEP_LANES; ++j)
+                cycles += jobs[j].result.cycles;
+        }
+
+        json_item(first);
+        printf("    { \"rom\": \"%s\", \"engine\": \"%s\", \"instances\": %d, \"cycles\": %llu, \"seconds\": %.6f, "
+            "\"ns_per_op\": %.3f, \"ips\": %.0f, \"ok\": %s, \"screen_hash\": \"%016llx\" }",
+            name, bench_engines[e].name, LOCKSTEP_LANES, (unsigned long long)cycles, best,
+            best * 1.0e9 / cycles, cycles / best, jobs[0].ok ? "true" : "false", (unsigned long long)jobs[0].screen_hash
+        );
+    }
+
+    return true;
+}
+
+static bool bench_roms_run(char **paths, int paths_len, const bench_opts_t *opts) {
+
+    batch_rom_t *rom;
+    if (!(rom = calloc(1, sizeof(batch_rom_t)))) // ipf, quirks: the ones of opts
+        return false;
+
+    bool ok = true, first = true;
+    printf("  \"roms\": [");
+
+    for (size_t i = 0; ok && i < BENCH_ROMS_LEN; ++i) {
+        memcpy(rom->data, bench_roms[i].data, bench_roms[i].size);
+        rom->size = bench_roms[i].size;
+        ok = bench_rom(bench_roms[i].name, rom, opts, &first);
+    }
+
+    for (int i = 0; ok && i < paths_len; ++i) {
+        if (!(rom->size = chip_read_rom(paths[i], rom->data))) {
+            fprintf(stderr, "cannot load the rom \"%s\"\n", paths[i]);
+            ok = false;
+            break;
+        }
+        ok = bench_rom(paths[i], rom, opts, &first);
+    }
+
+    printf("\n  ]\n");
+    free(rom);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+
+    bench_opts_t opts = { .iters = BENCH_ITERS, .repeat = BENCH_REPEAT, .cycles = BENCH_CYCLES };
+    bool quick = false;
+
+    for (int opt; (opt = getopt(argc, argv, "qr:c:")) != -1; ) {
+        switch (opt) {
+            case 'q': quick = true; break;
+            case 'r': opts.repeat = strtoul(optarg, NULL, 10); break;
+            case 'c': opts.cycles = strtoull(optarg, NULL, 10); break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (!opts.repeat || !opts.cycles) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (quick) {
+        opts.iters  /= 16;
+        opts.cycles  = opts.cycles / 16 ? opts.cycles / 16 : 1;
+    }
+
+    chip8_t *chip;
+    if (!(chip = chip_new())) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("{\n");
+    printf("  \"config\": { \"iters\": %u, \"repeat\": %u, \"cycles\": %llu, \"ipf\": %d, \"lanes\": %d },\n",
+        opts.iters, opts.repeat, (unsigned long long)opts.cycles, HEADLESS_IPF, LOCKSTEP_LANES
+    );
+
+    bench_opcodes(chip, &opts);
+    bench_dispatch(chip, &opts);
+    bench_framebuffer(&opts);
+    const bool ok = bench_roms_run(argv + optind, argc - optind, &opts);
+    printf("}\n");
+
+    chip_free(chip);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
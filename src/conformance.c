@@ -0,0 +1,378 @@
+#define _DEFAULT_SOURCE // required by endianness functions like be16toh()
+
+#include <chip8.h>
+#include <batch.h>
+#include <bench_roms.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [-t threads] [-j | -l] [-n] [-o dir] [-u] manifest.txt\n"
+        "  -t  worker threads (default one per cpu)\n"
+        "  -j  run through the jit\n"
+        "  -l  run through lockstep, %d jobs per vector\n"
+        "      (-j and -l only with the default quirks, the other roms run in the interpreter)\n"
+        "  -n  don't fast forward the idle loops of the interpreter (same results, only slower)\n"
+        "  -o  where the frames which don't match are written as ppm (default the current directory)\n"
+        "  -u  print the manifest again with the hashes of this run, es. the golden ones of a new rom\n"
+        "\n"
+        "one rom per line: rom quirks ipf frame=hash[,frame=hash...] [frame:key:down|up,... | -] [seed], '#' starts a comment.\n"
+        "  rom    path relative to the manifest, or @name for the roms of chip8_bench (@alu, @draw, @bcd, @calls, @timer, @scroll)\n"
+        "  hash   of the screen after that many frames (the one of chip8_headless), '?' when not known yet\n",
+        argv0, LOCKSTEP_LANES
+    );
+}
+
+typedef struct {
+    uint32_t frame;
+    uint64_t hash;
+    bool known;
+} checkpoint_t;
+
+// a line of the manifest, each checkpoint is a batch job of its own
+typedef struct {
+    char *name;        // as written
+    char *script;      // the keys as written, NULL -> none
+    batch_rom_t *rom;  // ipf and quirks of the line
+    key_event_t *keys;
+    size_t keys_len;
+    uint64_t seed;
+
+    checkpoint_t *checks;
+    size_t checks_len;
+    uint32_t first_job;
+} entry_t;
+
+typedef struct {
+    entry_t *entries;
+    size_t entries_len;
+    batch_job_t *jobs;
+    uint32_t jobs_len;
+} manifest_t;
+
+
+// @name: a rom of bench_roms.h, otherwise a path relative to the directory of the manifest
+static bool manifest_load_rom(batch_rom_t *rom, const char *name, const char *manifest) {
+
+    if (*name == '@') {
+        for (size_t i = 0; i < BENCH_ROMS_LEN; ++i) {
+            if (strcmp(bench_roms[i].name, name + 1)) continue;
+            memcpy(rom->data, bench_roms[i].data, bench_roms[i].size);
+            rom->size = bench_roms[i].size;
+            return true;
+        }
+        return false;
+    }
+
+    char path[4096];
+    const char *slash = strrchr(manifest, '/');
+    if (*name == '/' || !slash) snprintf(path, sizeof(path), "%s", name);
+    else snprintf(path, sizeof(path), "%.*s/%s", (int)(slash - manifest), manifest, name);
+
+    return (rom->size = chip_read_rom(path, rom->data));
+}
+
+// "frame=hash,..." sorted as written
+static bool checkpoints_parse(const char *list, checkpoint_t **checks, size_t *len) {
+
+    for (const char *p = list; *p; ) {
+
+        char *end;
+        const unsigned long frame = strtoul(p, &end, 10);
+        if (end == p || !frame || *end != '=')
+            return false;
+
+        checkpoint_t c = { .frame = frame };
+        p = end + 1;
+
+        if (*p == '?') {
+            ++p;
+        } else {
+            c.hash  = strtoull(p, &end, 16);
+            c.known = end != p;
+            if (!c.known) return false;
+            p = end;
+        }
+
+        if (*p == ',') ++p;
+        else if (*p) return false;
+
+        checkpoint_t *tmp;
+        if (!(tmp = realloc(*checks, (*len + 1) * sizeof(checkpoint_t))))
+            return false;
+
+        *checks = tmp;
+        (*checks)[(*len)++] = c;
+    }
+
+    return *len;
+}
+
+static bool manifest_entry(manifest_t *self, char *line, const char *fpath, size_t lineno) {
+
+    char *save;
+    const char *name   = strtok_r(line, " \t\r\n", &save);
+    if (!name) return true;
+
+    const char *quirks = strtok_r(NULL, " \t\r\n", &save);
+    const char *ipf    = strtok_r(NULL, " \t\r\n", &save);
+    const char *checks = strtok_r(NULL, " \t\r\n", &save);
+    const char *script = strtok_r(NULL, " \t\r\n", &save);
+    const char *seed   = strtok_r(NULL, " \t\r\n", &save);
+
+    entry_t *tmp;
+    if (!(tmp = realloc(self->entries, (self->entries_len + 1) * sizeof(entry_t))))
+        return false;
+
+    self->entries = tmp;
+    entry_t *e = self->entries + self->entries_len++;
+    memset(e, 0x00, sizeof(*e));
+
+    if (script && !strcmp(script, "-"))
+        script = NULL;
+
+    chip_quirks_t q = quirks ? chip_quirks_parse(quirks) : CHIP_QUIRKS_LEN;
+    const unsigned long i = ipf ? strtoul(ipf, NULL, 10) : 0;
+
+    if (q == CHIP_QUIRKS_LEN || !i || i > UINT16_MAX || !checks || !checkpoints_parse(checks, &e->checks, &e->checks_len)
+        || (script && !keyscript_parse(script, &e->keys, &e->keys_len))) {
+        fprintf(stderr, "%s:%zu: malformed line\n", fpath, lineno);
+        return false;
+    }
+
+    e->seed = seed ? strtoull(seed, NULL, 10) : 0;
+    if (!(e->name = strdup(name)) || (script && !(e->script = strdup(script))) || !(e->rom = calloc(1, sizeof(batch_rom_t))))
+        return false;
+
+    e->rom->ipf    = i;
+    e->rom->quirks = q;
+
+    if (!manifest_load_rom(e->rom, name, fpath)) {
+        fprintf(stderr, "%s:%zu: cannot load the rom \"%s\"\n", fpath, lineno, name);
+        return false;
+    }
+
+    return true;
+}
+
+static bool manifest_read(manifest_t *self, const char *fpath) {
+
+    FILE *file;
+    if (!(file = fopen(fpath, "r"))) {
+        fprintf(stderr, "cannot open the manifest \"%s\"\n", fpath);
+        return false;
+    }
+
+    bool ok = true;
+    char *line = NULL;
+    size_t line_cap = 0;
+
+    for (size_t lineno = 1; ok && getline(&line, &line_cap, file) != -1; ++lineno) {
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        ok = manifest_entry(self, line, fpath, lineno);
+    }
+
+    free(line);
+    fclose(file);
+
+    for (size_t e = 0; ok && e < self->entries_len; ++e)
+        self->jobs_len += self->entries[e].checks_len;
+
+    if (!ok || !(self->jobs = calloc(self->jobs_len ? self->jobs_len : 1, sizeof(batch_job_t))))
+        return false;
+
+    // every checkpoint runs from the beginning: the jobs are independent, so they spread on every core
+    uint32_t j = 0;
+    for (size_t e = 0; e < self->entries_len; ++e) {
+        entry_t *entry = self->entries + e;
+        entry->first_job = j;
+        for (size_t c = 0; c < entry->checks_len; ++c)
+            self->jobs[j++] = (batch_job_t){
+                .rom        = entry->rom,
+                .keys       = entry->keys,
+                .keys_len   = entry->keys_len,
+                .max_cycles = (uint64_t)entry->checks[c].frame * entry->rom->ipf,
+                .seed       = entry->seed,
+            };
+    }
+
+    return true;
+}
+
+static void manifest_free(manifest_t *self) {
+
+    for (size_t e = 0; e < self->entries_len; ++e) {
+        free(self->entries[e].name);
+        free(self->entries[e].script);
+        free(self->entries[e].rom);
+        free(self->entries[e].keys);
+        free(self->entries[e].checks);
+    }
+
+    free(self->entries);
+    free(self->jobs);
+}
+
+
+// the screen as it's shown (the lo-res one is its top left quarter), binary ppm
+static bool screen_write_ppm(const batch_screen_t *screen, const char *path) {
+
+    FILE *file;
+    if (!(file = fopen(path, "wb")))
+        return false;
+
+    const uint16_t width  = screen->hires ? SCREEN_WIDTH  : SCREEN_LORES_WIDTH;
+    const uint16_t height = screen->hires ? SCREEN_HEIGHT : SCREEN_LORES_HEIGHT;
+    bool ok = fprintf(file, "P6\n%u %u\n255\n", width, height) > 0;
+
+    for (uint16_t r = 0; ok && r < height; ++r) {
+
+        uint32_t argb[SCREEN_WIDTH];
+        uint8_t rgb[SCREEN_WIDTH * 3];
+
+        for (uint16_t w = 0; w < width / 64; ++w) {
+            uint64_t word[SCREEN_PLANES];
+            for (uint8_t p = 0; p < SCREEN_PLANES; ++p)
+                word[p] = screen->planes_used >> p & 1 ? screen->plane[p][r][w] : 0;
+            screen_planes_to_argb8888(argb + w * 64, word);
+        }
+
+        for (uint16_t x = 0; x < width; ++x) {
+            rgb[x * 3]     = argb[x] >> 16;
+            rgb[x * 3 + 1] = argb[x] >> 8;
+            rgb[x * 3 + 2] = argb[x];
+        }
+
+        ok = fwrite(rgb, 3, width, file) == width;
+    }
+
+    return !fclose(file) && ok;
+}
+
+// the job again, alone and with the same engine, to get the screen which didn't match: only for the failures
+static bool checkpoint_dump(const batch_job_t *failed, const batch_opts_t *opts, const char *path) {
+
+    batch_screen_t *screen;
+    if (!(screen = malloc(sizeof(batch_screen_t))))
+        return false;
+
+    batch_job_t job = *failed;
+    job.screen = screen;
+
+    const batch_opts_t one = { .threads = 1, .ipf = opts->ipf, .jit = opts->jit, .lockstep = opts->lockstep, .idle = opts->idle };
+    const bool ok = batch_run(&job, 1, &one) && job.ok && screen_write_ppm(screen, path);
+
+    free(screen);
+    return ok;
+}
+
+// es. "@timer", "suite/3-corax+.ch8" -> "timer", "3-corax+"
+static void ppm_path(char *path, size_t len, const char *dir, const entry_t *entry, const checkpoint_t *check) {
+
+    const char *name = strrchr(entry->name, '/');
+    name = name ? name + 1 : entry->name + (*entry->name == '@');
+
+    const char *ext = strrchr(name, '.');
+    const int name_len = ext && ext != name ? (int)(ext - name) : (int)strlen(name);
+
+    snprintf(path, len, "%s/%.*s-%s-%u.ppm", dir, name_len, name, chip_quirks_names[entry->rom->quirks], check->frame);
+}
+
+int main(int argc, char *argv[]) {
+
+    batch_opts_t opts = { .ipf = HEADLESS_IPF, .idle = true };
+    const char *dump_dir = ".";
+    bool update = false;
+
+    for (int opt; (opt = getopt(argc, argv, "t:jlno:u")) != -1; ) {
+        switch (opt) {
+            case 't': opts.threads  = strtoul(optarg, NULL, 10); break;
+            case 'j': opts.jit      = true; break;
+            case 'l': opts.lockstep = true; break;
+            case 'n': opts.idle     = false; break;
+            case 'o': dump_dir      = optarg; break;
+            case 'u': update        = true; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    manifest_t mf = {0};
+    if (!manifest_read(&mf, argv[optind])) {
+        manifest_free(&mf);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec beg, end;
+    clock_gettime(CLOCK_MONOTONIC, &beg);
+
+    if (!batch_run(mf.jobs, mf.jobs_len, &opts)) {
+        fprintf(stderr, "cannot setup the thread pool\n");
+        manifest_free(&mf);
+        return EXIT_FAILURE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds = (end.tv_sec - beg.tv_sec) + (end.tv_nsec - beg.tv_nsec) / 1.0e9;
+
+    uint32_t failed = 0, unknown = 0;
+    for (size_t e = 0; e < mf.entries_len; ++e) {
+
+        const entry_t *entry = mf.entries + e;
+        if (update) printf("%s %s %u ", entry->name, chip_quirks_names[entry->rom->quirks], entry->rom->ipf);
+
+        for (size_t c = 0; c < entry->checks_len; ++c) {
+
+            const checkpoint_t *check = entry->checks + c;
+            const batch_job_t *job = mf.jobs + entry->first_job + c;
+
+            if (update) {
+                printf(job->ok ? "%s%u=%016llx" : "%s%u=?", c ? "," : "", check->frame, (unsigned long long)job->screen_hash);
+                continue;
+            }
+
+            if (!check->known) {
+                unknown++;
+                printf("?    %s %s frame %u: %016llx\n", entry->name, chip_quirks_names[entry->rom->quirks], check->frame, (unsigned long long)job->screen_hash);
+                continue;
+            }
+
+            if (job->ok && job->screen_hash == check->hash) {
+                printf("ok   %s %s frame %u\n", entry->name, chip_quirks_names[entry->rom->quirks], check->frame);
+                continue;
+            }
+
+            failed++;
+            char path[4096];
+            ppm_path(path, sizeof(path), dump_dir, entry, check);
+
+            const bool dumped = job->ok && checkpoint_dump(job, &opts, path);
+            printf("FAIL %s %s frame %u: %016llx expected %016llx%s%s\n",
+                entry->name, chip_quirks_names[entry->rom->quirks], check->frame,
+                (unsigned long long)job->screen_hash, (unsigned long long)check->hash, dumped ? ", screen in " : "", dumped ? path : ""
+            );
+        }
+
+        if (update) printf(" %s %llu\n", entry->script ? entry->script : "-", (unsigned long long)entry->seed);
+    }
+
+    fprintf(stderr, "roms: %zu checkpoints: %u failed: %u unknown: %u seconds: %.3f\n",
+        mf.entries_len, mf.jobs_len, failed, unknown, seconds
+    );
+
+    manifest_free(&mf);
+    return update || (!failed && !unknown) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define CHIP_OPCODES_GENERATOR
+#include <opcodes.h>
+
+/*
+ Build time only (cmake runs it before every other target): writes opcode_table.h, the OP_xxx of all the 65536 opcodes.
+ es. ./chip8_gen_opcodes build/generated/opcode_table.h
+*/
+
+int main(int argc, char *argv[]) {
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <opcode_table.h>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out;
+    if (!(out = fopen(argv[1], "w"))) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out,
+        "// generated by src/gen_opcodes.c from op_classify() of include/opcodes.h, do not edit\n"
+        "#pragma once\n\n"
+        "alignas(64) static const uint8_t chip_opcode_table[0xffff + 1] = {\n"
+    );
+
+    for (uint32_t data = 0; data <= 0xffff; data += 16) {
+
+        if (!(data & 0xfff))
+            fprintf(out, "\n    // %X...\n", data >> 12);
+
+        fprintf(out, "    ");
+        for (uint32_t i = 0; i < 16; ++i)
+            fprintf(out, "%2u,", op_classify((instr_t){ .data = (uint16_t)(data + i) }));
+
+        fprintf(out, " // %04X\n", data);
+    }
+
+    fprintf(out, "};\n");
+
+    if (fclose(out)) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,304 @@
+#define _DEFAULT_SOURCE // required by endianness functions like be16toh()
+
+#include <chip8.h>
+#include <headless.h>
+#include <savestate.h>
+#include <rompack.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [-c cycles | -f frames] [-i instructions-per-frame] [-k frame:key:down|up,...] [-s seed] [-q quirks] [-j] [-n] [-L state] [-S state] [-P pack] [-M movie | -m movie] [-V | --record [y4m:|raw:|rle:]video] /path/your-rom.ch8\n"
+        "  -c  stop after this many instructions\n"
+        "  -f  stop after this many 60 Hz frames (default 600)\n"
+        "  -i  instructions per frame, the timers tick once per frame (default %d)\n"
+        "  -k  scripted key events, es. 60:5:down,64:5:up (can be repeated)\n"
+        "  -s  seed of the CXNN random numbers (default 0)\n"
+        "  -q  quirk profile: default, chip8, schip or xochip (see include/quirks.h)\n"
+        "  -j  run through the jit (default quirks only, otherwise the interpreter)\n"
+        "  -n  don't fast forward the idle loops (same results, only slower)\n"
+        "  -L  start from a save state of this rom (the key script frames count from there)\n"
+        "  -S  save the state at the end\n"
+        "  -P  the rom is a name (or an xxh64) in this rom pack (chip8_rompack), its ipf and quirks are the default of -i and -q\n"
+        "  -M  record the keys into this movie (-c is rounded down to whole frames)\n"
+        "  -m  play this movie back: its keys, seed, ipf and quirks, till its last frame unless -c or -f, exit failure if it ends elsewhere\n"
+        "  -V  every frame into this video (see include/video.h), \"|command\" pipes it es. \"|ffmpeg -i - out.mp4\"\n"
+#ifdef CHIP_PROFILE
+        "  -p  profile the run into prefix.folded (flamegraph.pl input) and prefix.json\n"
+#endif
+#ifdef CHIP_TRACE
+        "  -t  binary trace of every instruction into this file (chip8_trace_decode), implies -n\n"
+#endif
+        , argv0, HEADLESS_IPF
+    );
+}
+
+#ifdef CHIP_PROFILE
+static bool headless_dump_profile(const chip8_t *chip, const char *prefix) {
+
+    char path[4096];
+    FILE *file;
+    bool ok = true;
+
+    snprintf(path, sizeof(path), "%s.folded", prefix);
+    if ((file = fopen(path, "w"))) {
+        chip_profile_folded(chip->profile, file);
+        ok = !fclose(file) && ok;
+    } else ok = false;
+
+    snprintf(path, sizeof(path), "%s.json", prefix);
+    if ((file = fopen(path, "w"))) {
+        chip_profile_json(chip->profile, chip->memory, file);
+        ok = !fclose(file) && ok;
+    } else ok = false;
+
+    if (!ok) fprintf(stderr, "cannot write the profile \"%s.{folded,json}\"\n", prefix);
+    return ok;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+
+    headless_opts_t opts = {0};
+    key_event_t *keys = NULL;
+    uint64_t cycles = 0, frames = 600, seed = 0;
+    bool use_jit = false, idle = true;
+    bool frames_given = false;
+    const char *load_state = NULL, *save_state = NULL, *profile = NULL, *trace = NULL, *pack_path = NULL;
+    const char *record_path = NULL, *replay_path = NULL, *video_spec = NULL;
+    chip_quirks_t quirks = CHIP_QUIRKS_LEN; // -> the one of the pack or the default
+
+    static const struct option long_opts[] = { { "record", required_argument, NULL, 'V' }, {0} };
+
+    for (int opt; (opt = getopt_long(argc, argv, "c:f:i:k:s:q:jnL:S:P:M:m:V:p:t:", long_opts, NULL)) != -1; ) {
+        switch (opt) {
+            case 'c': cycles   = strtoull(optarg, NULL, 10); frames_given = true; break;
+            case 'f': frames   = strtoull(optarg, NULL, 10); frames_given = true; break;
+            case 'i': opts.ipf = strtoul(optarg, NULL, 10);  break;
+            case 's': seed     = strtoull(optarg, NULL, 10); break;
+            case 'j': use_jit  = true; break;
+            case 'n': idle     = false; break;
+            case 'L': load_state = optarg; break;
+            case 'S': save_state = optarg; break;
+            case 'P': pack_path  = optarg; break;
+            case 'M': record_path = optarg; break;
+            case 'm': replay_path = optarg; break;
+            case 'V': video_spec  = optarg; break;
+            case 'q':
+                if ((quirks = chip_quirks_parse(optarg)) == CHIP_QUIRKS_LEN) {
+                    fprintf(stderr, "unknown quirk profile: \"%s\"\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+#ifdef CHIP_PROFILE
+            case 'p': profile = optarg; break;
+#endif
+#ifdef CHIP_TRACE
+            case 't': trace = optarg; break;
+#endif
+            case 'k':
+                if (!keyscript_parse(optarg, &keys, &opts.keys_len)) {
+                    fprintf(stderr, "invalid key script: \"%s\"\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc || (record_path && replay_path)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (replay_path && keys) {
+        fprintf(stderr, "a replay takes its keys from the movie, no -k\n");
+        return EXIT_FAILURE;
+    }
+
+    // the recording is opened once the machine is at its first frame
+    movie_t *movie = NULL;
+    if (replay_path && !(movie = movie_replay(replay_path))) {
+        fprintf(stderr, "\"%s\" is not a valid movie\n", replay_path);
+        return EXIT_FAILURE;
+    }
+
+    if (movie) {
+        opts.ipf = movie->header.ipf;
+        quirks   = movie->header.quirks;
+        seed     = movie->header.seed;
+        if (!frames_given) frames = movie->header.frames;
+    }
+
+    rompack_t *pack = NULL;
+    const rompack_entry_t *packed = NULL;
+
+    if (pack_path && !(pack = rompack_open(pack_path))) {
+        fprintf(stderr, "\"%s\" is not a valid rom pack\n", pack_path);
+        return EXIT_FAILURE;
+    }
+
+    if (pack && !(packed = rompack_lookup(pack, argv[optind]))) {
+        fprintf(stderr, "no rom \"%s\" in the pack \"%s\"\n", argv[optind], pack_path);
+        rompack_close(pack);
+        movie_close(movie, NULL);
+        return EXIT_FAILURE;
+    }
+
+    if (!opts.ipf)
+        opts.ipf = packed && le16toh(packed->ipf) ? le16toh(packed->ipf) : HEADLESS_IPF;
+
+    if (quirks == CHIP_QUIRKS_LEN)
+        quirks = packed ? packed->quirks : CHIP_QUIRKS_DEFAULT;
+
+    opts.keys       = keys;
+    opts.max_cycles = cycles ? cycles : frames * opts.ipf;
+    if (record_path) opts.max_cycles -= opts.max_cycles % opts.ipf; // the movie ends with a whole frame
+
+    chip8_t *chip = chip_new();
+    const bool loaded = chip && chip_set_quirks(chip, quirks) && (packed ? chip_load_rom_pack(chip, pack, packed) : chip_load_rom(chip, argv[optind]));
+    rompack_close(pack); // the rom is copied and its metadata read
+
+    if (!loaded) {
+        movie_close(movie, NULL);
+        chip_free(chip);
+        free(keys);
+        return EXIT_FAILURE;
+    }
+
+    chip_seed(chip, seed);
+
+    if (load_state && !chip_load_state(chip, load_state)) {
+        fprintf(stderr, "cannot load the state \"%s\"\n", load_state);
+        movie_close(movie, NULL);
+        chip_free(chip);
+        free(keys);
+        return EXIT_FAILURE;
+    }
+
+    if (record_path && !(movie = movie_record(record_path))) {
+        fprintf(stderr, "cannot write the movie \"%s\"\n", record_path);
+        chip_free(chip);
+        free(keys);
+        return EXIT_FAILURE;
+    }
+
+    if (movie && !movie_start(movie, chip, opts.ipf, seed)) {
+        if (replay_path) fprintf(stderr, "the movie \"%s\" wasn't recorded from this rom (or save state)\n", replay_path);
+        else fprintf(stderr, "cannot write the movie \"%s\"\n", record_path);
+        movie_close(movie, chip);
+        chip_free(chip);
+        free(keys);
+        return EXIT_FAILURE;
+    }
+
+    opts.movie = movie;
+
+    if (use_jit && chip->quirks != CHIP_QUIRKS_DEFAULT) {
+        fprintf(stderr, "the jit has only the default quirks, %s runs in the interpreter\n", chip_quirks_names[chip->quirks]);
+        use_jit = false;
+    }
+
+    opts.jit  = use_jit ? chip_jit_new(chip) : NULL;
+    opts.idle = idle && !opts.jit && !trace; // a trace has every instruction, not a loop fast forwarded
+
+#ifdef CHIP_PROFILE
+    if (profile && !(chip->profile = chip_profile_new())) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    if (profile && use_jit)
+        fprintf(stderr, "only the instructions the jit leaves to the interpreter are profiled\n");
+#endif
+
+#ifdef CHIP_TRACE
+    if (trace && !(chip->trace = chip_trace_new(trace, chip->cycles, chip->V, chip->I, true))) {
+        fprintf(stderr, "cannot write the trace \"%s\"\n", trace);
+        return EXIT_FAILURE;
+    }
+
+    if (trace && use_jit)
+        fprintf(stderr, "only the instructions the jit leaves to the interpreter are traced\n");
+#endif
+
+    // lossless: without a real time to keep the emulation waits the writer instead of dropping frames
+    if (video_spec && !(opts.video = video_new(video_spec, true))) {
+        fprintf(stderr, "cannot write the video \"%s\"\n", video_spec);
+        return EXIT_FAILURE;
+    }
+
+    headless_result_t res;
+    headless_run(chip, &opts, &res);
+
+    printf("rom:    %s\n", argv[optind]);
+    printf("quirks: %s\n", chip_quirks_names[chip->quirks]);
+    printf("cycles: %llu\n", (unsigned long long)res.cycles);
+    printf("frames: %u\n", res.frames);
+    printf("idle:   %llu\n", (unsigned long long)res.idle);
+    printf("screen: %016llx\n", (unsigned long long)chip_screen_hash(chip));
+    char V[BYTE_DUMP_LEN(sizeof(chip->V))];
+    printf("V:      %s\n", byte_dump(V, chip->V, sizeof(chip->V)));
+    printf("I:      %#05x\n", chip->I);
+    printf("PC:     %#05x\n", chip->PC);
+    printf("SP:     %u\n", chip->stack.idx);
+    printf("DT:     %u\n", chip->delay_timer);
+    printf("ST:     %u\n", chip->sound_timer);
+    printf("ips:    %.0f\n", res.seconds > 0 ? res.cycles / res.seconds : 0.);
+
+    if (chip->bad_opcodes.count)
+        fprintf(stderr, "not an opcode: %#06x first, %u executed\n", chip->bad_opcodes.first, chip->bad_opcodes.count);
+
+    if (replay_path) {
+        static const char *const status[] = { [MOVIE_PLAYING] = "playing", [MOVIE_SYNC] = "sync", [MOVIE_DESYNC] = "desync" };
+        printf("movie:  %s (%u of %u frames)\n", status[movie->status], movie->frame, movie->header.frames);
+    }
+
+    bool ok = !save_state || chip_save_state(chip, save_state);
+    if (!ok) fprintf(stderr, "cannot save the state \"%s\"\n", save_state);
+
+    // a replay stopped earlier (-c, -f) isn't a failure, one ended in another state is
+    ok = (!movie || movie->status != MOVIE_DESYNC) && ok;
+    if (!movie_close(movie, chip)) {
+        fprintf(stderr, "cannot write the movie \"%s\"\n", record_path ? record_path : replay_path);
+        ok = false;
+    }
+
+#ifdef CHIP_PROFILE
+    if (profile) {
+        ok = headless_dump_profile(chip, profile) && ok;
+        chip_profile_free(chip->profile);
+    }
+#else
+    (void)profile;
+#endif
+
+#ifdef CHIP_TRACE
+    if (trace) {
+        // lossless, nothing dropped: the run waited the disk instead
+        if (!chip_trace_free(chip->trace)) {
+            fprintf(stderr, "cannot write the trace \"%s\"\n", trace);
+            ok = false;
+        }
+    }
+#else
+    (void)trace;
+#endif
+
+    if (!video_free(opts.video)) {
+        fprintf(stderr, "cannot write the video \"%s\"\n", video_spec);
+        ok = false;
+    }
+
+    chip_jit_free(opts.jit);
+    chip_free(chip);
+    free(keys);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
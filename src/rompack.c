@@ -0,0 +1,285 @@
+#define _DEFAULT_SOURCE // required by endianness functions like be16toh()
+
+#include <chip8.h>
+#include <rompack.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <unistd.h>
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s out.pack manifest.txt\n"
+        "       %s -l in.pack\n"
+        "  -l  list the roms of a pack: hash size ipf quirks keymap names\n"
+        "\n"
+        "one rom per line in the manifest: /path/rom.ch8 [ipf [quirks [keymap]]], '#' starts a comment.\n"
+        "  ipf     preferred instructions per frame (0 -> the default)\n"
+        "  quirks  preferred quirk profile: default, chip8, schip or xochip (see include/quirks.h)\n"
+        "  keymap  16 host keys for the chip-8 keys 0..F, es. x123qweasdzc4rfv\n"
+        "a rom is found by its file name (without the directory) or by the xxh64 of its content, see include/rompack.h\n",
+        argv0, argv0
+    );
+}
+
+typedef struct {
+    char *name;
+    uint8_t data[CHIP_ROM_MAX];
+    rompack_entry_t e; // host byte order till it's written
+    uint32_t rom;      // index in the sorted unique roms
+} pack_rom_t;
+
+// by hash, then by manifest line: a duplicate keeps the metadata of its first line
+static int pack_rom_cmp(const void *a, const void *b) {
+    const pack_rom_t *l = *(const pack_rom_t *const *)a, *r = *(const pack_rom_t *const *)b;
+    if (l->e.hash != r->e.hash) return (l->e.hash > r->e.hash) - (l->e.hash < r->e.hash);
+    return (l > r) - (l < r);
+}
+
+static const char *pack_strings; // qsort() has no context
+
+// by hash, then by name: the same name twice ends up side by side
+static int pack_name_cmp(const void *a, const void *b) {
+    const rompack_name_t *l = a, *r = b;
+    if (l->hash != r->hash) return (l->hash > r->hash) - (l->hash < r->hash);
+    return strcmp(pack_strings + l->name, pack_strings + r->name);
+}
+
+static bool manifest_read(const char *fpath, pack_rom_t **roms, size_t *len) {
+
+    FILE *file;
+    if (!(file = fopen(fpath, "r"))) {
+        fprintf(stderr, "cannot open the manifest \"%s\"\n", fpath);
+        return false;
+    }
+
+    bool ok = true;
+    char *line = NULL;
+    size_t line_cap = 0;
+
+    for (size_t lineno = 1; ok && getline(&line, &line_cap, file) != -1; ++lineno) {
+
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char *save;
+        char *path = strtok_r(line, " \t\r\n", &save);
+        if (!path) continue;
+
+        const char *ipf    = strtok_r(NULL, " \t\r\n", &save);
+        const char *quirks = strtok_r(NULL, " \t\r\n", &save);
+        const char *keymap = strtok_r(NULL, " \t\r\n", &save);
+
+        pack_rom_t *tmp;
+        if (!(tmp = realloc(*roms, (*len + 1) * sizeof(pack_rom_t)))) {
+            ok = false;
+            break;
+        }
+
+        *roms = tmp;
+        pack_rom_t *r = *roms + *len;
+        memset(r, 0x00, sizeof(*r));
+
+        const unsigned long ipf_v = ipf ? strtoul(ipf, NULL, 10) : 0;
+        const chip_quirks_t quirks_v = quirks ? chip_quirks_parse(quirks) : CHIP_QUIRKS_DEFAULT;
+        if (ipf_v > UINT16_MAX || quirks_v == CHIP_QUIRKS_LEN || (keymap && strlen(keymap) != sizeof(r->e.keymap))) {
+            fprintf(stderr, "%s:%zu: malformed rom\n", fpath, lineno);
+            ok = false;
+            break;
+        }
+
+        const size_t size = chip_read_rom(path, r->data);
+        if (!size || !(r->name = strdup(basename(path)))) {
+            fprintf(stderr, "%s:%zu: cannot load the rom \"%s\"\n", fpath, lineno, path);
+            ok = false;
+            break;
+        }
+
+        r->e.hash   = xxh64(r->data, size, 0);
+        r->e.size   = size;
+        r->e.ipf    = ipf_v;
+        r->e.quirks = quirks_v;
+        if (keymap) memcpy(r->e.keymap, keymap, sizeof(r->e.keymap));
+
+        ++*len;
+    }
+
+    free(line);
+    fclose(file);
+    return ok;
+}
+
+static bool pack_write(const char *fpath, pack_rom_t *roms, size_t len) {
+
+    pack_rom_t **sorted = malloc(len * sizeof(pack_rom_t *));
+    rompack_name_t *names = calloc(len, sizeof(rompack_name_t));
+    rompack_entry_t *index = calloc(len, sizeof(rompack_entry_t));
+    char *strings = NULL;
+    FILE *file = NULL;
+    bool ok = false;
+
+    uint64_t strings_len = 0;
+    for (size_t i = 0; i < len; ++i)
+        strings_len += strlen(roms[i].name) + 1;
+
+    if (!sorted || !names || !index || !(strings = malloc(strings_len)))
+        goto out;
+
+    // the unique roms sorted by hash
+    for (size_t i = 0; i < len; ++i)
+        sorted[i] = roms + i;
+
+    qsort(sorted, len, sizeof(pack_rom_t *), pack_rom_cmp);
+
+    uint32_t unique = 0;
+    uint64_t offset = 0; // of the data, from the beginning of the data for now
+    for (size_t i = 0; i < len; ++i) {
+        if (i && sorted[i]->e.hash == sorted[i - 1]->e.hash) {
+            if (sorted[i]->e.size != sorted[i - 1]->e.size || memcmp(sorted[i]->data, sorted[i - 1]->data, sorted[i]->e.size))
+                fprintf(stderr, "xxh64 collision between \"%s\" and \"%s\", only the first one is kept\n", sorted[i - 1]->name, sorted[i]->name);
+            sorted[i]->rom = sorted[i - 1]->rom;
+            continue;
+        }
+
+        sorted[i]->rom = unique;
+        index[unique] = sorted[i]->e;
+        index[unique].offset = offset;
+        offset += sorted[i]->e.size;
+        ++unique;
+    }
+
+    // every name, the same name twice is ambiguous
+    for (size_t i = 0, at = 0; i < len; ++i) {
+        const size_t n = strlen(roms[i].name) + 1;
+        memcpy(strings + at, roms[i].name, n);
+        names[i] = (rompack_name_t){ .hash = xxh64(roms[i].name, n - 1, 0), .name = at, .rom = roms[i].rom };
+        at += n;
+    }
+
+    pack_strings = strings;
+    qsort(names, len, sizeof(rompack_name_t), pack_name_cmp);
+
+    for (size_t i = 1; i < len; ++i)
+        if (!pack_name_cmp(names + i - 1, names + i)) {
+            fprintf(stderr, "the name \"%s\" is used twice, rename one of the roms\n", strings + names[i].name);
+            goto out;
+        }
+
+    const uint64_t data = sizeof(rompack_header_t) + unique * sizeof(rompack_entry_t) + len * sizeof(rompack_name_t) + strings_len;
+    if (data + offset > UINT32_MAX) {
+        fprintf(stderr, "the pack would be larger than 4 GB\n");
+        goto out;
+    }
+
+    rompack_header_t header = {
+        .magic      = ROMPACK_MAGIC,
+        .version    = htole32(ROMPACK_VERSION),
+        .roms       = htole32(unique),
+        .names      = htole32(len),
+        .index      = htole64(sizeof(rompack_header_t)),
+        .name_index = htole64(sizeof(rompack_header_t) + unique * sizeof(rompack_entry_t)),
+        .strings    = htole64(sizeof(rompack_header_t) + unique * sizeof(rompack_entry_t) + len * sizeof(rompack_name_t)),
+    };
+
+    if (!(file = fopen(fpath, "wb"))) {
+        fprintf(stderr, "cannot write the pack \"%s\"\n", fpath);
+        goto out;
+    }
+
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (uint32_t r = 0; ok && r < unique; ++r) {
+        rompack_entry_t e = index[r];
+        e.hash   = htole64(e.hash);
+        e.offset = htole32(data + e.offset);
+        e.size   = htole16(e.size);
+        e.ipf    = htole16(e.ipf);
+        ok = fwrite(&e, sizeof(e), 1, file) == 1;
+    }
+
+    for (size_t i = 0; ok && i < len; ++i) {
+        rompack_name_t n = { .hash = htole64(names[i].hash), .name = htole32(names[i].name), .rom = htole32(names[i].rom) };
+        ok = fwrite(&n, sizeof(n), 1, file) == 1;
+    }
+
+    ok = ok && fwrite(strings, strings_len, 1, file) == 1;
+
+    // the first line of every unique rom, in index order
+    for (size_t i = 0; ok && i < len; ++i)
+        if (!i || sorted[i]->rom != sorted[i - 1]->rom)
+            ok = fwrite(sorted[i]->data, sorted[i]->e.size, 1, file) == 1;
+
+    ok = !fclose(file) && ok;
+    if (!ok) fprintf(stderr, "cannot write the pack \"%s\"\n", fpath);
+    else fprintf(stderr, "%zu roms, %u unique, %llu bytes\n", len, unique, (unsigned long long)(data + offset));
+
+out:
+    free(strings);
+    free(index);
+    free(names);
+    free(sorted);
+    return ok;
+}
+
+static bool pack_list(const char *fpath) {
+
+    rompack_t *pack;
+    if (!(pack = rompack_open(fpath))) {
+        fprintf(stderr, "\"%s\" is not a valid rom pack\n", fpath);
+        return false;
+    }
+
+    for (uint32_t r = 0; r < pack->roms_len; ++r) {
+        const rompack_entry_t *e = pack->roms + r;
+        printf("%016llx %4u %4u %-7s %.16s", (unsigned long long)le64toh(e->hash), rompack_size(e), le16toh(e->ipf), chip_quirks_names[e->quirks], *e->keymap ? e->keymap : "-");
+
+        for (uint32_t n = 0; n < pack->names_len; ++n)
+            if (le32toh(pack->names[n].rom) == r)
+                printf(" %s", pack->strings + le32toh(pack->names[n].name));
+
+        printf("\n");
+    }
+
+    rompack_close(pack);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+
+    bool list = false;
+    for (int opt; (opt = getopt(argc, argv, "l")) != -1; ) {
+        switch (opt) {
+            case 'l': list = true; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != (list ? 1 : 2)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (list)
+        return pack_list(argv[optind]) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    pack_rom_t *roms = NULL;
+    size_t len = 0;
+
+    bool ok = manifest_read(argv[optind + 1], &roms, &len);
+    if (ok && !len) {
+        fprintf(stderr, "no roms in the manifest\n");
+        ok = false;
+    }
+
+    ok = ok && pack_write(argv[optind], roms, len);
+
+    for (size_t i = 0; i < len; ++i)
+        free(roms[i].name);
+    free(roms);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,138 @@
+#define _DEFAULT_SOURCE // required by endianness functions like be16toh()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <dbg.h>
+#include <trace.h>
+
+/*
+ A trace written by chip8_headless -t (include/trace.h) as text, one instruction per line with the mnemonic
+ of dump_instruction() and, below, what it changed.
+ es. ./chip8_trace_decode pong.trace | less
+*/
+
+// one record of the file (include/trace.h) as it is after decoding: the registers are the whole ones
+typedef struct {
+    uint64_t cycle;
+    uint16_t pc, opcode, I;
+    uint8_t flags;
+    uint8_t V[16];
+} record_t;
+
+static bool read16(FILE *file, uint16_t *v) {
+    const int lo = getc(file), hi = getc(file);
+    *v = lo | hi << 8;
+    return lo != EOF && hi != EOF;
+}
+
+// the next record on top of the one before (rec), false at the end of the file. truncated is set for an incomplete one
+static bool read_record(FILE *file, record_t *rec, bool *truncated) {
+
+    int c;
+    if ((c = getc(file)) == EOF)
+        return false;
+
+    *truncated = true;
+    rec->flags = c;
+
+    uint64_t delta = 0;
+    for (uint8_t shift = 0; ; shift += 7) {
+        if ((c = getc(file)) == EOF || shift > 63) return false;
+        delta |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) break;
+    }
+
+    rec->cycle += delta;
+    if (!read16(file, &rec->pc) || !read16(file, &rec->opcode))
+        return false;
+
+    if (rec->flags & TRACE_V) {
+        uint16_t mask;
+        if (!read16(file, &mask)) return false;
+        for (uint8_t r = 0; r < 16; ++r)
+            if (mask >> r & 1 && (c = getc(file)) != EOF) rec->V[r] = c;
+        if (c == EOF) return false;
+    }
+
+    if (rec->flags & TRACE_I && !read16(file, &rec->I))
+        return false;
+
+    *truncated = false;
+    return true;
+}
+
+// the registers that differ from the record before
+static void print_changes(const record_t *rec, const uint8_t *V, uint16_t I) {
+
+    if (!memcmp(rec->V, V, sizeof(rec->V)) && rec->I == I && !(rec->flags & TRACE_WAIT))
+        return;
+
+    printf("        ");
+    for (uint8_t r = 0; r < 16; ++r)
+        if (rec->V[r] != V[r]) printf("V%X=%02x ", r, rec->V[r]);
+
+    if (rec->I != I)             printf("I=%03x ", rec->I);
+    if (rec->flags & TRACE_WAIT) printf("(waiting a key)");
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <file.trace>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *file;
+    if (!(file = fopen(argv[1], "rb"))) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    trace_file_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) || le32toh(header.version) != TRACE_VERSION) {
+        fprintf(stderr, "\"%s\" is not a trace of this version\n", argv[1]);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    record_t rec = { .cycle = le64toh(header.cycles), .I = le16toh(header.I) };
+    memcpy(rec.V, header.V, sizeof(rec.V));
+
+    uint8_t V[16];
+    uint16_t I = rec.I;
+    memcpy(V, rec.V, sizeof(V));
+
+    uint64_t records = 0, gaps = 0;
+    bool truncated = false;
+
+    while (read_record(file, &rec, &truncated)) {
+
+        ++records;
+        if (rec.flags & TRACE_GAP) {
+            printf("--- records dropped here, the writer was behind ---\n");
+            ++gaps;
+        }
+
+        if (rec.flags & TRACE_KEY)
+            printf("[%llu] key %X %s\n", (unsigned long long)rec.cycle, rec.pc & 0xf, rec.opcode ? "down" : "up");
+        else {
+            printf("%03x ", rec.pc);
+            dump_instruction(rec.cycle, (instr_t){ .data = rec.opcode });
+        }
+
+        print_changes(&rec, V, I);
+        memcpy(V, rec.V, sizeof(V));
+        I = rec.I;
+    }
+
+    fclose(file);
+    if (truncated)
+        fprintf(stderr, "\"%s\": the record %llu is truncated\n", argv[1], (unsigned long long)records);
+
+    fprintf(stderr, "records: %llu gaps: %llu\n", (unsigned long long)records, (unsigned long long)gaps);
+    return truncated ? EXIT_FAILURE : EXIT_SUCCESS;
+}
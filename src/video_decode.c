@@ -0,0 +1,65 @@
+#define _DEFAULT_SOURCE // required by endianness functions like be16toh()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <video.h>
+
+/*
+ A rle video (include/video.h, es. chip8_headless -V out.ch8v) as y4m on stdout, for an encoder or a player.
+ es. ./chip8_video_decode out.ch8v | ffmpeg -i - out.mp4
+*/
+
+int main(int argc, char *argv[]) {
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <file.ch8v>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *file;
+    if (!(file = fopen(argv[1], "rb"))) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    video_file_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, VIDEO_MAGIC, sizeof(header.magic)) || le32toh(header.version) != VIDEO_VERSION
+        || le16toh(header.width) != SCREEN_WIDTH || le16toh(header.height) != SCREEN_HEIGHT || le16toh(header.fps) != VIDEO_FPS || header.planes != SCREEN_PLANES) {
+        fprintf(stderr, "\"%s\" is not a rle video of this version\n", argv[1]);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    static video_frame_t frame;
+    static uint8_t bits[VIDEO_BITMAP], delta[VIDEO_BITMAP], rle[VIDEO_RLE_MAX], gray[VIDEO_PIXELS];
+
+    bool ok = fwrite(VIDEO_Y4M, strlen(VIDEO_Y4M), 1, stdout) == 1;
+    uint32_t frames = 0;
+
+    for (uint8_t rec[3]; ok && fread(rec, sizeof(rec), 1, file) == 1; ++frames) {
+
+        const size_t size = rec[1] | rec[2] << 8;
+        if (size > sizeof(rle) || fread(rle, size, 1, file) != 1 || !video_unrle(delta, sizeof(delta), rle, size)) {
+            fprintf(stderr, "\"%s\": frame %u is truncated or corrupted\n", argv[1], frames);
+            ok = false;
+            break;
+        }
+
+        for (size_t i = 0; i < sizeof(bits); ++i)
+            bits[i] ^= delta[i];
+
+        video_bits_frame(&frame, bits);
+        frame.hires       = rec[0] & 1;
+        frame.planes_used = rec[0] >> 1;
+        video_frame_gray(gray, &frame);
+
+        ok = fwrite("FRAME\n", 6, 1, stdout) == 1 && fwrite(gray, sizeof(gray), 1, stdout) == 1;
+    }
+
+    fclose(file);
+    fprintf(stderr, "frames: %u\n", frames);
+    return ok && !fflush(stdout) ? EXIT_SUCCESS : EXIT_FAILURE;
+}